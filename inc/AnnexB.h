@@ -0,0 +1,133 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <map>
+
+// helpers to mux the H264/H265 Annex B access units in ISO based containers
+typedef std::pair<const uint8_t*, size_t> Nalu;
+
+inline std::vector<Nalu> splitNalus(const uint8_t* data, size_t size) {
+	std::vector<Nalu> nalus;
+	size_t start = std::string::npos;
+	size_t i = 0;
+	while (i + 3 <= size) {
+		if ( (data[i] == 0) && (data[i+1] == 0) && (data[i+2] == 1) ) {
+			if (start != std::string::npos) {
+				size_t end = i;
+				while ((end > start) && (data[end-1] == 0)) {
+					end--;
+				}
+				nalus.push_back(Nalu(data + start, end - start));
+			}
+			i += 3;
+			start = i;
+		} else {
+			i++;
+		}
+	}
+	if ( (start != std::string::npos) && (start < size) ) {
+		nalus.push_back(Nalu(data + start, size - start));
+	}
+	return nalus;
+}
+
+inline int naluType(const std::string & codec, const Nalu & nalu) {
+	return (codec == "H265") ? ((nalu.first[0] >> 1) & 0x3F) : (nalu.first[0] & 0x1F);
+}
+
+inline void writeParameterSet(std::vector<uint8_t> & out, const Nalu & nalu) {
+	out.push_back((nalu.second >> 8) & 0xFF);
+	out.push_back(nalu.second & 0xFF);
+	out.insert(out.end(), nalu.first, nalu.first + nalu.second);
+}
+
+// AVCDecoderConfigurationRecord
+inline std::vector<uint8_t> getAvcC(const Nalu & sps, const Nalu & pps) {
+	std::vector<uint8_t> avcC = { 1, sps.first[1], sps.first[2], sps.first[3], 0xFF, 0xE1 };
+	writeParameterSet(avcC, sps);
+	avcC.push_back(1);
+	writeParameterSet(avcC, pps);
+	return avcC;
+}
+
+// HEVCDecoderConfigurationRecord, the profile_tier_level is read from the SPS without emulation prevention bytes
+inline std::vector<uint8_t> getHvcC(const Nalu & vps, const Nalu & sps, const Nalu & pps) {
+	std::vector<uint8_t> rbsp;
+	for (size_t i = 0; (i < sps.second) && (rbsp.size() < 15); i++) {
+		if ( (i >= 2) && (sps.first[i] == 3) && (sps.first[i-1] == 0) && (sps.first[i-2] == 0) ) {
+			continue;
+		}
+		rbsp.push_back(sps.first[i]);
+	}
+	std::vector<uint8_t> hvcC;
+	if (rbsp.size() < 15) {
+		return hvcC;
+	}
+	int maxSubLayers = ((rbsp[2] >> 1) & 0x07) + 1;
+	int temporalIdNested = rbsp[2] & 0x01;
+	hvcC.push_back(1);
+	hvcC.insert(hvcC.end(), rbsp.begin() + 3, rbsp.begin() + 15);
+	hvcC.insert(hvcC.end(), { 0xF0, 0x00, 0xFC, 0xFD, 0xF8, 0xF8, 0x00, 0x00 });
+	hvcC.push_back((maxSubLayers << 3) | (temporalIdNested << 2) | 0x03);
+	hvcC.push_back(3);
+	uint8_t types[] = { 32, 33, 34 };
+	const Nalu* nalus[] = { &vps, &sps, &pps };
+	for (int i = 0; i < 3; i++) {
+		hvcC.insert(hvcC.end(), { (uint8_t)(0x80 | types[i]), 0x00, 0x01 });
+		writeParameterSet(hvcC, *nalus[i]);
+	}
+	return hvcC;
+}
+
+// avcC or hvcC from the parameter sets of a key frame, empty when they are missing
+inline std::vector<uint8_t> getDecoderConfiguration(const std::string & codec, const uint8_t* data, size_t size) {
+	std::map<int, Nalu> parameterSets;
+	for (const Nalu & nalu : splitNalus(data, size)) {
+		if (nalu.second > 4) {
+			parameterSets[naluType(codec, nalu)] = nalu;
+		}
+	}
+	std::vector<uint8_t> config;
+	if (codec == "H264") {
+		if ( (parameterSets.find(7) != parameterSets.end()) && (parameterSets.find(8) != parameterSets.end()) ) {
+			config = getAvcC(parameterSets[7], parameterSets[8]);
+		}
+	} else if (codec == "H265") {
+		if ( (parameterSets.find(32) != parameterSets.end()) && (parameterSets.find(33) != parameterSets.end()) && (parameterSets.find(34) != parameterSets.end()) ) {
+			config = getHvcC(parameterSets[32], parameterSets[33], parameterSets[34]);
+		}
+	}
+	return config;
+}
+
+// Annex B to 4 bytes length prefixed NAL units, without the access unit delimiters
+inline std::vector<uint8_t> toLengthPrefixed(const std::string & codec, const uint8_t* data, size_t size) {
+	std::vector<uint8_t> payload;
+	int aud = (codec == "H265") ? 35 : 9;
+	for (const Nalu & nalu : splitNalus(data, size)) {
+		if ( (nalu.second == 0) || (naluType(codec, nalu) == aud) ) {
+			continue;
+		}
+		payload.push_back((nalu.second >> 24) & 0xFF);
+		payload.push_back((nalu.second >> 16) & 0xFF);
+		payload.push_back((nalu.second >> 8) & 0xFF);
+		payload.push_back(nalu.second & 0xFF);
+		payload.insert(payload.end(), nalu.first, nalu.first + nalu.second);
+	}
+	return payload;
+}
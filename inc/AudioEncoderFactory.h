@@ -0,0 +1,39 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "api/audio_codecs/builtin_audio_encoder_factory.h"
+
+#include "NullAudioEncoder.h"
+
+class AudioEncoderFactory : public webrtc::AudioEncoderFactory {
+   public:
+    AudioEncoderFactory(): m_factory(webrtc::CreateBuiltinAudioEncoderFactory()) {}
+    virtual ~AudioEncoderFactory() override {}
+
+    std::vector<webrtc::AudioCodecSpec> GetSupportedEncoders() override { return m_factory->GetSupportedEncoders(); }
+
+    std::optional<webrtc::AudioCodecInfo> QueryAudioEncoder(const webrtc::SdpAudioFormat& format) override { return m_factory->QueryAudioEncoder(format); }
+
+    std::unique_ptr<webrtc::AudioEncoder> Create(const webrtc::Environment& env, const webrtc::SdpAudioFormat& format, Options options) override {
+      std::unique_ptr<webrtc::AudioEncoder> encoder = m_factory->Create(env, format, options);
+      if (encoder && (EncodedAudioFrame::getCodec(format.name) != EncodedAudioFrame::kUnknown)) {
+        RTC_LOG(LS_INFO) << "Create Null Audio Encoder format:" << format.name << "/" << format.clockrate_hz << "/" << format.num_channels;
+        encoder = std::make_unique<NullAudioEncoder>(format, options.payload_type, std::move(encoder));
+      }
+      return encoder;
+    }
+
+   private:
+    webrtc::scoped_refptr<webrtc::AudioEncoderFactory> m_factory;
+};
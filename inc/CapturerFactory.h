@@ -38,19 +38,33 @@
 #include "rtmpvideosource.h"
 #endif
 
+#include "webrtcvideosource.h"
+
 #include "pc/video_track_source.h"
 
 template<class T>
 class TrackSource : public webrtc::VideoTrackSource {
 public:
 	static webrtc::scoped_refptr<TrackSource> Create(const std::string & videourl, const std::map<std::string, std::string> & opts, std::unique_ptr<webrtc::VideoDecoderFactory>& videoDecoderFactory) {
-		std::unique_ptr<T> capturer = absl::WrapUnique(T::Create(videourl, opts, videoDecoderFactory));
+		return Create(absl::WrapUnique(T::Create(videourl, opts, videoDecoderFactory)));
+	}
+
+	static webrtc::scoped_refptr<TrackSource> Create(std::unique_ptr<T> capturer) {
 		if (!capturer) {
 			return nullptr;
 		}
 		return webrtc::make_ref_counted<TrackSource>(std::move(capturer));
 	}
 
+	// the sinks of the PeerConnections are added from the worker thread of their shard
+	void AddOrUpdateSink(webrtc::VideoSinkInterface<webrtc::VideoFrame>* sink, const webrtc::VideoSinkWants& wants) override {
+		source()->AddOrUpdateSink(sink, wants);
+	}
+
+	void RemoveSink(webrtc::VideoSinkInterface<webrtc::VideoFrame>* sink) override {
+		source()->RemoveSink(sink);
+	}
+
 	virtual bool GetStats(Stats* stats) override {
 		bool result = false;
 		T* source =  m_capturer.get();
@@ -169,7 +183,7 @@ class CapturerFactory {
 		return videoList;
 	}
 
-	static webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface> CreateVideoSource(const std::string & videourl, const std::map<std::string,std::string> & opts, const std::regex & publishFilter, webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> peer_connection_factory, std::unique_ptr<webrtc::VideoDecoderFactory>& videoDecoderFactory) {
+	static webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface> CreateVideoSource(const std::string & videourl, const std::map<std::string,std::string> & opts, const std::regex & publishFilter, webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> peer_connection_factory, std::unique_ptr<webrtc::VideoDecoderFactory>& videoDecoderFactory, bool useNullCodec = false) {
 		webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface> videoSource;
 		if ( ((videourl.find("rtsp://") == 0) || (videourl.find("rtsps://") == 0) )  && (std::regex_match("rtsp://", publishFilter))) {
 #ifdef HAVE_LIVE555
@@ -205,9 +219,17 @@ class CapturerFactory {
 			videoSource = TrackSource<RtmpVideoSource>::Create(videourl, opts, videoDecoderFactory);
 #endif 
 		}
+		else if ( ((videourl.find("webrtc://") == 0) || (videourl.find("webrtcs://") == 0)) && (std::regex_match("webrtc://",publishFilter)) ) {
+			videoSource = TrackSource<WebRtcVideoSource>::Create(absl::WrapUnique(WebRtcVideoSource::Create(videourl, opts, peer_connection_factory, useNullCodec)));
+		}
 		else if ((videourl.find("v4l2://") == 0) && (std::regex_match("v4l2://",publishFilter))) {
 #ifdef HAVE_V4L2			
-			videoSource = TrackSource<V4l2Capturer>::Create(videourl, opts, videoDecoderFactory);
+			std::map<std::string,std::string> v4l2opts(opts);
+			if (v4l2opts.find("format") == v4l2opts.end()) {
+				// null codec forwards encoded frames, otherwise prefer raw formats that do not need decoding
+				v4l2opts["format"] = useNullCodec ? "H264" : "NV12,YUYV";
+			}
+			videoSource = TrackSource<V4l2Capturer>::Create(videourl, v4l2opts, videoDecoderFactory);
 #endif			
 		}		
 		else if (std::regex_match("videocap://",publishFilter)) {
@@ -264,26 +286,36 @@ class CapturerFactory {
 		return audioList;
 	}
 
+	// sources created as LiveAudioSource, they could forward encoded audio and do not use the audio device module
+	static bool IsLiveAudioSource(const std::string & audiourl) {
+		return (audiourl.find("rtsp://") == 0) || (audiourl.find("file://") == 0);
+	}
+
 	static webrtc::scoped_refptr<webrtc::AudioSourceInterface> CreateAudioSource(const std::string & audiourl, 
 							const std::map<std::string,std::string> & opts, 
 							const std::regex & publishFilter, 
 							webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> peer_connection_factory,
 							webrtc::scoped_refptr<webrtc::AudioDecoderFactory> audioDecoderfactory,
-							webrtc::scoped_refptr<webrtc::AudioDeviceModule>   audioDeviceModule) {
+							webrtc::scoped_refptr<webrtc::AudioDeviceModule>   audioDeviceModule,
+							bool useNullCodec = false) {
 		webrtc::scoped_refptr<webrtc::AudioSourceInterface> audioSource;
 
+		// live sources forward Opus and G.711 without decoding when the null codec is used
+		std::map<std::string,std::string> audioopts(opts);
+		if (useNullCodec && (audioopts.find("passthrough") == audioopts.end())) {
+			audioopts["passthrough"] = "1";
+		}
+
 		if ( (audiourl.find("rtsp://") == 0) && (std::regex_match("rtsp://",publishFilter)) )
 		{
 	#ifdef HAVE_LIVE555
-			audioDeviceModule->Terminate();
-			audioSource = RTSPAudioSource::Create(audioDecoderfactory, audiourl, opts);
+			audioSource = RTSPAudioSource::Create(audioDecoderfactory, audiourl, audioopts);
 	#endif
 		}
 		else if ( (audiourl.find("file://") == 0) && (std::regex_match("file://",publishFilter)) )
 		{
 	#ifdef HAVE_LIVE555
-			audioDeviceModule->Terminate();
-			audioSource = FileAudioSource::Create(audioDecoderfactory, audiourl, opts);
+			audioSource = FileAudioSource::Create(audioDecoderfactory, audiourl, audioopts);
 	#endif
 		}
 		else if (std::regex_match("audiocap://",publishFilter)) 
@@ -0,0 +1,120 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "absl/strings/match.h"
+
+// encoded audio packets are forwarded to NullAudioEncoder inside the 10ms PCM frames of an audio track
+// a packet is split over as many mono frames as its duration, the last one completes the packet
+class EncodedAudioFrame
+{
+	struct Header
+	{
+		uint16_t m_magic[2];
+		uint16_t m_flags;
+		uint16_t m_size;
+	};
+
+	static const uint16_t kMagic0 = 0x454e;
+	static const uint16_t kMagic1 = 0x4341;
+	static const size_t   kHeaderSamples = sizeof(Header) / sizeof(int16_t);
+
+public:
+	enum Flag
+	{
+		kFirst = 1,
+		kLast  = 2
+	};
+
+	enum Codec
+	{
+		kUnknown = 0,
+		kOpus,
+		kPCMU,
+		kPCMA
+	};
+
+	static Codec getCodec(const std::string &name)
+	{
+		Codec codec = kUnknown;
+		if (absl::EqualsIgnoreCase(name, "opus"))
+		{
+			codec = kOpus;
+		}
+		else if (absl::EqualsIgnoreCase(name, "PCMU"))
+		{
+			codec = kPCMU;
+		}
+		else if (absl::EqualsIgnoreCase(name, "PCMA"))
+		{
+			codec = kPCMA;
+		}
+		return codec;
+	}
+
+	// payload bytes that fit in a frame of samples
+	static size_t capacity(size_t samples)
+	{
+		return (samples > kHeaderSamples) ? (samples - kHeaderSamples) * sizeof(int16_t) : 0;
+	}
+
+	static void write(int16_t *samples, size_t count, Codec codec, int flags, const uint8_t *data, size_t size)
+	{
+		Header header;
+		header.m_magic[0] = kMagic0;
+		header.m_magic[1] = kMagic1;
+		header.m_flags = (codec << 8) | flags;
+		header.m_size = size;
+		memcpy(samples, &header, sizeof(header));
+		memcpy(samples + kHeaderSamples, data, size);
+		memset((uint8_t *)(samples + kHeaderSamples) + size, 0, capacity(count) - size);
+	}
+
+	// read the frame from the first channel of interleaved samples, return false if it is not an encoded frame
+	static bool read(const int16_t *samples, size_t count, size_t channels, Codec &codec, int &flags, std::vector<uint8_t> &payload)
+	{
+		size_t frameSamples = count / channels;
+		if (frameSamples <= kHeaderSamples)
+		{
+			return false;
+		}
+
+		Header header;
+		uint16_t *words = (uint16_t *)&header;
+		for (size_t i = 0; i < kHeaderSamples; i++)
+		{
+			words[i] = samples[i * channels];
+		}
+		if ((header.m_magic[0] != kMagic0) || (header.m_magic[1] != kMagic1) || (header.m_size > capacity(frameSamples)))
+		{
+			return false;
+		}
+		codec = (Codec)(header.m_flags >> 8);
+		flags = header.m_flags & 0xff;
+
+		size_t offset = payload.size();
+		payload.resize(offset + header.m_size);
+		uint8_t *data = payload.data() + offset;
+		for (size_t i = 0; i < header.m_size; i += sizeof(int16_t))
+		{
+			uint16_t word = samples[(kHeaderSamples + i / sizeof(int16_t)) * channels];
+			memcpy(data + i, &word, std::min(sizeof(word), header.m_size - i));
+		}
+		return true;
+	}
+};
@@ -28,9 +28,9 @@ public:
 
   webrtc::SdpVideoFormat getFormat() const { return m_format; }
 
-  webrtc::EncodedImage getEncodedImage(uint32_t rtptime, int ntptime ) const { 
+  webrtc::EncodedImage getEncodedImage(uint32_t rtptime, int64_t ntptime ) const { 
   	webrtc::EncodedImage encoded_image;
-		encoded_image.SetEncodedData(webrtc::EncodedImageBuffer::Create(m_encoded_data->data(), m_encoded_data->size()));
+		encoded_image.SetEncodedData(m_encoded_data);
 		encoded_image._frameType = m_frameType;
 		encoded_image.SetRtpTimestamp(rtptime);
 		encoded_image.ntp_time_ms_ = ntptime;
@@ -0,0 +1,268 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+// helpers to write the fragmented MP4 (CMAF) init segment and fragments of a single H264/H265 track
+const uint32_t kFmp4Timescale = 90000;
+const uint32_t kFmp4TrackId = 1;
+
+struct Fmp4Sample
+{
+	std::vector<uint8_t> m_data;
+	uint32_t             m_duration;
+	bool                 m_keyFrame;
+};
+
+inline void writeU8(std::string & out, uint8_t value) {
+	out.push_back((char)value);
+}
+
+inline void writeU16(std::string & out, uint16_t value) {
+	writeU8(out, value >> 8);
+	writeU8(out, value & 0xFF);
+}
+
+inline void writeU24(std::string & out, uint32_t value) {
+	writeU8(out, (value >> 16) & 0xFF);
+	writeU16(out, value & 0xFFFF);
+}
+
+inline void writeU32(std::string & out, uint32_t value) {
+	writeU16(out, value >> 16);
+	writeU16(out, value & 0xFFFF);
+}
+
+inline void writeU64(std::string & out, uint64_t value) {
+	writeU32(out, value >> 32);
+	writeU32(out, value & 0xFFFFFFFF);
+}
+
+inline void patchU32(std::string & out, size_t offset, uint32_t value) {
+	out[offset]   = (char)(value >> 24);
+	out[offset+1] = (char)((value >> 16) & 0xFF);
+	out[offset+2] = (char)((value >> 8) & 0xFF);
+	out[offset+3] = (char)(value & 0xFF);
+}
+
+// the size of a box is patched when it is closed
+inline size_t beginBox(std::string & out, const char* type) {
+	size_t offset = out.size();
+	writeU32(out, 0);
+	out.append(type, 4);
+	return offset;
+}
+
+inline size_t beginFullBox(std::string & out, const char* type, uint8_t version, uint32_t flags) {
+	size_t offset = beginBox(out, type);
+	writeU8(out, version);
+	writeU24(out, flags);
+	return offset;
+}
+
+inline void endBox(std::string & out, size_t offset) {
+	patchU32(out, offset, out.size() - offset);
+}
+
+inline void writeMatrix(std::string & out) {
+	uint32_t matrix[] = { 0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000 };
+	for (uint32_t value : matrix) {
+		writeU32(out, value);
+	}
+}
+
+// ftyp and moov of a single video track, the samples are described by the fragments
+inline std::string buildFmp4Init(const std::string & codec, const std::vector<uint8_t> & config, int width, int height) {
+	std::string out;
+	size_t ftyp = beginBox(out, "ftyp");
+	out.append("iso6", 4);
+	writeU32(out, 0);
+	out.append("iso6cmfcmp41", 12);
+	endBox(out, ftyp);
+
+	size_t moov = beginBox(out, "moov");
+	size_t mvhd = beginFullBox(out, "mvhd", 0, 0);
+	writeU32(out, 0);
+	writeU32(out, 0);
+	writeU32(out, kFmp4Timescale);
+	writeU32(out, 0);
+	writeU32(out, 0x00010000);
+	writeU16(out, 0x0100);
+	out.append(10, '\0');
+	writeMatrix(out);
+	out.append(24, '\0');
+	writeU32(out, kFmp4TrackId + 1);
+	endBox(out, mvhd);
+
+	size_t trak = beginBox(out, "trak");
+	size_t tkhd = beginFullBox(out, "tkhd", 0, 3);
+	writeU32(out, 0);
+	writeU32(out, 0);
+	writeU32(out, kFmp4TrackId);
+	writeU32(out, 0);
+	writeU32(out, 0);
+	out.append(16, '\0');
+	writeMatrix(out);
+	writeU32(out, width << 16);
+	writeU32(out, height << 16);
+	endBox(out, tkhd);
+
+	size_t mdia = beginBox(out, "mdia");
+	size_t mdhd = beginFullBox(out, "mdhd", 0, 0);
+	writeU32(out, 0);
+	writeU32(out, 0);
+	writeU32(out, kFmp4Timescale);
+	writeU32(out, 0);
+	writeU16(out, 0x55C4);
+	writeU16(out, 0);
+	endBox(out, mdhd);
+	size_t hdlr = beginFullBox(out, "hdlr", 0, 0);
+	writeU32(out, 0);
+	out.append("vide", 4);
+	out.append(12, '\0');
+	out.append("VideoHandler", 13);
+	endBox(out, hdlr);
+
+	size_t minf = beginBox(out, "minf");
+	size_t vmhd = beginFullBox(out, "vmhd", 0, 1);
+	out.append(8, '\0');
+	endBox(out, vmhd);
+	size_t dinf = beginBox(out, "dinf");
+	size_t dref = beginFullBox(out, "dref", 0, 0);
+	writeU32(out, 1);
+	endBox(out, beginFullBox(out, "url ", 0, 1));
+	endBox(out, dref);
+	endBox(out, dinf);
+
+	size_t stbl = beginBox(out, "stbl");
+	size_t stsd = beginFullBox(out, "stsd", 0, 0);
+	writeU32(out, 1);
+	size_t entry = beginBox(out, (codec == "H265") ? "hvc1" : "avc1");
+	out.append(6, '\0');
+	writeU16(out, 1);
+	out.append(16, '\0');
+	writeU16(out, width);
+	writeU16(out, height);
+	writeU32(out, 0x00480000);
+	writeU32(out, 0x00480000);
+	writeU32(out, 0);
+	writeU16(out, 1);
+	out.append(32, '\0');
+	writeU16(out, 0x0018);
+	writeU16(out, 0xFFFF);
+	size_t configBox = beginBox(out, (codec == "H265") ? "hvcC" : "avcC");
+	out.append(config.begin(), config.end());
+	endBox(out, configBox);
+	endBox(out, entry);
+	endBox(out, stsd);
+	const char* tables[] = { "stts", "stsc", "stco" };
+	for (const char* table : tables) {
+		size_t box = beginFullBox(out, table, 0, 0);
+		writeU32(out, 0);
+		endBox(out, box);
+	}
+	size_t stsz = beginFullBox(out, "stsz", 0, 0);
+	writeU32(out, 0);
+	writeU32(out, 0);
+	endBox(out, stsz);
+	endBox(out, stbl);
+	endBox(out, minf);
+	endBox(out, mdia);
+	endBox(out, trak);
+
+	size_t mvex = beginBox(out, "mvex");
+	size_t trex = beginFullBox(out, "trex", 0, 0);
+	writeU32(out, kFmp4TrackId);
+	writeU32(out, 1);
+	writeU32(out, 0);
+	writeU32(out, 0);
+	writeU32(out, 0);
+	endBox(out, trex);
+	endBox(out, mvex);
+	endBox(out, moov);
+	return out;
+}
+
+// moof and mdat of samples with their duration, size and flags, the decode time is the one of the first sample
+inline std::string buildFmp4Fragment(uint32_t sequence, uint64_t decodeTime, const std::vector<Fmp4Sample> & samples) {
+	std::string out;
+	size_t moof = beginBox(out, "moof");
+	size_t mfhd = beginFullBox(out, "mfhd", 0, 0);
+	writeU32(out, sequence);
+	endBox(out, mfhd);
+	size_t traf = beginBox(out, "traf");
+	// default-base-is-moof
+	size_t tfhd = beginFullBox(out, "tfhd", 0, 0x020000);
+	writeU32(out, kFmp4TrackId);
+	endBox(out, tfhd);
+	size_t tfdt = beginFullBox(out, "tfdt", 1, 0);
+	writeU64(out, decodeTime);
+	endBox(out, tfdt);
+	// data-offset, sample-duration, sample-size and sample-flags
+	size_t trun = beginFullBox(out, "trun", 0, 0x000701);
+	writeU32(out, samples.size());
+	size_t dataOffset = out.size();
+	writeU32(out, 0);
+	size_t mdatSize = 8;
+	for (const Fmp4Sample & sample : samples) {
+		writeU32(out, sample.m_duration);
+		writeU32(out, sample.m_data.size());
+		writeU32(out, sample.m_keyFrame ? 0x02000000 : 0x01010000);
+		mdatSize += sample.m_data.size();
+	}
+	endBox(out, trun);
+	endBox(out, traf);
+	endBox(out, moof);
+	patchU32(out, dataOffset, out.size() - moof + 8);
+	writeU32(out, mdatSize);
+	out.append("mdat", 4);
+	for (const Fmp4Sample & sample : samples) {
+		out.append(sample.m_data.begin(), sample.m_data.end());
+	}
+	return out;
+}
+
+// RFC 6381 codec of an avcC or hvcC, as expected by MSE and WebCodecs
+inline std::string getCodecString(const std::string & codec, const std::vector<uint8_t> & config) {
+	char value[64];
+	if ( (codec == "H264") && (config.size() >= 4) ) {
+		snprintf(value, sizeof(value), "avc1.%02x%02x%02x", config[1], config[2], config[3]);
+		return value;
+	}
+	if ( (codec == "H265") && (config.size() >= 13) ) {
+		int profileSpace = config[1] >> 6;
+		uint32_t compatibility = (config[2] << 24) | (config[3] << 16) | (config[4] << 8) | config[5];
+		uint32_t reversed = 0;
+		for (int i = 0; i < 32; i++) {
+			reversed |= ((compatibility >> i) & 1) << (31 - i);
+		}
+		std::string space = profileSpace ? std::string(1, 'A' + profileSpace - 1) : "";
+		snprintf(value, sizeof(value), "hvc1.%s%d.%x.%c%d", space.c_str(), config[1] & 0x1F, reversed, (config[1] & 0x20) ? 'H' : 'L', config[12]);
+		std::string result(value);
+		size_t constraints = 6;
+		while ( (constraints > 0) && (config[5 + constraints] == 0) ) {
+			constraints--;
+		}
+		for (size_t i = 0; i < constraints; i++) {
+			snprintf(value, sizeof(value), ".%02x", config[6 + i]);
+			result += value;
+		}
+		return result;
+	}
+	return "";
+}
@@ -0,0 +1,99 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <string>
+#include <map>
+#include <deque>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+
+#include "Fmp4.h"
+
+// package the H264/H265 access units of a null codec stream in LL-HLS CMAF parts, without transcoding
+// the last segments are kept in memory, the playlist and the parts are served by blocking requests
+class HlsPackager : public webrtc::VideoSinkInterface<webrtc::VideoFrame>
+{
+	struct Part
+	{
+		std::string          m_data;
+		uint64_t             m_duration;
+		bool                 m_independent;
+	};
+
+	struct Segment
+	{
+		Segment() : m_duration(0), m_complete(false) {}
+
+		std::vector<Part>    m_parts;
+		uint64_t             m_duration;
+		bool                 m_complete;
+	};
+
+public:
+	HlsPackager(const std::map<std::string,std::string> & opts);
+	virtual ~HlsPackager() {}
+
+	// overide webrtc::VideoSinkInterface
+	void OnFrame(const webrtc::VideoFrame& frame) override;
+
+	// media playlist, blocking until the segment msn (or its part) is available when msn is not negative
+	// the media URIs are relative to the playlist and carry the query of the stream
+	int getPlaylist(const std::string & query, int64_t msn, int64_t part, int timeoutMs, std::string & playlist);
+	int getInit(std::string & data);
+	int getSegment(uint64_t msn, std::string & data);
+	// part of the current segment, blocking until it is available for the preload hints
+	int getPart(uint64_t msn, uint64_t part, int timeoutMs, std::string & data);
+
+	int64_t getLastRequestTime() { return m_lastRequestTime; }
+
+private:
+	bool isAvailable(uint64_t msn, int64_t part);
+	void closePart();
+	void completeSegment();
+	void reset(const std::string & codec, const std::vector<uint8_t> & config, int width, int height);
+
+private:
+	uint64_t                 m_partTarget;
+	uint64_t                 m_segmentTarget;
+	size_t                   m_maxSegments;
+
+	std::mutex               m_mutex;
+	std::condition_variable  m_cond;
+	std::string              m_codec;
+	std::vector<uint8_t>     m_config;
+	int                      m_width;
+	int                      m_height;
+	std::string              m_init;
+	int                      m_initVersion;
+	uint64_t                 m_discontinuity;
+	std::deque<Segment>      m_segments;
+	uint64_t                 m_firstMsn;
+	uint64_t                 m_maxSegmentDuration;
+
+	// packaging state
+	std::vector<Fmp4Sample>  m_samples;
+	uint64_t                 m_samplesDuration;
+	uint64_t                 m_decodeTime;
+	uint32_t                 m_fragmentSeq;
+	bool                     m_pending;
+	Fmp4Sample               m_pendingSample;
+	int64_t                  m_pendingTimestamp;
+
+	std::atomic<int64_t>     m_lastRequestTime;
+};
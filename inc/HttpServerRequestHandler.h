@@ -17,6 +17,7 @@
 #include "json/json.h"
 #include "CivetServer.h"
 
+class WebsocketHandler;
 
 /* ---------------------------------------------------------------------------
 **  http callback
@@ -26,13 +27,24 @@ class HttpServerRequestHandler : public CivetServer
 	public:
 		typedef std::tuple<int, std::map<std::string,std::string>,Json::Value> httpFunctionReturn;
 		typedef std::function<httpFunctionReturn(const struct mg_request_info *req_info, const Json::Value &)> httpFunction;
+		typedef std::function<bool(const std::string & data, bool binary)> wsWriter;
+		typedef std::function<void()> wsCloser;
+		typedef std::function<bool(const void* id, const struct mg_request_info *req_info, const wsWriter &, const wsCloser &)> wsSubscribe;
+		typedef std::function<void(const void* id)> wsUnsubscribe;
 	
 		HttpServerRequestHandler(std::map<std::string,httpFunction>& func, const std::vector<std::string>& options); 
 		virtual ~HttpServerRequestHandler();
 
+		void publish(const std::string & peerid, const Json::Value & event);
+		bool hasSubscribers(const std::string & peerid);
+		// websocket pushing a stream, the connection is closed when the subscription fails
+		void addStreamHandler(const std::string & uri, const wsSubscribe & subscribe, const wsUnsubscribe & unsubscribe);
+
 	private:
 		prometheus::Registry       m_registry;
 		std::vector<CivetHandler*> m_handlers;
+		WebsocketHandler*          m_websocketHandler;
+		std::map<std::string,CivetWebSocketHandler*> m_streamHandlers;
 };
 
 
@@ -0,0 +1,220 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdio.h>
+#include <setjmp.h>
+#include <vector>
+
+#include <jpeglib.h>
+
+#include "libyuv/convert.h"
+
+#include "rtc_base/logging.h"
+#include "api/video/i420_buffer.h"
+
+// JPEG decoder using libjpeg DCT scaling to decode directly at 1/2, 1/4 or 1/8 of the source size
+// the 4:2:0 and 4:2:2 images are decoded as raw YCbCr planes, without color conversion, the others through BGRA
+class JpegScaledDecoder
+{
+    struct ErrorManager
+    {
+        struct jpeg_error_mgr pub;
+        jmp_buf               setjmp_buffer;
+    };
+
+    static void onError(j_common_ptr cinfo)
+    {
+        char message[JMSG_LENGTH_MAX];
+        (*cinfo->err->format_message)(cinfo, message);
+        RTC_LOG(LS_ERROR) << "JpegScaledDecoder error:" << message;
+        longjmp(((ErrorManager *)cinfo->err)->setjmp_buffer, 1);
+    }
+
+    static void onMessage(j_common_ptr cinfo, int msg_level)
+    {
+    }
+
+#if JPEG_LIB_VERSION >= 70
+    static int getBlockWidth(const jpeg_component_info *comp) { return comp->DCT_h_scaled_size; }
+    static int getBlockHeight(const jpeg_component_info *comp) { return comp->DCT_v_scaled_size; }
+    static int getMinBlockHeight(const jpeg_decompress_struct *cinfo) { return cinfo->min_DCT_v_scaled_size; }
+#else
+    static int getBlockWidth(const jpeg_component_info *comp) { return comp->DCT_scaled_size; }
+    static int getBlockHeight(const jpeg_component_info *comp) { return comp->DCT_scaled_size; }
+    static int getMinBlockHeight(const jpeg_decompress_struct *cinfo) { return cinfo->min_DCT_scaled_size; }
+#endif
+
+public:
+    JpegScaledDecoder() : m_raw(false), m_subsampledRows(false), m_width(0), m_height(0)
+    {
+        m_cinfo.err = jpeg_std_error(&m_error.pub);
+        m_error.pub.error_exit = onError;
+        m_error.pub.emit_message = onMessage;
+        jpeg_create_decompress(&m_cinfo);
+    }
+
+    virtual ~JpegScaledDecoder()
+    {
+        jpeg_destroy_decompress(&m_cinfo);
+    }
+
+    // largest denominator that keeps the decoded image at least as large as the target
+    static int getScaleDenom(int width, int height, int targetWidth, int targetHeight)
+    {
+        int denom = 1;
+        while ((denom < 8) && (width / (denom * 2) >= targetWidth) && (height / (denom * 2) >= targetHeight))
+        {
+            denom *= 2;
+        }
+        return denom;
+    }
+
+    webrtc::scoped_refptr<webrtc::I420Buffer> decode(const uint8_t *data, size_t size, int denom)
+    {
+        webrtc::scoped_refptr<webrtc::I420Buffer> buffer;
+        if (decompress(data, size, denom))
+        {
+            buffer = webrtc::I420Buffer::Create(m_width, m_height);
+            if (!m_raw)
+            {
+                libyuv::ARGBToI420(m_argb.data(), m_width * 4,
+                                   buffer->MutableDataY(), buffer->StrideY(),
+                                   buffer->MutableDataU(), buffer->StrideU(),
+                                   buffer->MutableDataV(), buffer->StrideV(),
+                                   m_width, m_height);
+            }
+            else if (m_subsampledRows)
+            {
+                libyuv::I420Copy(m_planes[0].data(), m_strides[0], m_planes[1].data(), m_strides[1], m_planes[2].data(), m_strides[2],
+                                 buffer->MutableDataY(), buffer->StrideY(),
+                                 buffer->MutableDataU(), buffer->StrideU(),
+                                 buffer->MutableDataV(), buffer->StrideV(),
+                                 m_width, m_height);
+            }
+            else
+            {
+                libyuv::I422ToI420(m_planes[0].data(), m_strides[0], m_planes[1].data(), m_strides[1], m_planes[2].data(), m_strides[2],
+                                   buffer->MutableDataY(), buffer->StrideY(),
+                                   buffer->MutableDataU(), buffer->StrideU(),
+                                   buffer->MutableDataV(), buffer->StrideV(),
+                                   m_width, m_height);
+            }
+        }
+        return buffer;
+    }
+
+private:
+    // the luma is subsampled 2x1 or 2x2 with one block of each chroma component in a MCU
+    bool isRawSupported()
+    {
+        return (m_cinfo.num_components == 3) && (m_cinfo.jpeg_color_space == JCS_YCbCr)
+            && (m_cinfo.comp_info[0].h_samp_factor == 2) && ((m_cinfo.comp_info[0].v_samp_factor == 1) || (m_cinfo.comp_info[0].v_samp_factor == 2))
+            && (m_cinfo.comp_info[1].h_samp_factor == 1) && (m_cinfo.comp_info[1].v_samp_factor == 1)
+            && (m_cinfo.comp_info[2].h_samp_factor == 1) && (m_cinfo.comp_info[2].v_samp_factor == 1);
+    }
+
+    // no object with a destructor should live in this scope because of longjmp
+    bool decompress(const uint8_t *data, size_t size, int denom)
+    {
+        if (setjmp(m_error.setjmp_buffer))
+        {
+            jpeg_abort_decompress(&m_cinfo);
+            return false;
+        }
+
+        jpeg_mem_src(&m_cinfo, const_cast<unsigned char *>(data), size);
+        jpeg_read_header(&m_cinfo, TRUE);
+
+        m_cinfo.scale_num = 1;
+        m_cinfo.scale_denom = denom;
+        m_cinfo.dct_method = JDCT_IFAST;
+        m_cinfo.do_fancy_upsampling = FALSE;
+        m_raw = isRawSupported();
+        if (m_raw)
+        {
+            m_cinfo.out_color_space = JCS_YCbCr;
+            m_cinfo.raw_data_out = TRUE;
+        }
+        else
+        {
+            m_cinfo.out_color_space = JCS_EXT_BGRA;
+            m_cinfo.raw_data_out = FALSE;
+        }
+        jpeg_start_decompress(&m_cinfo);
+
+        m_width = m_cinfo.output_width;
+        m_height = m_cinfo.output_height;
+        if (m_raw)
+        {
+            // the component info is released with the decompression, the sampling is kept for the conversion
+            m_subsampledRows = (m_cinfo.comp_info[0].v_samp_factor == 2);
+
+            // the planes are padded to whole MCUs, the scaled blocks are written in place
+            int mcuHeight = m_cinfo.max_v_samp_factor * getMinBlockHeight(&m_cinfo);
+            int mcuRows = (m_height + mcuHeight - 1) / mcuHeight;
+            for (int c = 0; c < 3; c++)
+            {
+                jpeg_component_info *comp = &m_cinfo.comp_info[c];
+                m_strides[c] = comp->width_in_blocks * getBlockWidth(comp);
+                m_planes[c].resize(m_strides[c] * mcuRows * comp->v_samp_factor * getBlockHeight(comp));
+            }
+
+            JSAMPROW rows[3][2 * DCTSIZE];
+            JSAMPARRAY planes[3] = { rows[0], rows[1], rows[2] };
+            while (m_cinfo.output_scanline < m_cinfo.output_height)
+            {
+                int mcuRow = m_cinfo.output_scanline / mcuHeight;
+                for (int c = 0; c < 3; c++)
+                {
+                    jpeg_component_info *comp = &m_cinfo.comp_info[c];
+                    int nbrows = comp->v_samp_factor * getBlockHeight(comp);
+                    for (int i = 0; i < nbrows; i++)
+                    {
+                        rows[c][i] = m_planes[c].data() + (mcuRow * nbrows + i) * m_strides[c];
+                    }
+                }
+                jpeg_read_raw_data(&m_cinfo, planes, mcuHeight);
+            }
+        }
+        else
+        {
+            m_argb.resize(m_width * m_height * 4);
+
+            JSAMPROW rows[16];
+            while (m_cinfo.output_scanline < m_cinfo.output_height)
+            {
+                int nbrows = 0;
+                while ((nbrows < 16) && (m_cinfo.output_scanline + nbrows < m_cinfo.output_height))
+                {
+                    rows[nbrows] = m_argb.data() + (m_cinfo.output_scanline + nbrows) * m_width * 4;
+                    nbrows++;
+                }
+                jpeg_read_scanlines(&m_cinfo, rows, nbrows);
+            }
+        }
+        jpeg_finish_decompress(&m_cinfo);
+        return true;
+    }
+
+private:
+    struct jpeg_decompress_struct m_cinfo;
+    ErrorManager                  m_error;
+    bool                          m_raw;
+    bool                          m_subsampledRows;
+    std::vector<uint8_t>          m_planes[3];
+    int                           m_strides[3];
+    std::vector<uint8_t>          m_argb;
+    int                           m_width;
+    int                           m_height;
+};
@@ -0,0 +1,92 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "api/audio_codecs/audio_encoder.h"
+#include "rtc_base/logging.h"
+
+#include "EncodedAudioFrame.h"
+
+// forward the encoded packets carried by EncodedAudioFrame, other PCM frames are given to the builtin encoder
+class NullAudioEncoder : public webrtc::AudioEncoder {
+   public:
+	NullAudioEncoder(const webrtc::SdpAudioFormat& format, int payloadType, std::unique_ptr<webrtc::AudioEncoder> encoder)
+		: m_format(format), m_codec(EncodedAudioFrame::getCodec(format.name)), m_payloadType(payloadType), m_encoder(std::move(encoder)), m_timestamp(0), m_mismatch(false) {}
+    virtual ~NullAudioEncoder() override {}
+
+    int SampleRateHz() const override { return m_encoder->SampleRateHz(); }
+    int RtpTimestampRateHz() const override { return m_encoder->RtpTimestampRateHz(); }
+    size_t NumChannels() const override { return m_encoder->NumChannels(); }
+    size_t Num10MsFramesInNextPacket() const override { return m_encoder->Num10MsFramesInNextPacket(); }
+    size_t Max10MsFramesInAPacket() const override { return m_encoder->Max10MsFramesInAPacket(); }
+    int GetTargetBitrate() const override { return m_encoder->GetTargetBitrate(); }
+    std::optional<std::pair<webrtc::TimeDelta, webrtc::TimeDelta>> GetFrameLengthRange() const override { return m_encoder->GetFrameLengthRange(); }
+
+    void Reset() override {
+		m_packet.clear();
+		m_encoder->Reset();
+	}
+
+   protected:
+    EncodedInfo EncodeImpl(uint32_t rtp_timestamp, webrtc::ArrayView<const int16_t> audio, webrtc::Buffer* encoded) override {
+		EncodedInfo info;
+		size_t offset = m_packet.size();
+		EncodedAudioFrame::Codec codec = EncodedAudioFrame::kUnknown;
+		int flags = 0;
+		if (!EncodedAudioFrame::read(audio.data(), audio.size(), NumChannels(), codec, flags, m_packet)) {
+			// PCM frame
+			m_packet.clear();
+			return m_encoder->Encode(rtp_timestamp, audio, encoded);
+		}
+
+		if (codec != m_codec) {
+			if (!m_mismatch) {
+				RTC_LOG(LS_ERROR) << "NullAudioEncoder cannot forward codec:" << codec << " as " << m_format.name;
+				m_mismatch = true;
+			}
+			m_packet.clear();
+			return info;
+		}
+		m_mismatch = false;
+
+		if (flags & EncodedAudioFrame::kFirst) {
+			m_packet.erase(m_packet.begin(), m_packet.begin() + offset);
+			m_timestamp = rtp_timestamp;
+		}
+		if (flags & EncodedAudioFrame::kLast) {
+			encoded->AppendData(m_packet.data(), m_packet.size());
+			info.encoded_bytes = m_packet.size();
+			info.encoded_timestamp = m_timestamp;
+			info.payload_type = m_payloadType;
+			info.speech = true;
+			switch (m_codec) {
+				case EncodedAudioFrame::kOpus: info.encoder_type = webrtc::CodecType::kOpus; break;
+				case EncodedAudioFrame::kPCMU: info.encoder_type = webrtc::CodecType::kPcmU; break;
+				case EncodedAudioFrame::kPCMA: info.encoder_type = webrtc::CodecType::kPcmA; break;
+				default: info.encoder_type = webrtc::CodecType::kOther; break;
+			}
+			RTC_LOG(LS_VERBOSE) << "NullAudioEncoder forward " << m_format.name << " size:" << m_packet.size() << " ts:" << m_timestamp;
+			m_packet.clear();
+		}
+		return info;
+	}
+
+  private:
+	webrtc::SdpAudioFormat                m_format;
+	EncodedAudioFrame::Codec              m_codec;
+	int                                   m_payloadType;
+	std::unique_ptr<webrtc::AudioEncoder> m_encoder;
+	std::vector<uint8_t>                  m_packet;
+	uint32_t                              m_timestamp;
+	bool                                  m_mismatch;
+};
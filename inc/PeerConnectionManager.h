@@ -18,6 +18,9 @@
 #include <regex>
 #include <thread>
 #include <future>
+#include <set>
+#include <limits>
+#include <condition_variable>
 
 #include "api/peer_connection_interface.h"
 #include "api/video_codecs/video_decoder_factory.h"
@@ -31,8 +34,25 @@
 #include "rtc_base/time_utils.h"
 
 #include "HttpServerRequestHandler.h"
+#include "SegmentRecorder.h"
+#include "TimeShiftBuffer.h"
+#include "SnapshotSink.h"
+#include "HlsPackager.h"
+#include "WebsocketStreamSink.h"
 
 class PeerConnectionManager {
+	// PeerConnectionFactories running on their own network and worker threads
+	struct Shard {
+		Shard() : m_networkThread(NULL), m_workerThread(NULL), m_peerCount(0) {}
+
+		webrtc::Thread*                                               m_networkThread;
+		webrtc::Thread*                                               m_workerThread;
+		webrtc::scoped_refptr<webrtc::AudioDeviceModule>              m_audioDeviceModule;
+		webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> m_builtin_peer_connection_factory;
+		webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> m_null_peer_connection_factory;
+		std::atomic<int>                                              m_peerCount;
+	};
+
 	class VideoSink : public webrtc::VideoSinkInterface<webrtc::VideoFrame> {
 		public:
 			VideoSink(const webrtc::scoped_refptr<webrtc::VideoTrackInterface> & track): m_track(track) {
@@ -46,8 +66,8 @@ class PeerConnectionManager {
 
 			// VideoSinkInterface implementation
 			virtual void OnFrame(const webrtc::VideoFrame& video_frame) {
-				webrtc::scoped_refptr<webrtc::I420BufferInterface> buffer(video_frame.video_frame_buffer()->ToI420());
-				RTC_LOG(LS_VERBOSE) << __PRETTY_FUNCTION__ << " frame:" << buffer->width() << "x" << buffer->height();
+				// the frame could be encoded (null codec), it is not converted only to be logged
+				RTC_LOG(LS_VERBOSE) << __PRETTY_FUNCTION__ << " frame:" << video_frame.width() << "x" << video_frame.height();
 			}
 
 		protected:
@@ -163,12 +183,14 @@ class PeerConnectionManager {
 			uint64_t getBytesReceived()      { std::lock_guard<std::mutex> lock(m_reportMutex); return m_bytesReceived; }
 			uint64_t getBandwidthSentBps()   { std::lock_guard<std::mutex> lock(m_reportMutex); return m_bwSentBps; }
 			uint64_t getBandwidthRecvBps()   { std::lock_guard<std::mutex> lock(m_reportMutex); return m_bwRecvBps; }
+			void setDeltaCallback(const std::function<void(const Json::Value &)> & callback) { std::lock_guard<std::mutex> lock(m_reportMutex); m_deltaCallback = callback; }
 
 		protected:
 			virtual void OnStatsDelivered(const webrtc::scoped_refptr<const webrtc::RTCStatsReport>& report) {
 				std::lock_guard<std::mutex> lock(m_reportMutex);
 				uint64_t bytesSent = 0;
 				uint64_t bytesReceived = 0;
+				Json::Value delta;
 				for (const webrtc::RTCStats& stats : *report) {
 					Json::Value statsMembers;
 					for (auto & attribute : stats.Attributes()) {
@@ -194,12 +216,19 @@ class PeerConnectionManager {
 						m_bwSentBps = static_cast<uint64_t>((bytesSent - m_prevBytesSent) * 8 / dtSec);
 						m_bwRecvBps = static_cast<uint64_t>((bytesReceived - m_prevBytesReceived) * 8 / dtSec);
 					}
+					delta["bytesSent"]          = (Json::UInt64)(bytesSent - m_prevBytesSent);
+					delta["bytesReceived"]      = (Json::UInt64)(bytesReceived - m_prevBytesReceived);
+					delta["bandwidth_sent_bps"] = (Json::UInt64)m_bwSentBps;
+					delta["bandwidth_recv_bps"] = (Json::UInt64)m_bwRecvBps;
 				}
 				m_prevBytesSent     = bytesSent;
 				m_prevBytesReceived = bytesReceived;
 				m_prevTimestampUs   = nowUs;
 				m_bytesSent     = bytesSent;
 				m_bytesReceived = bytesReceived;
+				if (m_deltaCallback && !delta.isNull()) {
+					m_deltaCallback(delta);
+				}
 			}
 
 			std::mutex m_reportMutex;
@@ -211,6 +240,7 @@ class PeerConnectionManager {
 			uint64_t    m_prevBytesSent;
 			uint64_t    m_prevBytesReceived;
 			int64_t     m_prevTimestampUs;
+			std::function<void(const Json::Value &)> m_deltaCallback;
 	};
 
 	class DataChannelObserver : public webrtc::DataChannelObserver  {
@@ -241,17 +271,20 @@ class PeerConnectionManager {
 
 	class PeerConnectionObserver : public webrtc::PeerConnectionObserver {
 		public:
-			PeerConnectionObserver(PeerConnectionManager* peerConnectionManager, const std::string& peerid, const webrtc::PeerConnectionInterface::RTCConfiguration & config, const webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> & peerConnectionFactory)
+			PeerConnectionObserver(PeerConnectionManager* peerConnectionManager, const std::string& peerid, const webrtc::PeerConnectionInterface::RTCConfiguration & config, Shard & shard, bool useNullCodec)
 			: m_peerConnectionManager(peerConnectionManager)
 			, m_peerid(peerid)
+			, m_shard(shard)
+			, m_peerConnectionFactory(useNullCodec ? shard.m_null_peer_connection_factory : shard.m_builtin_peer_connection_factory)
 			, m_iceCandidateList(Json::arrayValue)
 			, m_deleting(false)
-			, m_creationTime(webrtc::TimeMicros()) {
+			, m_creationTime(webrtc::TimeMicros())
+			, m_gatheringState(webrtc::PeerConnectionInterface::kIceGatheringNew) {
 
 				RTC_LOG(LS_INFO) << __FUNCTION__ << "CreatePeerConnection peerid:" << peerid;
 				webrtc::PeerConnectionDependencies dependencies(this);
 
-				webrtc::RTCErrorOr<webrtc::scoped_refptr<webrtc::PeerConnectionInterface>> result = peerConnectionFactory->CreatePeerConnectionOrError(config, std::move(dependencies));
+				webrtc::RTCErrorOr<webrtc::scoped_refptr<webrtc::PeerConnectionInterface>> result = m_peerConnectionFactory->CreatePeerConnectionOrError(config, std::move(dependencies));
 				if (result.ok()) {
 					m_pc = result.MoveValue();
 
@@ -267,6 +300,8 @@ class PeerConnectionManager {
 				}
 
 				m_statsCallback = new webrtc::RefCountedObject<PeerConnectionStatsCollectorCallback>();
+				this->setPeerId(peerid);
+				m_shard.m_peerCount++;
 				RTC_LOG(LS_INFO) << __FUNCTION__ << "CreatePeerConnection peerid:" << peerid;
 			};
 
@@ -277,15 +312,33 @@ class PeerConnectionManager {
 					m_deleting = true;
 					m_pc->Close();
 				}
+				m_shard.m_peerCount--;
+			}
+
+			// assign a pooled PeerConnection to a peer
+			void setPeerId(const std::string & peerid) {
+				{
+					std::lock_guard<std::mutex> lock(m_peeridMutex);
+					m_peerid = peerid;
+				}
+				m_creationTime = webrtc::TimeMicros();
+				PeerConnectionManager* peerConnectionManager = m_peerConnectionManager;
+				m_statsCallback->setDeltaCallback([peerConnectionManager, peerid](const Json::Value & delta) {
+					peerConnectionManager->publishEvent(peerid, "stats", delta);
+				});
 			}
 
 			Json::Value getIceCandidateList() { std::lock_guard<std::mutex> lock(m_iceCandidateMutex); return m_iceCandidateList; }
 
-			void triggerStatsUpdate() {
-				if (m_pc.get()) {
-					m_pc->GetStats(m_statsCallback.get());
-				}
+			// wait for a first local candidate or the end of the gathering
+			bool waitIceCandidate(int timeoutMs) {
+				std::unique_lock<std::mutex> lock(m_iceCandidateMutex);
+				return m_iceCandidateCond.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] {
+					return !m_iceCandidateList.empty() || (m_gatheringState == webrtc::PeerConnectionInterface::kIceGatheringComplete);
+				});
 			}
+
+			webrtc::scoped_refptr<PeerConnectionStatsCollectorCallback> getStatsCallback() { return m_statsCallback; }
 			uint64_t getBytesSent()          { return m_statsCallback->getBytesSent(); }
 			uint64_t getBytesReceived()      { return m_statsCallback->getBytesReceived(); }
 			uint64_t getBandwidthSentBps()   { return m_statsCallback->getBandwidthSentBps(); }
@@ -302,6 +355,7 @@ class PeerConnectionManager {
 			};
 
 			webrtc::scoped_refptr<webrtc::PeerConnectionInterface> getPeerConnection() { return m_pc; };
+			webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> getPeerConnectionFactory() { return m_peerConnectionFactory; };
 
 			// PeerConnectionObserver interface
 			virtual void OnAddStream(webrtc::scoped_refptr<webrtc::MediaStreamInterface> stream)    {
@@ -316,6 +370,12 @@ class PeerConnectionManager {
 					m_audiosink.reset(new AudioSink(audioTracks.at(0)));
 				}
 			}
+			virtual void OnTrack(webrtc::scoped_refptr<webrtc::RtpTransceiverInterface> transceiver) {
+				RTC_LOG(LS_INFO) << __PRETTY_FUNCTION__ << " peerid:" << this->getPeerId() << " mid:" << transceiver->mid().value_or("");
+				if (!m_publishName.empty()) {
+					m_peerConnectionManager->publishTrack(m_publishName, transceiver->receiver()->track());
+				}
+			}
 			virtual void OnRemoveStream(webrtc::scoped_refptr<webrtc::MediaStreamInterface> stream) {
 				RTC_LOG(LS_ERROR) << __PRETTY_FUNCTION__;
 				m_videosink.reset();
@@ -326,16 +386,21 @@ class PeerConnectionManager {
 				m_remoteChannel.reset(new DataChannelObserver(channel));
 			}
 			virtual void OnRenegotiationNeeded()                              {
-				RTC_LOG(LS_ERROR) << __PRETTY_FUNCTION__ << " peerid:" << m_peerid;;
+				RTC_LOG(LS_ERROR) << __PRETTY_FUNCTION__ << " peerid:" << this->getPeerId();;
 			}
 
 			virtual void OnIceCandidate(const webrtc::IceCandidate* candidate);
 			
 			virtual void OnSignalingChange(webrtc::PeerConnectionInterface::SignalingState state) {
-				RTC_LOG(LS_WARNING) << __PRETTY_FUNCTION__ << " state:" << webrtc::PeerConnectionInterface::AsString(state) << " peerid:" << m_peerid;				
+				RTC_LOG(LS_WARNING) << __PRETTY_FUNCTION__ << " state:" << webrtc::PeerConnectionInterface::AsString(state) << " peerid:" << this->getPeerId();				
+				m_peerConnectionManager->publishState(this->getPeerId(), "signalingstatechange", webrtc::PeerConnectionInterface::AsString(state));
+			}
+			virtual void OnConnectionChange(webrtc::PeerConnectionInterface::PeerConnectionState state) {
+				m_peerConnectionManager->publishState(this->getPeerId(), "connectionstatechange", webrtc::PeerConnectionInterface::AsString(state));
 			}
 			virtual void OnIceConnectionChange(webrtc::PeerConnectionInterface::IceConnectionState state) {
-				RTC_LOG(LS_WARNING) << __PRETTY_FUNCTION__ << " state:" << webrtc::PeerConnectionInterface::AsString(state)  << " peerid:" << m_peerid;
+				RTC_LOG(LS_WARNING) << __PRETTY_FUNCTION__ << " state:" << webrtc::PeerConnectionInterface::AsString(state)  << " peerid:" << this->getPeerId();
+				m_peerConnectionManager->publishState(this->getPeerId(), "iceconnectionstatechange", webrtc::PeerConnectionInterface::AsString(state));
 				if ( (state == webrtc::PeerConnectionInterface::kIceConnectionFailed)
 				   ||(state == webrtc::PeerConnectionInterface::kIceConnectionClosed) )
 				{ 
@@ -344,30 +409,46 @@ class PeerConnectionManager {
 						m_iceCandidateList.clear();
 					}
 					if (!m_deleting) {
-						std::thread([this]() {
-							m_peerConnectionManager->hangUp(m_peerid);
+						PeerConnectionManager* peerConnectionManager = m_peerConnectionManager;
+						std::string peerid = this->getPeerId();
+						std::thread([peerConnectionManager, peerid]() {
+							peerConnectionManager->hangUp(peerid);
 						}).detach();
 					}
 				}
 			}
 			
 			virtual void OnIceGatheringChange(webrtc::PeerConnectionInterface::IceGatheringState state) {
-				RTC_LOG(LS_WARNING) << __PRETTY_FUNCTION__ << " state:" << webrtc::PeerConnectionInterface::AsString(state)  << " peerid:" << m_peerid;
-				m_gatheringState = state;
+				RTC_LOG(LS_WARNING) << __PRETTY_FUNCTION__ << " state:" << webrtc::PeerConnectionInterface::AsString(state)  << " peerid:" << this->getPeerId();
+				{
+					std::lock_guard<std::mutex> lock(m_iceCandidateMutex);
+					m_gatheringState = state;
+				}
+				m_iceCandidateCond.notify_all();
+				m_peerConnectionManager->publishState(this->getPeerId(), "icegatheringstatechange", webrtc::PeerConnectionInterface::AsString(state));
 			}
 
 			uint64_t    getCreationTime() { return m_creationTime; }
-			std::string getPeerId() { return m_peerid; }
+			// the signaling thread reads the peerid while a pooled PeerConnection is assigned
+			std::string getPeerId() { std::lock_guard<std::mutex> lock(m_peeridMutex); return m_peerid; }
+			// the received tracks are registered as a stream with this name (WHIP)
+			void        setPublishName(const std::string & name) { m_publishName = name; }
+			std::string getPublishName() { return m_publishName; }
 			webrtc::PeerConnectionInterface::IceGatheringState getGatheringState() { return m_gatheringState; }
 
 		private:
 			PeerConnectionManager*                                   m_peerConnectionManager;
-			const std::string                                        m_peerid;
+			std::mutex                                               m_peeridMutex;
+			std::string                                              m_peerid;
+			std::string                                              m_publishName;
+			Shard&                                                   m_shard;
+			webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> m_peerConnectionFactory;
 			webrtc::scoped_refptr<webrtc::PeerConnectionInterface>      m_pc;
 			std::unique_ptr<DataChannelObserver>                     m_localChannel;
 			std::unique_ptr<DataChannelObserver>                     m_remoteChannel;
 			mutable std::mutex                                       m_iceCandidateMutex;
 			Json::Value                                              m_iceCandidateList;
+			std::condition_variable                                  m_iceCandidateCond;
 			webrtc::scoped_refptr<PeerConnectionStatsCollectorCallback> m_statsCallback;
 			std::unique_ptr<VideoSink>                               m_videosink;
 			std::unique_ptr<AudioSink>                               m_audiosink;
@@ -377,11 +458,28 @@ class PeerConnectionManager {
 	};
 
 	public:
-		PeerConnectionManager(const std::list<std::string> & iceServerList, const Json::Value & config, webrtc::AudioDeviceModule::AudioLayer audioLayer, const std::string& publishFilter, const std::string& webrtcUdpPortRange, bool useNullCodec, bool usePlanB, int maxpc, webrtc::PeerConnectionInterface::IceTransportsType transportType, const std::string & basePath, const std::string & webrtcTrialsFields, const std::string & extraHost = "");
+		// pagination and field selection of the list APIs
+		struct ListQuery
+		{
+			ListQuery() : m_offset(0), m_limit(std::numeric_limits<size_t>::max()) {}
+
+			bool hasField(const std::string & field) const { return m_fields.empty() || (m_fields.find(field) != m_fields.end()); }
+
+			size_t                m_offset;
+			size_t                m_limit;
+			std::set<std::string> m_fields;
+		};
+
+		// session events pushed to the websocket subscribers
+		typedef std::function<void(const std::string & peerid, const Json::Value & event)> eventCallback;
+		typedef std::function<bool(const std::string & peerid)> eventSubscribed;
+
+		PeerConnectionManager(const std::list<std::string> & iceServerList, const Json::Value & config, webrtc::AudioDeviceModule::AudioLayer audioLayer, const std::string& publishFilter, const std::string& webrtcUdpPortRange, bool useNullCodec, bool usePlanB, int maxpc, webrtc::PeerConnectionInterface::IceTransportsType transportType, const std::string & basePath, const std::string & webrtcTrialsFields, const std::string & extraHost = "", int pcPoolSize = 0, int shards = 1, int snapshotInterval = 1000);
 		virtual ~PeerConnectionManager();
 
 		bool InitializePeerConnection();
 		const std::map<std::string,HttpServerRequestHandler::httpFunction> getHttpApi() { return m_func; };  
+		void setEventCallback(const eventCallback & callback, const eventSubscribed & subscribed);
 
 		const Json::Value getIceCandidateList(const std::string &peerid);
 		const Json::Value addIceCandidate(const std::string &peerid, const Json::Value& jmessage);
@@ -392,26 +490,50 @@ class PeerConnectionManager {
 		const Json::Value hangUp(const std::string &peerid);
 		const Json::Value call(const std::string &peerid, const std::string & videourl, const std::string & audiourl, const std::string & options, const Json::Value& jmessage, bool useNullCodec = false);
 		const Json::Value getIceServers(const std::string& clientIp);
-		const Json::Value getPeerConnectionList();
+		const Json::Value getPeerConnectionList(const ListQuery & query, size_t & total);
 		const Json::Value getStreamList();
 		const Json::Value createOffer(const std::string &peerid, const std::string & videourl, const std::string & audiourl, const std::string & options);
 		const Json::Value setAnswer(const std::string &peerid, const Json::Value& jmessage);
 		std::tuple<int,std::map<std::string,std::string>,Json::Value> whep( const std::string &method,  const std::string &url,  const std::string &peerid, const std::string & videourl, const std::string & audiourl, const std::string & options, bool useNullCodec, const Json::Value &in);
+		std::tuple<int,std::map<std::string,std::string>,Json::Value> whip( const std::string &method,  const std::string &url,  const std::string &peerid, const std::string & name, bool useNullCodec, const Json::Value &in);
+		void publishTrack(const std::string & name, const webrtc::scoped_refptr<webrtc::MediaStreamTrackInterface> & track);
+		std::tuple<int,std::map<std::string,std::string>,Json::Value> snapshot(const std::string & videourl, const std::string & audiourl, const std::string & options, bool useNullCodec);
+		std::tuple<int,std::map<std::string,std::string>,Json::Value> hls(const std::string & file, const char* queryString);
+		bool subscribeStream(const void* id, const char* queryString, const WebsocketStreamSink::writer & writer, const WebsocketStreamSink::closer & closer);
+		void unsubscribeStream(const void* id);
 
 
 	protected:
-		PeerConnectionObserver*                               CreatePeerConnection(const std::string& peerid, bool useNullCodec = false);
+		PeerConnectionObserver*                               CreatePeerConnection(const std::string& peerid, bool useNullCodec = false, bool useAudioDevice = false);
+		bool                                                  prepareStream(const std::string & videourl, const std::string & audiourl, const std::string & options, bool useNullCodec, std::string & streamLabel, std::map<std::string, std::string> & opts, std::string & audio);
 		bool                                                  AddStreams(webrtc::PeerConnectionInterface* peer_connection, const std::string & videourl, const std::string & audiourl, const std::string & options, const webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> & peerConnectionFactory, bool useNullCodec = false);
 		webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface> CreateVideoSource(const std::string & videourl, const std::map<std::string,std::string> & opts, bool useNullCodec = false);
-		webrtc::scoped_refptr<webrtc::AudioSourceInterface>      CreateAudioSource(const std::string & audiourl, const std::map<std::string,std::string> & opts, const webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> & peerConnectionFactory);
+		webrtc::scoped_refptr<webrtc::AudioSourceInterface>      CreateAudioSource(const std::string & audiourl, const std::map<std::string,std::string> & opts, const webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> & peerConnectionFactory, bool useNullCodec = false);
+		void                                                  SetEncodedAudioCodec(webrtc::PeerConnectionInterface* peer_connection, const webrtc::scoped_refptr<webrtc::RtpSenderInterface> & sender, const webrtc::SdpAudioFormat & format, const webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> & peerConnectionFactory);
 		bool                                                  streamStillUsed(const std::string & streamLabel);
 		const std::list<std::string>                          getVideoCaptureDeviceList();
 		webrtc::scoped_refptr<webrtc::PeerConnectionInterface>   getPeerConnection(const std::string& peerid);
 		const std::string                                     sanitizeLabel(const std::string &label);
+		bool                                                  isEncodedSource(const std::string &videourl);
 		void                                                  createAudioModule(webrtc::AudioDeviceModule::AudioLayer audioLayer);
-		std::unique_ptr<webrtc::SessionDescriptionInterface>  getAnswer(const std::string & peerid, const std::string & sdpoffer, const std::string & videourl, const std::string & audiourl, const std::string & options, bool waitgatheringcompletion = false, bool useNullCodec = false);
-		std::unique_ptr<webrtc::SessionDescriptionInterface>  getAnswer(const std::string & peerid, webrtc::SessionDescriptionInterface *session_description, const std::string & videourl, const std::string & audiourl, const std::string & options, bool waitgatheringcompletion = false, bool useNullCodec = false);
+		std::unique_ptr<webrtc::SessionDescriptionInterface>  getAnswer(const std::string & peerid, const std::string & sdpoffer, const std::string & videourl, const std::string & audiourl, const std::string & options, bool waitcandidates = false, bool useNullCodec = false);
+		std::unique_ptr<webrtc::SessionDescriptionInterface>  getAnswer(const std::string & peerid, webrtc::SessionDescriptionInterface *session_description, const std::string & videourl, const std::string & audiourl, const std::string & options, bool waitcandidates = false, bool useNullCodec = false);
+		std::unique_ptr<webrtc::SessionDescriptionInterface>  answerOffer(PeerConnectionObserver* peerConnectionObserver, webrtc::SessionDescriptionInterface *session_description, bool waitcandidates);
+		void                                                  unpublish(const std::string & name, const std::string & peerid);
+		void                                                  removeStreamSinks(const std::string & streamLabel, const webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface> & videoSource);
+		bool                                                  streamKeptOpen(const std::string & streamLabel);
+		void                                                  releaseIdleOutputs();
 		std::string                                           getOldestPeerCannection();
+		std::string                                           getIceCandidateFragment(const std::string &peerid);
+		void                                                  publishEvent(const std::string & peerid, const std::string & type, const Json::Value & event);
+		void                                                  publishState(const std::string & peerid, const std::string & type, const std::string & state);
+		void                                                  statsLoop();
+		webrtc::PeerConnectionInterface::RTCConfiguration     createRTCConfiguration();
+		PeerConnectionObserver*                               getPooledPeerConnection(const std::string& peerid, size_t shard, bool useNullCodec);
+		std::unique_ptr<Shard>                                createShard(size_t index);
+		size_t                                                selectShard(bool useAudioDevice);
+		bool                                                  useAudioDevice(const std::string & audiourl);
+		void                                                  poolLoop();
 
 
 	protected:
@@ -419,6 +541,7 @@ class PeerConnectionManager {
 		std::unique_ptr<webrtc::Thread>                                              m_signalingThread;
 		std::unique_ptr<webrtc::Thread>                                              m_workerThread;
 		std::unique_ptr<webrtc::Thread>                                              m_networkThread;
+		std::list<std::unique_ptr<webrtc::Thread>>                                   m_shardThreads;
 		typedef std::pair< webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface>, webrtc::scoped_refptr<webrtc::AudioSourceInterface>> AudioVideoPair;
 		webrtc::scoped_refptr<webrtc::AudioDecoderFactory>                           m_audioDecoderfactory;
 		webrtc::scoped_refptr<webrtc::AudioDeviceModule>                             m_audioDeviceModule;
@@ -426,9 +549,18 @@ class PeerConnectionManager {
 	  	std::unique_ptr<webrtc::VideoDecoderFactory>                                 m_null_video_decoder_factory;
 		webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface>                m_builtin_peer_connection_factory;
 		webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface>                m_null_peer_connection_factory;
+		std::vector<std::unique_ptr<Shard>>                                          m_shards;
 		std::mutex                                                                   m_peerMapMutex;
 		std::map<std::string, PeerConnectionObserver* >                              m_peer_connectionobs_map;
 		std::map<std::string, AudioVideoPair>                                        m_stream_map;
+		std::map<std::string, std::shared_future<AudioVideoPair>>                    m_stream_creation;
+		std::map<std::string, std::pair<std::string,bool>>                           m_published_map;
+		std::map<std::string, std::unique_ptr<SegmentRecorder>>                      m_recorder_map;
+		std::map<std::string, std::shared_ptr<TimeShiftBuffer>>                      m_timeshift_map;
+		std::map<std::string, std::shared_ptr<SnapshotSink>>                         m_snapshot_map;
+		std::map<std::string, std::shared_ptr<HlsPackager>>                          m_hls_map;
+		std::map<std::string, std::map<std::string, std::shared_ptr<WebsocketStreamSink>>> m_websocket_map;
+		std::map<const void*, std::pair<std::string,std::string>>                   m_websocket_subscribers;
 		std::mutex                                                                   m_streamMapMutex;
 		std::list<std::string>                                                       m_iceServerList;
 		const Json::Value                                                            m_config;
@@ -442,5 +574,22 @@ class PeerConnectionManager {
 		webrtc::PeerConnectionInterface::IceTransportsType                           m_transportType;
 		const std::string                                                            m_webrtcTrialsFields;
 		const std::string                                                            m_extraHost;
+		std::mutex                                                                   m_mediaListMutex;
+		Json::Value                                                                  m_mediaList;
+		int64_t                                                                      m_mediaListTime;
+		std::mutex                                                                   m_eventMutex;
+		std::condition_variable                                                      m_eventCond;
+		eventCallback                                                                m_eventCallback;
+		eventSubscribed                                                              m_eventSubscribed;
+		std::thread                                                                  m_statsThread;
+		bool                                                                         m_statsRunning;
+		webrtc::PeerConnectionInterface::RTCConfiguration                            m_rtcConfig;
+		const int                                                                    m_pcPoolSize;
+		std::mutex                                                                   m_pcPoolMutex;
+		std::condition_variable                                                      m_pcPoolCond;
+		std::map<std::pair<size_t,bool>, std::list<PeerConnectionObserver*>>         m_pc_pool;
+		std::thread                                                                  m_pcPoolThread;
+		bool                                                                         m_pcPoolRunning;
+		const int                                                                    m_snapshotInterval;
 };
 
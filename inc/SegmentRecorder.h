@@ -0,0 +1,81 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdio.h>
+
+#include <string>
+#include <map>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+#include "api/video/encoded_image.h"
+
+// record the encoded frames of a null codec stream in Matroska segments without decoding them
+// the frames are muxed and written by a dedicated thread, one write per cluster
+class SegmentRecorder : public webrtc::VideoSinkInterface<webrtc::VideoFrame>
+{
+	struct Frame
+	{
+		webrtc::scoped_refptr<webrtc::EncodedImageBufferInterface> m_data;
+		std::string                                                m_codec;
+		bool                                                       m_keyFrame;
+		int64_t                                                    m_timestampMs;
+		int                                                        m_width;
+		int                                                        m_height;
+	};
+
+public:
+	SegmentRecorder(const std::string & name, const std::map<std::string,std::string> & opts);
+	virtual ~SegmentRecorder();
+
+	// overide webrtc::VideoSinkInterface, it never blocks the source
+	void OnFrame(const webrtc::VideoFrame& frame) override;
+
+private:
+	void WriterThread();
+	void writeFrame(const Frame & frame);
+	bool openSegment(const Frame & frame);
+	void closeSegment();
+	void flushCluster();
+
+private:
+	std::string             m_directory;
+	std::string             m_name;
+	size_t                  m_maxSize;
+	int64_t                 m_maxDurationMs;
+	size_t                  m_retention;
+
+	std::thread             m_thread;
+	std::mutex              m_mutex;
+	std::condition_variable m_cond;
+	std::deque<Frame>       m_queue;
+	bool                    m_stop;
+	bool                    m_waitKeyFrame;
+
+	// writer thread state
+	FILE*                   m_file;
+	long                    m_segmentOffset;
+	std::string             m_codec;
+	size_t                  m_segmentSize;
+	int64_t                 m_segmentStartMs;
+	std::vector<uint8_t>    m_cluster;
+	int64_t                 m_clusterStartMs;
+	int64_t                 m_lastTimestampMs;
+	std::deque<std::string> m_segments;
+};
@@ -0,0 +1,72 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <string>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <condition_variable>
+
+#include "api/environment/environment.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+#include "api/video/encoded_image.h"
+#include "api/video_codecs/video_decoder.h"
+#include "api/video_codecs/video_decoder_factory.h"
+#include "api/video_codecs/sdp_video_format.h"
+
+// keep the latest frame of a stream and encode it as JPEG on request, at most once per interval
+// the encoded streams keep only their last key frame, it is decoded when a snapshot is needed
+class SnapshotSink : public webrtc::VideoSinkInterface<webrtc::VideoFrame>, public webrtc::DecodedImageCallback
+{
+public:
+	SnapshotSink(const webrtc::Environment & env, std::unique_ptr<webrtc::VideoDecoderFactory> & decoderFactory, int intervalMs);
+	virtual ~SnapshotSink() {}
+
+	// overide webrtc::VideoSinkInterface
+	void OnFrame(const webrtc::VideoFrame& frame) override;
+
+	// overide webrtc::DecodedImageCallback
+	int32_t Decoded(webrtc::VideoFrame& decodedImage) override;
+
+	// JPEG of the latest frame, waiting for the first one, empty when none was received
+	std::string getJpeg(int timeoutMs);
+	int64_t getLastRequestTime() { return m_lastRequestTime; }
+
+private:
+	webrtc::scoped_refptr<webrtc::I420BufferInterface> decodeKeyFrame(const webrtc::scoped_refptr<webrtc::EncodedImageBuffer> & keyFrame, const webrtc::SdpVideoFormat & format, int width, int height);
+	static std::string encodeJpeg(const webrtc::scoped_refptr<webrtc::I420BufferInterface> & buffer, int quality);
+
+private:
+	const webrtc::Environment                                  m_env;
+	std::unique_ptr<webrtc::VideoDecoderFactory> &            m_decoderFactory;
+	const int                                                  m_intervalMs;
+
+	std::mutex                                                 m_frameMutex;
+	std::condition_variable                                    m_frameCond;
+	webrtc::scoped_refptr<webrtc::VideoFrameBuffer>            m_frame;
+	webrtc::scoped_refptr<webrtc::EncodedImageBuffer>          m_keyFrame;
+	webrtc::SdpVideoFormat                                     m_keyFrameFormat;
+	int                                                        m_keyFrameWidth;
+	int                                                        m_keyFrameHeight;
+	bool                                                       m_updated;
+
+	std::mutex                                                 m_jpegMutex;
+	std::string                                                m_jpeg;
+	int64_t                                                    m_jpegTime;
+	std::unique_ptr<webrtc::VideoDecoder>                      m_decoder;
+	webrtc::SdpVideoFormat                                     m_decoderFormat;
+	webrtc::scoped_refptr<webrtc::I420BufferInterface>         m_decoded;
+	std::atomic<int64_t>                                       m_lastRequestTime;
+};
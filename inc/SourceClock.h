@@ -0,0 +1,136 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdlib.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "system_wrappers/include/clock.h"
+#include "rtc_base/logging.h"
+
+// map the presentation times of a source to the local clock
+// the audio and video streams of an url come from separate RTP sessions, each one has its own mapping
+// live555 gives presentation times following the local clock of the first packet until the first RTCP SR, then the clock of the sender
+// once the two streams are on the sender clock, they share the same offset for lip sync
+class SourceClock
+{
+	// presentation times too far from the local clock restart the mapping of a stream (stream loop, RTCP synchronization)
+	static const int64_t kMaxDeviationUs = 1000000;
+	// a stream without discontinuity during the RTCP report interval is considered on the sender clock
+	static const int64_t kRtcpSyncDelayUs = 10000000;
+
+	struct Mapping
+	{
+		Mapping() : m_offsetUs(0), m_startUs(0), m_init(false), m_synchronized(false) {}
+
+		int64_t m_offsetUs;
+		int64_t m_startUs;
+		bool    m_init;
+		bool    m_synchronized;
+	};
+
+public:
+	enum Stream { kAudio = 0, kVideo = 1 };
+
+	static std::shared_ptr<SourceClock> Get(const std::string &url)
+	{
+		static std::mutex mutex;
+		static std::map<std::string, std::weak_ptr<SourceClock>> clocks;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		for (auto it = clocks.begin(); it != clocks.end();)
+		{
+			if (it->second.expired())
+			{
+				it = clocks.erase(it);
+			}
+			else
+			{
+				++it;
+			}
+		}
+		std::shared_ptr<SourceClock> clock = clocks[url].lock();
+		if (!clock)
+		{
+			clock = std::make_shared<SourceClock>();
+			clocks[url] = clock;
+		}
+		return clock;
+	}
+
+	SourceClock() : m_clock(webrtc::Clock::GetRealTimeClock()), m_sharedOffsetUs(0), m_shared(false) {}
+
+	// local time in microseconds of a presentation time in microseconds of a stream
+	int64_t toLocalUs(Stream stream, int64_t ptsUs)
+	{
+		int64_t nowUs = m_clock->TimeInMicroseconds();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Mapping & mapping = m_mappings[stream];
+		if (!mapping.m_init)
+		{
+			mapping.m_offsetUs = nowUs - ptsUs;
+			mapping.m_startUs = nowUs;
+			mapping.m_init = true;
+		}
+		else if (llabs(ptsUs + mapping.m_offsetUs - nowUs) > kMaxDeviationUs)
+		{
+			RTC_LOG(LS_VERBOSE) << "SourceClock::toLocalUs stream:" << stream << " resync drift:" << (ptsUs + mapping.m_offsetUs - nowUs) / 1000 << "ms";
+			mapping.m_offsetUs = nowUs - ptsUs;
+			mapping.m_synchronized = true;
+			m_shared = false;
+		}
+		else if (!mapping.m_synchronized && (nowUs - mapping.m_startUs > kRtcpSyncDelayUs))
+		{
+			mapping.m_synchronized = true;
+		}
+
+		// the shared offset is the one of the late stream, the early one waits for it
+		const Mapping & other = m_mappings[stream == kAudio ? kVideo : kAudio];
+		if (!m_shared && mapping.m_synchronized && other.m_synchronized && (llabs(mapping.m_offsetUs - other.m_offsetUs) <= kMaxDeviationUs))
+		{
+			m_sharedOffsetUs = std::max(mapping.m_offsetUs, other.m_offsetUs);
+			m_shared = true;
+			RTC_LOG(LS_INFO) << "SourceClock::toLocalUs audio/video skew:" << (m_mappings[kVideo].m_offsetUs - m_mappings[kAudio].m_offsetUs) / 1000 << "ms";
+		}
+		return ptsUs + ((m_shared && mapping.m_synchronized) ? m_sharedOffsetUs : mapping.m_offsetUs);
+	}
+
+	// NTP time in milliseconds of a local time in microseconds
+	int64_t toNtpMs(int64_t localUs) const
+	{
+		return m_clock->ConvertTimestampToNtpTimeInMilliseconds(localUs / 1000);
+	}
+
+	// pace the streams of a file source on the shared clock
+	void waitUntil(int64_t localUs) const
+	{
+		int64_t delayUs = localUs - m_clock->TimeInMicroseconds();
+		if ((delayUs > 0) && (delayUs < kMaxDeviationUs))
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds(delayUs));
+		}
+	}
+
+private:
+	webrtc::Clock *m_clock;
+	std::mutex     m_mutex;
+	Mapping        m_mappings[2];
+	int64_t        m_sharedOffsetUs;
+	bool           m_shared;
+};
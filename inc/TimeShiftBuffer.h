@@ -0,0 +1,99 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <string>
+#include <map>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+#include "api/video_codecs/sdp_video_format.h"
+
+#include "VideoSource.h"
+
+// rolling buffer of the encoded frames of a null codec stream, stored in a memory-mapped ring file
+class TimeShiftBuffer : public webrtc::VideoSinkInterface<webrtc::VideoFrame>
+{
+	struct Entry
+	{
+		size_t                 m_offset;
+		size_t                 m_size;
+		int64_t                m_timestampMs;
+		bool                   m_keyFrame;
+		int                    m_width;
+		int                    m_height;
+		webrtc::SdpVideoFormat m_format;
+	};
+
+public:
+	TimeShiftBuffer(const std::map<std::string,std::string> & opts);
+	virtual ~TimeShiftBuffer();
+
+	// overide webrtc::VideoSinkInterface
+	void OnFrame(const webrtc::VideoFrame& frame) override;
+
+	// sequence of the last key frame received before the offset
+	uint64_t seek(int64_t offsetMs);
+	// copy of a frame, waiting for it when it is not yet received or jumping to the next key frame when it was overwritten
+	bool read(uint64_t & seq, webrtc::scoped_refptr<webrtc::VideoFrameBuffer> & buffer, int64_t & timestampMs, int timeoutMs);
+	// no frame after this one is buffered
+	bool isLive(uint64_t seq);
+	// the ring could not be allocated, the buffer stays empty
+	bool isAllocated() { return m_data != NULL; }
+
+private:
+	uint8_t*                 m_data;
+	size_t                   m_capacity;
+	std::vector<uint8_t>     m_memory;
+	int64_t                  m_durationMs;
+	std::mutex               m_mutex;
+	std::condition_variable  m_cond;
+	std::deque<Entry>        m_index;
+	uint64_t                 m_firstSeq;
+	size_t                   m_writeOffset;
+};
+
+// video source of a viewer replaying a TimeShiftBuffer from an offset, faster than real time until it reaches the live frames
+class TimeShiftSource : public VideoSource
+{
+public:
+	TimeShiftSource(const std::shared_ptr<TimeShiftBuffer> & buffer, const std::map<std::string,std::string> & opts);
+	virtual ~TimeShiftSource();
+
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+
+	// parse an offset like -30s, 1500ms or 2m
+	static int64_t getOffsetMs(const std::string & seek);
+
+private:
+	void ReplayThread();
+
+private:
+	std::shared_ptr<TimeShiftBuffer> m_buffer;
+	int64_t                          m_offsetMs;
+	double                           m_speed;
+	std::thread                      m_thread;
+	std::mutex                       m_mutex;
+	std::condition_variable          m_cond;
+	bool                             m_stop;
+	std::atomic<int>                 m_width;
+	std::atomic<int>                 m_height;
+};
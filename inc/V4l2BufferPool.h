@@ -0,0 +1,196 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <linux/videodev2.h>
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "api/video/encoded_image.h"
+#include "rtc_base/logging.h"
+
+// V4L2 mmap buffers, a dequeued buffer is given back to the driver when its last reference is released
+class V4l2BufferPool : public std::enable_shared_from_this<V4l2BufferPool>
+{
+	struct Buffer
+	{
+		void*  m_start;
+		size_t m_length;
+	};
+
+	class EncodedBuffer : public webrtc::EncodedImageBufferInterface
+	{
+	public:
+		EncodedBuffer(const std::shared_ptr<V4l2BufferPool> &pool, unsigned int index, uint8_t *data, size_t size) : m_pool(pool), m_index(index), m_data(data), m_size(size) {}
+		virtual ~EncodedBuffer() { m_pool->queue(m_index); }
+
+		const uint8_t *data() const override { return m_data; }
+		uint8_t *data() override { return m_data; }
+		size_t size() const override { return m_size; }
+
+	private:
+		std::shared_ptr<V4l2BufferPool> m_pool;
+		unsigned int                    m_index;
+		uint8_t*                        m_data;
+		size_t                          m_size;
+	};
+
+public:
+	static std::shared_ptr<V4l2BufferPool> Create(int fd, unsigned int count)
+	{
+		std::shared_ptr<V4l2BufferPool> pool(new V4l2BufferPool(dup(fd)));
+		if (!pool->Init(count))
+		{
+			pool.reset();
+		}
+		return pool;
+	}
+
+	virtual ~V4l2BufferPool()
+	{
+		int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		ioctl(m_fd, VIDIOC_STREAMOFF, &type);
+		for (const Buffer &buffer : m_buffers)
+		{
+			munmap(buffer.m_start, buffer.m_length);
+		}
+		struct v4l2_requestbuffers req;
+		memset(&req, 0, sizeof(req));
+		req.count = 0;
+		req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		req.memory = V4L2_MEMORY_MMAP;
+		ioctl(m_fd, VIDIOC_REQBUFS, &req);
+		close(m_fd);
+	}
+
+	int isReadable(timeval *tv)
+	{
+		fd_set fdset;
+		FD_ZERO(&fdset);
+		FD_SET(m_fd, &fdset);
+		return select(m_fd + 1, &fdset, NULL, NULL, tv);
+	}
+
+	// dequeue a filled buffer, the data are copied when the driver is about to run out of buffers
+	// the last two buffers stay with the driver, the others could be held without copy
+	webrtc::scoped_refptr<webrtc::EncodedImageBufferInterface> dequeue()
+	{
+		webrtc::scoped_refptr<webrtc::EncodedImageBufferInterface> encodedData;
+		struct v4l2_buffer buf;
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		if (ioctl(m_fd, VIDIOC_DQBUF, &buf) == -1)
+		{
+			if (errno != EAGAIN)
+			{
+				RTC_LOG(LS_ERROR) << "V4l2BufferPool::dequeue VIDIOC_DQBUF error:" << strerror(errno);
+			}
+		}
+		else if (buf.index < m_buffers.size())
+		{
+			uint8_t *data = (uint8_t *)m_buffers[buf.index].m_start;
+			m_pending++;
+			if (m_pending + 1 >= m_buffers.size())
+			{
+				RTC_LOG(LS_VERBOSE) << "V4l2BufferPool::dequeue copy frame pending:" << m_pending;
+				encodedData = webrtc::EncodedImageBuffer::Create(data, buf.bytesused);
+				this->queue(buf.index);
+			}
+			else
+			{
+				encodedData = webrtc::make_ref_counted<EncodedBuffer>(shared_from_this(), buf.index, data, buf.bytesused);
+			}
+		}
+		return encodedData;
+	}
+
+	void queue(unsigned int index)
+	{
+		struct v4l2_buffer buf;
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = index;
+		if (ioctl(m_fd, VIDIOC_QBUF, &buf) == -1)
+		{
+			RTC_LOG(LS_ERROR) << "V4l2BufferPool::queue VIDIOC_QBUF error:" << strerror(errno);
+		}
+		m_pending--;
+	}
+
+private:
+	V4l2BufferPool(int fd) : m_fd(fd), m_pending(0) {}
+
+	bool Init(unsigned int count)
+	{
+		struct v4l2_requestbuffers req;
+		memset(&req, 0, sizeof(req));
+		req.count = count;
+		req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		req.memory = V4L2_MEMORY_MMAP;
+		if (ioctl(m_fd, VIDIOC_REQBUFS, &req) == -1)
+		{
+			RTC_LOG(LS_ERROR) << "V4l2BufferPool::Init VIDIOC_REQBUFS error:" << strerror(errno);
+			return false;
+		}
+
+		for (unsigned int i = 0; i < req.count; i++)
+		{
+			struct v4l2_buffer buf;
+			memset(&buf, 0, sizeof(buf));
+			buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			buf.memory = V4L2_MEMORY_MMAP;
+			buf.index = i;
+			if (ioctl(m_fd, VIDIOC_QUERYBUF, &buf) == -1)
+			{
+				RTC_LOG(LS_ERROR) << "V4l2BufferPool::Init VIDIOC_QUERYBUF error:" << strerror(errno);
+				return false;
+			}
+			void *start = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, buf.m.offset);
+			if (start == MAP_FAILED)
+			{
+				RTC_LOG(LS_ERROR) << "V4l2BufferPool::Init mmap error:" << strerror(errno);
+				return false;
+			}
+			m_buffers.push_back({start, buf.length});
+			if (ioctl(m_fd, VIDIOC_QBUF, &buf) == -1)
+			{
+				RTC_LOG(LS_ERROR) << "V4l2BufferPool::Init VIDIOC_QBUF error:" << strerror(errno);
+				return false;
+			}
+		}
+
+		int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		if (ioctl(m_fd, VIDIOC_STREAMON, &type) == -1)
+		{
+			RTC_LOG(LS_ERROR) << "V4l2BufferPool::Init VIDIOC_STREAMON error:" << strerror(errno);
+			return false;
+		}
+		RTC_LOG(LS_INFO) << "V4l2BufferPool::Init buffers:" << m_buffers.size();
+		return true;
+	}
+
+private:
+	int                       m_fd;
+	std::vector<Buffer>       m_buffers;
+	std::atomic<unsigned int> m_pending;
+};
@@ -13,18 +13,57 @@
 #pragma once
 
 #include <chrono>
+#include <sstream>
+
+#include "libyuv/convert.h"
+#include "libyuv/planar_functions.h"
 
 #include "api/video/video_broadcaster.h"
+#include "api/video/nv12_buffer.h"
 #include "common_video/h264/h264_common.h"
 #include "common_video/h264/sps_parser.h"
 #include "modules/video_coding/h264_sprop_parameter_sets.h"
 #include "rtc_base/logging.h"
 
 #include "EncodedVideoFrameBuffer.h"
+#include "V4l2BufferPool.h"
 
 #include "V4l2Capture.h"
 #include "VideoSource.h"
 
+// NV12 frame referencing the V4L2 buffer it was captured in, the chroma plane starts at uvOffset (after the padding rows of the luma)
+class V4l2NV12Buffer : public webrtc::NV12BufferInterface
+{
+public:
+	V4l2NV12Buffer(int width, int height, int stride, size_t uvOffset, const webrtc::scoped_refptr<webrtc::EncodedImageBufferInterface> &data)
+		: m_width(width), m_height(height), m_stride(stride), m_uvOffset(uvOffset), m_data(data) {}
+
+	int width() const override { return m_width; }
+	int height() const override { return m_height; }
+	const uint8_t *DataY() const override { return m_data->data(); }
+	const uint8_t *DataUV() const override { return m_data->data() + m_uvOffset; }
+	int StrideY() const override { return m_stride; }
+	int StrideUV() const override { return m_stride; }
+
+	webrtc::scoped_refptr<webrtc::I420BufferInterface> ToI420() override
+	{
+		webrtc::scoped_refptr<webrtc::I420Buffer> i420 = webrtc::I420Buffer::Create(m_width, m_height);
+		libyuv::NV12ToI420(DataY(), StrideY(), DataUV(), StrideUV(),
+						   i420->MutableDataY(), i420->StrideY(),
+						   i420->MutableDataU(), i420->StrideU(),
+						   i420->MutableDataV(), i420->StrideV(),
+						   m_width, m_height);
+		return i420;
+	}
+
+private:
+	const int                                                  m_width;
+	const int                                                  m_height;
+	const int                                                  m_stride;
+	const size_t                                               m_uvOffset;
+	webrtc::scoped_refptr<webrtc::EncodedImageBufferInterface> m_data;
+};
+
 class V4l2Capturer : public VideoSource
 {
 public:
@@ -34,6 +73,7 @@ public:
 		size_t height = 0;
 		size_t fps = 0;
 		std::string format = "H264";
+		bool zerocopy = true;
 		if (opts.find("width") != opts.end())
 		{
 			width = std::stoi(opts.at("width"));
@@ -50,9 +90,13 @@ public:
 		{
 			format = opts.at("format");
 		}
+		if (opts.find("zerocopy") != opts.end())
+		{
+			zerocopy = std::stoi(opts.at("zerocopy"));
+		}
 
 		std::unique_ptr<V4l2Capturer> capturer(new V4l2Capturer());
-		if (!capturer->Init(format, width, height, fps, videourl))
+		if (!capturer->Init(format, width, height, fps, videourl, zerocopy))
 		{
 			RTC_LOG(LS_WARNING) << "Failed to create V4l2Capturer(w = " << width
 								<< ", h = " << height << ", fps = " << fps
@@ -70,13 +114,14 @@ public:
     int height() const { return m_height;  }        
 
 private:
-	V4l2Capturer() : m_stop(false), m_width(0), m_height(0) {}
+	V4l2Capturer() : m_stop(false), m_pixelformat(0), m_width(0), m_height(0), m_stride(0), m_uvOffset(0) {}
 
 	bool Init(const std::string &format,
 			  size_t width,
 			  size_t height,
 			  size_t fps,
-			  const std::string &videourl)
+			  const std::string &videourl,
+			  bool zerocopy)
 	{
 		m_format = format;
 		m_width = width;
@@ -88,11 +133,36 @@ private:
 			device = videourl.substr(strlen("v4l2://"));
 		}		
 
-		V4L2DeviceParameters param(device.c_str(), V4l2Device::fourcc(format.c_str()), width, height, fps);
+		// format could be a list of formats ordered by preference, the first one supported by the device is used
+		std::list<unsigned int> formatList;
+		std::istringstream is(format);
+		std::string fourcc;
+		while (std::getline(is, fourcc, ',')) {
+			formatList.push_back(V4l2Device::fourcc(fourcc.c_str()));
+		}
+
+		V4L2DeviceParameters param(device.c_str(), formatList, width, height, fps);
 		m_capture.reset(V4l2Capture::create(param));
 
 		bool ret = false;
 		if (m_capture) {
+			m_pixelformat = m_capture->getFormat();
+			m_format = V4l2Device::fourcc(m_pixelformat);
+			m_width = m_capture->getWidth();
+			m_height = m_capture->getHeight();
+			m_stride = this->getStride();
+			m_uvOffset = this->getChromaOffset();
+			RTC_LOG(LS_INFO) << "V4l2Capturer::Init format:" << m_format << " " << m_width << "x" << m_height << " stride:" << m_stride << " chroma offset:" << m_uvOffset;
+
+			// replace the buffers of libv4l2cpp by buffers that are given to webrtc without copy
+			// the pool keeps two buffers queued to the driver, so 4 of the 6 buffers could be held by webrtc
+			if (zerocopy && m_capture->stop()) {
+				m_pool = V4l2BufferPool::Create(m_capture->getFd(), 6);
+				if (!m_pool) {
+					RTC_LOG(LS_WARNING) << "V4l2Capturer::Init cannot allocate zero copy buffers";
+					m_capture->start();
+				}
+			}
 			m_capturethread = std::thread(&V4l2Capturer::CaptureThread, this);
 			ret = true;
 		}
@@ -100,6 +170,40 @@ private:
 		return ret;
 	}
 
+	int isReadable(timeval *tv)
+	{
+		return m_pool ? m_pool->isReadable(tv) : m_capture->isReadable(tv);
+	}
+
+	webrtc::scoped_refptr<webrtc::EncodedImageBufferInterface> readFrame()
+	{
+		webrtc::scoped_refptr<webrtc::EncodedImageBufferInterface> encodedData;
+		if (m_pool)
+		{
+			encodedData = m_pool->dequeue();
+		}
+		else
+		{
+			webrtc::scoped_refptr<webrtc::EncodedImageBuffer> buffer = webrtc::EncodedImageBuffer::Create(m_capture->getBufferSize());
+			int frameSize = m_capture->read((char*)buffer->data(), buffer->size());
+			if (frameSize > 0)
+			{
+				buffer->Realloc(frameSize);
+				encodedData = buffer;
+			}
+		}
+		return encodedData;
+	}
+
+	// keep the last parameter set, the buffer is updated only when it changes
+	void updateParameterSet(webrtc::scoped_refptr<webrtc::EncodedImageBufferInterface> &parameterSet, const uint8_t *data, size_t size)
+	{
+		if (!parameterSet || (parameterSet->size() != size) || (memcmp(parameterSet->data(), data, size) != 0))
+		{
+			parameterSet = webrtc::EncodedImageBuffer::Create(data, size);
+		}
+	}
+
 	void CaptureThread()
 	{
 		timeval tv;
@@ -108,57 +212,155 @@ private:
 		{
 			tv.tv_sec=1;
 			tv.tv_usec=0;	
-			if (m_capture->isReadable(&tv) > 0)
+			if (isReadable(&tv) > 0)
 			{
-				char* buffer = new char[m_capture->getBufferSize()];	
-				int frameSize = m_capture->read(buffer,  m_capture->getBufferSize());
-
-				bool idr = false;
-				int cfg = 0;
-				std::span<const uint8_t> data((const uint8_t*)buffer, frameSize);
-				std::vector<webrtc::H264::NaluIndex> naluIndexes = webrtc::H264::FindNaluIndices(data);
-				for (webrtc::H264::NaluIndex  index : naluIndexes) {
-					webrtc::H264::NaluType nalu_type = webrtc::H264::ParseNaluType(buffer[index.payload_start_offset]);
-					RTC_LOG(LS_VERBOSE) << __FUNCTION__ << " nalu:" << nalu_type << " payload_start_offset:" << index.payload_start_offset << " start_offset:" << index.start_offset << " size:" << index.payload_size;
-					if (nalu_type ==  webrtc::H264::NaluType::kSps) {
-						m_sps = webrtc::EncodedImageBuffer::Create((uint8_t*)&buffer[index.start_offset], index.payload_size + index.payload_start_offset - index.start_offset);
-						cfg++;
+				webrtc::scoped_refptr<webrtc::EncodedImageBufferInterface> encodedData = readFrame();
+				if (!encodedData)
+				{
+					continue;
+				}
+				int64_t ts = std::chrono::high_resolution_clock::now().time_since_epoch().count()/1000/1000;
+				if (m_pixelformat == V4L2_PIX_FMT_NV12)
+				{
+					size_t uvOffset = m_uvOffset ? m_uvOffset : m_stride * m_height;
+					if (encodedData->size() < uvOffset + m_stride * ((m_height + 1) / 2))
+					{
+						RTC_LOG(LS_WARNING) << "V4l2Capturer ignore truncated NV12 frame size:" << encodedData->size();
 					}
-					else if (nalu_type ==  webrtc::H264::NaluType::kPps) {
-						m_pps = webrtc::EncodedImageBuffer::Create((uint8_t*)&buffer[index.start_offset], index.payload_size + index.payload_start_offset - index.start_offset);
-						cfg++;
+					else if (m_uvOffset)
+					{
+						onRawFrame(webrtc::make_ref_counted<V4l2NV12Buffer>(m_width, m_height, m_stride, m_uvOffset, encodedData), ts);
 					}
-					else if (nalu_type ==  webrtc::H264::NaluType::kIdr) {
-						idr = true;
+					else
+					{
+						// the layout given by the driver is not understood, the planes are copied assuming no padding rows
+						webrtc::scoped_refptr<webrtc::NV12Buffer> nv12 = webrtc::NV12Buffer::Create(m_width, m_height);
+						libyuv::NV12Copy(encodedData->data(), m_stride, encodedData->data() + uvOffset, m_stride,
+										 nv12->MutableDataY(), nv12->StrideY(),
+										 nv12->MutableDataUV(), nv12->StrideUV(),
+										 m_width, m_height);
+						onRawFrame(nv12, ts);
 					}
 				}
-				RTC_LOG(LS_VERBOSE) << __FUNCTION__ << " idr:" << idr << " cfg:" << cfg << " " << m_sps->size() << " " << m_pps->size() << " " << frameSize;
-				
-				webrtc::scoped_refptr<webrtc::EncodedImageBufferInterface> encodedData = webrtc::EncodedImageBuffer::Create((uint8_t*)buffer, frameSize);
-				delete [] buffer;			
-				// add last SPS/PPS if not present before an IDR
-				if (idr && (cfg == 0) && (m_sps->size() != 0) && (m_pps->size() != 0) ) {
-					char * newBuffer = new char[encodedData->size() + m_sps->size() + m_pps->size()];
-					memcpy(newBuffer, m_sps->data(), m_sps->size());
-					memcpy(newBuffer+m_sps->size(), m_pps->data(), m_pps->size());
-					memcpy(newBuffer+m_sps->size()+m_pps->size(), encodedData->data(), encodedData->size());
-					encodedData = webrtc::EncodedImageBuffer::Create((uint8_t*)newBuffer, encodedData->size() + m_sps->size() + m_pps->size());
-					delete [] newBuffer;
+				else if (m_pixelformat == V4L2_PIX_FMT_YUYV)
+				{
+					webrtc::scoped_refptr<webrtc::NV12Buffer> nv12 = webrtc::NV12Buffer::Create(m_width, m_height);
+					libyuv::YUY2ToNV12(encodedData->data(), m_stride,
+									   nv12->MutableDataY(), nv12->StrideY(),
+									   nv12->MutableDataUV(), nv12->StrideUV(),
+									   m_width, m_height);
+					onRawFrame(nv12, ts);
+				}
+				else
+				{
+					onEncodedFrame(encodedData, ts);
 				}
+			}
+		}
+	}
 
-				int64_t ts = std::chrono::high_resolution_clock::now().time_since_epoch().count()/1000/1000;
-				webrtc::VideoFrameType frameType = idr ? webrtc::VideoFrameType::kVideoFrameKey : webrtc::VideoFrameType::kVideoFrameDelta;
-				webrtc::scoped_refptr<webrtc::VideoFrameBuffer> frameBuffer = webrtc::make_ref_counted<EncodedVideoFrameBuffer>(m_capture->getWidth(), m_capture->getHeight(), encodedData, frameType, webrtc::SdpVideoFormat(m_format));
-				webrtc::VideoFrame frame = webrtc::VideoFrame::Builder()
-					.set_video_frame_buffer(frameBuffer)
-					.set_rotation(webrtc::kVideoRotation_0)
-					.set_timestamp_ms(ts)
-					.set_id(ts)
-					.build();
-
-				m_broadcaster.OnFrame(frame);
+	void onRawFrame(const webrtc::scoped_refptr<webrtc::VideoFrameBuffer> &frameBuffer, int64_t ts)
+	{
+		webrtc::VideoFrame frame = webrtc::VideoFrame::Builder()
+			.set_video_frame_buffer(frameBuffer)
+			.set_rotation(webrtc::kVideoRotation_0)
+			.set_timestamp_ms(ts)
+			.set_id(ts)
+			.build();
+
+		m_broadcaster.OnFrame(frame);
+	}
+
+	void onEncodedFrame(webrtc::scoped_refptr<webrtc::EncodedImageBufferInterface> encodedData, int64_t ts)
+	{
+		const uint8_t* buffer = encodedData->data();
+		size_t frameSize = encodedData->size();
+
+		bool idr = false;
+		int cfg = 0;
+		std::span<const uint8_t> data(buffer, frameSize);
+		std::vector<webrtc::H264::NaluIndex> naluIndexes = webrtc::H264::FindNaluIndices(data);
+		for (webrtc::H264::NaluIndex  index : naluIndexes) {
+			webrtc::H264::NaluType nalu_type = webrtc::H264::ParseNaluType(buffer[index.payload_start_offset]);
+			RTC_LOG(LS_VERBOSE) << __FUNCTION__ << " nalu:" << nalu_type << " payload_start_offset:" << index.payload_start_offset << " start_offset:" << index.start_offset << " size:" << index.payload_size;
+			if (nalu_type ==  webrtc::H264::NaluType::kSps) {
+				updateParameterSet(m_sps, &buffer[index.start_offset], index.payload_size + index.payload_start_offset - index.start_offset);
+				cfg++;
+			}
+			else if (nalu_type ==  webrtc::H264::NaluType::kPps) {
+				updateParameterSet(m_pps, &buffer[index.start_offset], index.payload_size + index.payload_start_offset - index.start_offset);
+				cfg++;
+			}
+			else if (nalu_type ==  webrtc::H264::NaluType::kIdr) {
+				idr = true;
+			}
+		}
+		RTC_LOG(LS_VERBOSE) << __FUNCTION__ << " idr:" << idr << " cfg:" << cfg << " " << frameSize;
+		
+		// add last SPS/PPS if not present before an IDR, an encoded image needs a contiguous buffer so this frame is copied
+		if (idr && (cfg == 0) && m_sps && m_pps) {
+			webrtc::scoped_refptr<webrtc::EncodedImageBuffer> newBuffer = webrtc::EncodedImageBuffer::Create(frameSize + m_sps->size() + m_pps->size());
+			memcpy(newBuffer->data(), m_sps->data(), m_sps->size());
+			memcpy(newBuffer->data()+m_sps->size(), m_pps->data(), m_pps->size());
+			memcpy(newBuffer->data()+m_sps->size()+m_pps->size(), buffer, frameSize);
+			encodedData = newBuffer;
+		}
+
+		webrtc::VideoFrameType frameType = idr ? webrtc::VideoFrameType::kVideoFrameKey : webrtc::VideoFrameType::kVideoFrameDelta;
+		webrtc::scoped_refptr<webrtc::VideoFrameBuffer> frameBuffer = webrtc::make_ref_counted<EncodedVideoFrameBuffer>(m_width, m_height, encodedData, frameType, webrtc::SdpVideoFormat(m_format));
+		webrtc::VideoFrame frame = webrtc::VideoFrame::Builder()
+			.set_video_frame_buffer(frameBuffer)
+			.set_rotation(webrtc::kVideoRotation_0)
+			.set_timestamp_ms(ts)
+			.set_id(ts)
+			.build();
+
+		m_broadcaster.OnFrame(frame);
+	}
+
+	int getStride()
+	{
+		int stride = m_width;
+		struct v4l2_format fmt;
+		memset(&fmt, 0, sizeof(fmt));
+		fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		if (ioctl(m_capture->getFd(), VIDIOC_G_FMT, &fmt) == 0)
+		{
+			stride = fmt.fmt.pix.bytesperline;
+		}
+		else if (m_pixelformat == V4L2_PIX_FMT_YUYV)
+		{
+			stride = m_width * 2;
+		}
+		return stride;
+	}
+
+	// the chroma plane of a NV12 image follows the luma plane and its padding rows, both are sized from sizeimage
+	// 0 when sizeimage does not match a NV12 layout
+	size_t getChromaOffset()
+	{
+		size_t offset = 0;
+		struct v4l2_format fmt;
+		memset(&fmt, 0, sizeof(fmt));
+		fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		if ( (m_pixelformat == V4L2_PIX_FMT_NV12) && (m_stride > 0) && (ioctl(m_capture->getFd(), VIDIOC_G_FMT, &fmt) == 0) )
+		{
+			size_t sizeimage = fmt.fmt.pix.sizeimage;
+			size_t bytesperline = fmt.fmt.pix.bytesperline;
+			if ( (bytesperline == (size_t)m_stride) && ((2 * sizeimage) % (3 * bytesperline) == 0) )
+			{
+				size_t lines = 2 * sizeimage / (3 * bytesperline);
+				if (lines >= (size_t)m_height)
+				{
+					offset = bytesperline * lines;
+				}
+			}
+			if (!offset)
+			{
+				RTC_LOG(LS_WARNING) << "V4l2Capturer NV12 sizeimage:" << sizeimage << " bytesperline:" << bytesperline << " not understood, frames are copied";
 			}
 		}
+		return offset;
 	}
 
 	void Destroy()
@@ -167,6 +369,7 @@ private:
 		{
 			m_stop = true;
 			m_capturethread.join();
+			m_pool.reset();
 			m_capture.reset();
 		}
 	}
@@ -174,9 +377,13 @@ private:
 	bool                                                       m_stop;
 	std::thread                                                m_capturethread;
 	std::unique_ptr<V4l2Capture>                               m_capture;
+	std::shared_ptr<V4l2BufferPool>                            m_pool;
 	webrtc::scoped_refptr<webrtc::EncodedImageBufferInterface> m_sps;
 	webrtc::scoped_refptr<webrtc::EncodedImageBufferInterface> m_pps;
 	std::string											       m_format;
+	unsigned int                                               m_pixelformat;
 	int                                                        m_width;		
  	int                                                       m_height;	
+	int                                                        m_stride;
+	size_t                                                     m_uvOffset;
 };
@@ -14,6 +14,7 @@
 
 #include <string.h>
 #include <vector>
+#include <deque>
 #include <chrono>
 
 #include "api/video/i420_buffer.h"
@@ -23,6 +24,7 @@
 #include "rtc_base/base64.h"
 
 #include "SessionSink.h"
+#include "SourceClock.h"
 #include "VideoScaler.h"
 
 class VideoDecoder : public webrtc::VideoSourceInterface<webrtc::VideoFrame>, public webrtc::DecodedImageCallback {
@@ -43,14 +45,13 @@ class VideoDecoder : public webrtc::VideoSourceInterface<webrtc::VideoFrame>, pu
         };
 
     public:
-        VideoDecoder(const std::map<std::string,std::string> & opts, std::unique_ptr<webrtc::VideoDecoderFactory>& videoDecoderFactory, bool wait = false) : 
+        VideoDecoder(const std::map<std::string,std::string> & opts, std::unique_ptr<webrtc::VideoDecoderFactory>& videoDecoderFactory, bool wait = false, const std::string & uri = "") : 
                 m_scaler(opts),
                 m_env(webrtc::CreateEnvironment()),
                 m_factory(videoDecoderFactory),
                 m_stop(false),
                 m_wait(wait),
-                m_previmagets(0),
-                m_prevts(0) {
+                m_clock(uri.empty() ? std::make_shared<SourceClock>() : SourceClock::Get(uri)) {
             this->Start();                    
         }
 
@@ -160,36 +161,32 @@ class VideoDecoder : public webrtc::VideoSourceInterface<webrtc::VideoFrame>, pu
 
 		// overide webrtc::DecodedImageCallback
 	    virtual int32_t Decoded(webrtc::VideoFrame& decodedImage) override {
-            int64_t ts = std::chrono::high_resolution_clock::now().time_since_epoch().count()/1000/1000;
-
             RTC_LOG(LS_VERBOSE) << "VideoDecoder::Decoded size:" << decodedImage.size() 
                         << " decode rtptime:" << decodedImage.rtp_timestamp()
-                        << " decode ts:" << decodedImage.timestamp_us()/1000
-                        << " source ts:" << ts;
+                        << " decode ts:" << decodedImage.timestamp_us()/1000;
 
             if (decodedImage.timestamp_us() == 0) {
-                decodedImage.set_timestamp_us(decodedImage.rtp_timestamp()*1000);
+                // the builtin decoders only keep the 32 bits RTP timestamp, the presentation time is found from it
+                int64_t presentationTimeMs = this->getPresentationTime(decodedImage.rtp_timestamp());
+                if (presentationTimeMs < 0) {
+                    RTC_LOG(LS_WARNING) << "VideoDecoder::Decoded unknown rtptime:" << decodedImage.rtp_timestamp();
+                    return 1;
+                }
+                decodedImage.set_timestamp_us(presentationTimeMs*1000);
             }
 
-            // waiting 
-            if ( (m_wait) && (m_prevts != 0) ) {
-                int64_t periodSource = decodedImage.timestamp_us()/1000 - m_previmagets;
-                int64_t periodDecode = ts-m_prevts;
-                    
-                RTC_LOG(LS_VERBOSE) << "VideoDecoder::Decoded interframe decode:" << periodDecode << " source:" << periodSource;
-                int64_t delayms = periodSource-periodDecode;
-                if ( (delayms > 0) && (delayms < 1000) ) {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(delayms));			
-                }
+            // map the presentation time on the clock shared with the audio of the source
+            int64_t localUs = m_clock->toLocalUs(SourceClock::kVideo, decodedImage.timestamp_us());
+            if (m_wait) {
+                m_clock->waitUntil(localUs);
             } else {
                 std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            }                        
+            }
+            decodedImage.set_timestamp_us(localUs);
+            decodedImage.set_ntp_time_ms(m_clock->toNtpMs(localUs));
 
             m_scaler.OnFrame(decodedImage);
 
-	        m_previmagets = decodedImage.timestamp_us()/1000;
-	        m_prevts = std::chrono::high_resolution_clock::now().time_since_epoch().count()/1000/1000;
-                       
             return 1;
         }
 
@@ -274,6 +271,7 @@ class VideoDecoder : public webrtc::VideoSourceInterface<webrtc::VideoFrame>, pu
                         input_image.SetRtpTimestamp(frame.m_timestamp_ms); // store time in ms that overflow the 32bits
 
                         if (this->hasDecoder()) {
+                            this->addPresentationTime(input_image.RtpTimestamp(), frame.m_timestamp_ms);
                             int res = m_decoder->Decode(input_image, false, frame.m_timestamp_ms);
                             if (res != WEBRTC_VIDEO_CODEC_OK) {
                                 RTC_LOG(LS_ERROR) << "VideoDecoder::DecoderThread failure:" << res << " => reset decoder";
@@ -287,6 +285,25 @@ class VideoDecoder : public webrtc::VideoSourceInterface<webrtc::VideoFrame>, pu
             }
         }
 
+        // the decoders could output the frames later than they are decoded (reordering, hardware)
+        void addPresentationTime(uint32_t rtpTimestamp, uint64_t presentationTimeMs) {
+            std::lock_guard<std::mutex> lock(m_presentationTimeMutex);
+            m_presentationTimes.push_back(std::make_pair(rtpTimestamp, presentationTimeMs));
+            if (m_presentationTimes.size() > kMaxPresentationTimes) {
+                m_presentationTimes.pop_front();
+            }
+        }
+
+        int64_t getPresentationTime(uint32_t rtpTimestamp) {
+            std::lock_guard<std::mutex> lock(m_presentationTimeMutex);
+            for (auto it = m_presentationTimes.rbegin(); it != m_presentationTimes.rend(); ++it) {
+                if (it->first == rtpTimestamp) {
+                    return it->second;
+                }
+            }
+            return -1;
+        }
+
         void Start()
         {
             RTC_LOG(LS_INFO) << "VideoDecoder::start";
@@ -310,6 +327,11 @@ class VideoDecoder : public webrtc::VideoSourceInterface<webrtc::VideoFrame>, pu
     public:
         std::unique_ptr<webrtc::VideoDecoder>         m_decoder;
 
+    private:
+        static const size_t                           kMaxPresentationTimes = 64;
+        std::mutex                                    m_presentationTimeMutex;
+        std::deque<std::pair<uint32_t,uint64_t>>      m_presentationTimes;
+
     protected:
         VideoScaler                                   m_scaler;
         const webrtc::Environment                     m_env;
@@ -326,7 +348,6 @@ class VideoDecoder : public webrtc::VideoSourceInterface<webrtc::VideoFrame>, pu
         bool                                  m_stop;   
 
         bool                                  m_wait;
-        int64_t                               m_previmagets;	
-        int64_t                               m_prevts;
+        std::shared_ptr<SourceClock>          m_clock;
 
 };
@@ -16,6 +16,8 @@
 #include "api/media_stream_interface.h"
 #include "api/video/i420_buffer.h"
 
+#include <cmath>
+
 #include "VideoSource.h"
 
 class VideoScaler :  public webrtc::VideoSinkInterface<webrtc::VideoFrame>,  public VideoSource 
@@ -25,7 +27,8 @@ public:
     VideoScaler(const std::map<std::string, std::string> &opts) :
                 m_width(0), m_height(0), 
                 m_rotation(webrtc::kVideoRotation_0),
-                m_roi_x(0), m_roi_y(0), m_roi_width(0), m_roi_height(0) 
+                m_roi_x(0), m_roi_y(0), m_roi_width(0), m_roi_height(0),
+                m_input_width(0), m_input_height(0)
     {
         if (opts.find("width") != opts.end())
         {
@@ -86,23 +89,46 @@ public:
     {
     }
 
-    webrtc::scoped_refptr<webrtc::I420Buffer> createOutputBuffer() {
-        int height = m_height;
-        int width = m_width;
+    void getOutputSize(int roi_width, int roi_height, int & width, int & height) const {
+        height = m_height;
+        width = m_width;
         if ( (height == 0) && (width == 0) )
         {
-            height = m_roi_height;
-            width = m_roi_width;
+            height = roi_height;
+            width = roi_width;
         }
         else if (height == 0)
         {
-            height = (m_roi_height * width) / m_roi_width;
+            height = (roi_height * width) / roi_width;
         }
         else if (width == 0)
         {
-            width = (m_roi_width * height) / m_roi_height;
+            width = (roi_width * height) / roi_height;
+        }
+    }
+
+    // output size for a full source frame, only when it is downscaled without ROI
+    bool getDownscaledSize(int srcWidth, int srcHeight, int & width, int & height) const {
+        if (m_roi_x || m_roi_y || m_roi_width || m_roi_height)
+        {
+            return false;
+        }
+        getOutputSize(srcWidth, srcHeight, width, height);
+
+        // limit to the resolution wanted by the sinks
+        webrtc::VideoSinkWants wants = m_broadcaster.wants();
+        int maxPixels = wants.max_pixel_count;
+        if (wants.target_pixel_count && (*wants.target_pixel_count < maxPixels))
+        {
+            maxPixels = *wants.target_pixel_count;
         }
-        return webrtc::I420Buffer::Create(width, height);
+        if ((int64_t)width * height > maxPixels)
+        {
+            double scale = std::sqrt((double)maxPixels / ((int64_t)width * height));
+            width = width * scale;
+            height = height * scale;
+        }
+        return (width < srcWidth) && (height < srcHeight);
     }
 
     void OnFrame(const webrtc::VideoFrame &frame) override
@@ -128,31 +154,39 @@ public:
             m_roi_height = 0;
         }
 
-        if (m_roi_width == 0)
+        // the ROI size is evaluated for each frame, the source size could change (ie: downscaled JPEG decoding)
+        m_input_width = (m_roi_width != 0) ? m_roi_width : frame.width() - m_roi_x;
+        m_input_height = (m_roi_height != 0) ? m_roi_height : frame.height() - m_roi_y;
+
+        if (frame.video_frame_buffer()->type() == webrtc::VideoFrameBuffer::Type::kNative)
         {
-            m_roi_width = frame.width() - m_roi_x;
+            // encoded frames cannot be scaled or dropped
+            m_broadcaster.OnFrame(frame);
+            return;
         }
-        if (m_roi_height == 0)
+
+        int width = 0;
+        int height = 0;
+        getOutputSize(m_input_width, m_input_height, width, height);
+        int outWidth = width;
+        int outHeight = height;
+        if (!AdaptFrame(width, height, frame.timestamp_us(), outWidth, outHeight))
         {
-            m_roi_height = frame.height() - m_roi_y;
+            RTC_LOG(LS_VERBOSE) << "drop frame for sinks wants";
+            return;
         }
 
-        if ( ((m_roi_width != frame.width()) && (m_roi_height == frame.height()) && (m_rotation == webrtc::kVideoRotation_0)) || (frame.video_frame_buffer()->type() == webrtc::VideoFrameBuffer::Type::kNative) )
+        if ( (m_input_width == frame.width()) && (m_input_height == frame.height()) && (outWidth == frame.width()) && (outHeight == frame.height()) && (m_rotation == webrtc::kVideoRotation_0) )
         {
             m_broadcaster.OnFrame(frame);
         }
         else
         {
-            webrtc::scoped_refptr<webrtc::I420Buffer> scaled_buffer = this->createOutputBuffer();
-            if (m_roi_width != frame.width() || m_roi_height != frame.height())
-            {
-                RTC_LOG(LS_VERBOSE) << "crop:" << m_roi_x << "x" << m_roi_y << " " << m_roi_width << "x" << m_roi_height << " scale: " << scaled_buffer->width() << "x" << scaled_buffer->height();
-                scaled_buffer->CropAndScaleFrom(*frame.video_frame_buffer()->ToI420(), m_roi_x, m_roi_y, m_roi_width, m_roi_height);
-            }
-            else
+            webrtc::scoped_refptr<webrtc::VideoFrameBuffer> scaled_buffer = frame.video_frame_buffer();
+            if ( (m_input_width != frame.width()) || (m_input_height != frame.height()) || (outWidth != frame.width()) || (outHeight != frame.height()) )
             {
-                RTC_LOG(LS_VERBOSE) << "scale: " << scaled_buffer->width() << "x" << scaled_buffer->height();
-                scaled_buffer->ScaleFrom(*frame.video_frame_buffer()->ToI420());
+                RTC_LOG(LS_VERBOSE) << "crop:" << m_roi_x << "x" << m_roi_y << " " << m_input_width << "x" << m_input_height << " scale: " << outWidth << "x" << outHeight;
+                scaled_buffer = scaled_buffer->CropAndScale(m_roi_x, m_roi_y, m_input_width, m_input_height, outWidth, outHeight);
             }
             
             webrtc::VideoFrame scaledFrame = webrtc::VideoFrame::Builder()
@@ -160,6 +194,7 @@ public:
                 .set_rotation(m_rotation)
                 .set_timestamp_rtp(frame.rtp_timestamp())
                 .set_timestamp_us(frame.timestamp_us())
+                .set_ntp_time_ms(frame.ntp_time_ms())
                 .set_id(frame.id())
                 .build();
 
@@ -167,8 +202,10 @@ public:
         }
     }
 
-    int width() const { return m_roi_width;  }
-    int height() const { return m_roi_height;  }
+    int maxFramerate() const { return m_broadcaster.wants().max_framerate_fps; }
+
+    int width() const { return m_input_width;  }
+    int height() const { return m_input_height;  }
 
 private:
     int                    m_width;
@@ -178,5 +215,7 @@ private:
     int                    m_roi_y;
     int                    m_roi_width;
     int                    m_roi_height;    
+    int                    m_input_width;
+    int                    m_input_height;
 };
 
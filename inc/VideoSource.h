@@ -14,17 +14,29 @@
 
 #include "modules/video_capture/video_capture_factory.h"
 #include "api/video/video_broadcaster.h"
+#include "media/base/video_adapter.h"
+#include "rtc_base/time_utils.h"
 
 class VideoSource : public webrtc::VideoSourceInterface<webrtc::VideoFrame> {
 public:
   	void AddOrUpdateSink(webrtc::VideoSinkInterface<webrtc::VideoFrame>* sink, const webrtc::VideoSinkWants& wants) override {
 		m_broadcaster.AddOrUpdateSink(sink, wants);
+		m_adapter.OnSinkWants(m_broadcaster.wants());
   	}
 
   	void RemoveSink(webrtc::VideoSinkInterface<webrtc::VideoFrame>* sink) override {
 		m_broadcaster.RemoveSink(sink);
+		m_adapter.OnSinkWants(m_broadcaster.wants());
   	}
 
 protected:
+	// apply the resolution and frame rate wanted by the sinks, return false if the frame should be dropped
+	bool AdaptFrame(int width, int height, int64_t timestamp_us, int & out_width, int & out_height) {
+		int cropped_width = 0;
+		int cropped_height = 0;
+		return m_adapter.AdaptFrameResolution(width, height, timestamp_us * webrtc::kNumNanosecsPerMicrosec, &cropped_width, &cropped_height, &out_width, &out_height);
+	}
+
 	webrtc::VideoBroadcaster                          m_broadcaster;
+	webrtc::VideoAdapter                              m_adapter;
 };
@@ -0,0 +1,98 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <string>
+#include <map>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+
+// fan-out of the H264/H265 access units of a null codec stream to websocket connections
+// each frame is serialized once and the same buffer is queued to all the connections, one sender thread walks the queues
+// a connection that does not follow skips the frames until the next key frame, the others are delayed by one write at most
+//  - "raw": a text message with the WebCodecs decoder configuration, then a binary message for each access unit
+//    (1 byte flags with the key frame bit, 8 bytes timestamp in us, length prefixed NAL units)
+//  - "fmp4": the init segment, then a fragment for each access unit, for MSE
+class WebsocketStreamSink : public webrtc::VideoSinkInterface<webrtc::VideoFrame>
+{
+public:
+	typedef std::function<bool(const std::string & data, bool binary)> writer;
+	typedef std::function<void()> closer;
+
+private:
+	struct Message
+	{
+		std::shared_ptr<const std::string> m_header;
+		std::shared_ptr<const std::string> m_data;
+		bool                               m_keyFrame;
+	};
+
+	struct Subscriber
+	{
+		Subscriber(const writer & writer, const closer & closer) : m_writer(writer), m_closer(closer), m_waitKeyFrame(true) {}
+
+		writer                             m_writer;
+		closer                             m_closer;
+		std::deque<Message>                m_queue;
+		std::shared_ptr<const std::string> m_header;
+		bool                               m_waitKeyFrame;
+	};
+
+public:
+	WebsocketStreamSink(const std::string & format);
+	virtual ~WebsocketStreamSink();
+
+	// overide webrtc::VideoSinkInterface, it never blocks the source
+	void OnFrame(const webrtc::VideoFrame& frame) override;
+
+	// a connection starts with the header and the next key frame, it is closed and dropped when a write fails
+	void addSubscriber(const void* id, const writer & writer, const closer & closer);
+	// once removed, the writer of the connection is not called anymore, only its pending write is waited
+	void removeSubscriber(const void* id);
+	size_t getSubscriberCount();
+	// stop the sender and close all the connections, when the stream goes away
+	void close();
+
+private:
+	void SenderThread();
+	void stop();
+
+private:
+	const bool                                        m_fmp4;
+
+	// serialization state
+	std::string                                       m_codec;
+	std::vector<uint8_t>                              m_config;
+	int                                               m_width;
+	int                                               m_height;
+	std::shared_ptr<const std::string>                m_header;
+	uint32_t                                          m_fragmentSeq;
+	int64_t                                           m_firstTimestamp;
+	int64_t                                           m_lastTimestamp;
+	uint32_t                                          m_lastDuration;
+
+	std::mutex                                        m_subscriberMutex;
+	std::condition_variable                           m_subscriberCond;
+	std::map<const void*, std::shared_ptr<Subscriber>> m_subscribers;
+	const void*                                       m_writing;
+	bool                                              m_stop;
+	std::thread                                       m_thread;
+};
@@ -0,0 +1,56 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "CivetServer.h"
+
+/* ---------------------------------------------------------------------------
+**  HTTP front end of the worker processes
+**  the requests of a stream go to the same worker, the follow-up requests of a peer go to the worker that created it
+**  it authenticates the requests and terminates TLS, the websockets are not available
+** -------------------------------------------------------------------------*/
+class WorkerDispatcher : public CivetServer
+{
+	public:
+		WorkerDispatcher(const std::vector<std::string> & workers, const std::string & basePath, const std::vector<std::string>& options);
+		virtual ~WorkerDispatcher();
+
+		bool forward(struct mg_connection *conn);
+		void expirePeers();
+
+	private:
+		struct Peer
+		{
+			size_t   m_worker;
+			int64_t  m_time;
+		};
+
+		bool getWorker(const struct mg_request_info *req_info, size_t & worker);
+		void updatePeer(const struct mg_request_info *req_info, const struct mg_response_info *resp_info, size_t worker);
+		bool request(size_t worker, const std::string & uri, std::string & answer);
+
+	private:
+		std::vector<std::string>       m_workers;
+		std::string                    m_basePath;
+		std::mutex                     m_peerMutex;
+		std::map<std::string, Peer>    m_peers;
+		CivetHandler*                  m_handler;
+		CivetWebSocketHandler*         m_websocketHandler;
+};
@@ -13,8 +13,14 @@
 #pragma once
 
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <vector>
+#include <algorithm>
 
 #include "api/video/i420_buffer.h"
+#include "common_video/include/video_frame_buffer_pool.h"
 
 #include "libyuv/video_common.h"
 #include "libyuv/convert.h"
@@ -27,13 +33,19 @@
 
 class DesktopCapturer : public VideoSource, public webrtc::DesktopCapturer::Callback  {
 	public:
-		DesktopCapturer(const std::map<std::string,std::string> & opts) : m_width(0), m_height(0) {
+		DesktopCapturer(const std::map<std::string,std::string> & opts) : m_width(0), m_height(0), m_fps(30), m_isrunning(false), m_srcWidth(0), m_srcHeight(0), m_lastFrameTime(0), m_updated(false), m_forceFrame(false) {
 			if (opts.find("width") != opts.end()) {
 				m_width = std::stoi(opts.at("width"));
 			}	
 			if (opts.find("height") != opts.end()) {
 				m_height = std::stoi(opts.at("height"));
 			}
+			if (opts.find("fps") != opts.end()) {
+				m_fps = std::stoi(opts.at("fps"));
+				if (m_fps <= 0) {
+					m_fps = 30;
+				}
+			}
 		}
 		bool Init() {
 			return this->Start();
@@ -49,6 +61,9 @@ class DesktopCapturer : public VideoSource, public webrtc::DesktopCapturer::Call
 		void Stop();
 		bool IsRunning() { return m_isrunning; }
 
+		// overide VideoSource to wake up the capture thread
+		void AddOrUpdateSink(webrtc::VideoSinkInterface<webrtc::VideoFrame>* sink, const webrtc::VideoSinkWants& wants) override;
+
 		// overide webrtc::DesktopCapturer::Callback
 		virtual void OnCaptureResult(webrtc::DesktopCapturer::Result result, std::unique_ptr<webrtc::DesktopFrame> frame);
 		
@@ -57,11 +72,26 @@ class DesktopCapturer : public VideoSource, public webrtc::DesktopCapturer::Call
 
 	
 	protected:
+		void UpdateRect(const webrtc::DesktopFrame & frame, const webrtc::DesktopRect & rect);
+
 		std::thread                              m_capturethread;
 		std::unique_ptr<webrtc::DesktopCapturer> m_capturer;
 		int                                      m_width;		
 		int                                      m_height;	
-		bool                                     m_isrunning;
+		int                                      m_fps;
+		std::atomic<bool>                        m_isrunning;
+		std::mutex                               m_mutex;
+		std::condition_variable                  m_cond;
+
+		// persistent output image updated with the damaged regions
+		webrtc::scoped_refptr<webrtc::I420Buffer> m_canvas;
+		std::vector<uint8_t>                      m_scaled;
+		webrtc::VideoFrameBufferPool              m_bufferPool;
+		int                                       m_srcWidth;
+		int                                       m_srcHeight;
+		int64_t                                   m_lastFrameTime;
+		bool                                      m_updated;
+		std::atomic<bool>                         m_forceFrame;
 };
 
 
@@ -12,9 +12,12 @@
 #include <iostream>
 #include <thread>
 #include <mutex>
-#include <queue>
+#include <vector>
+#include <algorithm>
 #include <cctype>
 #include <chrono>
+#include <optional>
+#include <condition_variable>
 
 #include "environment.h"
 
@@ -22,9 +25,23 @@
 #include "api/environment/environment_factory.h"
 #include "api/audio_codecs/builtin_audio_decoder_factory.h"
 
+#include "EncodedAudioFrame.h"
+#include "SourceClock.h"
+
+// non template base of the live sources to get the format of the packets they forward without decoding
+class EncodedAudioSource : public webrtc::Notifier<webrtc::AudioSourceInterface>
+{
+public:
+    // wait for the session, nothing is returned if the source is decoded
+    virtual std::optional<webrtc::SdpAudioFormat> getEncodedFormat(int timeoutMs) = 0;
+};
+
 template <typename T>
-class LiveAudioSource : public webrtc::Notifier<webrtc::AudioSourceInterface>, public T::Callback
+class LiveAudioSource : public EncodedAudioSource, public T::Callback
 {
+    // used to size the decode buffer when the decoder cannot give the packet duration
+    static const int kMaxPacketDurationMs = 120;
+
 public:
     SourceState state() const override { return kLive; }
     bool remote() const override { return true; }
@@ -42,6 +59,13 @@ public:
         m_sinks.remove(sink);
     }
 
+    std::optional<webrtc::SdpAudioFormat> getEncodedFormat(int timeoutMs) override
+    {
+        std::unique_lock<std::mutex> lock(m_formatMutex);
+        m_formatCond.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return m_session; });
+        return m_encodedFormat;
+    }
+
     void CaptureThread()
     {
         m_env.mainloop();
@@ -71,11 +95,23 @@ public:
                 m_decoder = m_factory->Create(m_webrtcenv, format, std::optional<webrtc::AudioCodecPairId>());
                 m_codec[id] = codec;
                 success = true;
+
+                std::lock_guard<std::mutex> lock(m_formatMutex);
+                if (m_passthrough && (EncodedAudioFrame::getCodec(codec) != EncodedAudioFrame::kUnknown))
+                {
+                    RTC_LOG(LS_INFO) << "LiveAudioSource::onNewSession forward encoded " << codec;
+                    m_encodedCodec = EncodedAudioFrame::getCodec(codec);
+                    m_encodedFormat = format;
+                }
             }
             else
             {
                 RTC_LOG(LS_ERROR) << "LiveAudioSource::onNewSession not support codec" << sdp;
             }
+
+            std::lock_guard<std::mutex> lock(m_formatMutex);
+            m_session = true;
+            m_formatCond.notify_all();
         }
         return success;
     }
@@ -87,66 +123,62 @@ public:
         if (m_codec.find(id) != m_codec.end())
         {
             int64_t sourcets = presentationTime.tv_sec;
-            sourcets = sourcets * 1000 + presentationTime.tv_usec / 1000;
-
-            int64_t ts = std::chrono::high_resolution_clock::now().time_since_epoch().count() / 1000 / 1000;
+            sourcets = sourcets * 1000000 + presentationTime.tv_usec;
 
-            RTC_LOG(LS_VERBOSE) << "LiveAudioSource::onData decode ts:" << ts
-                              << " source ts:" << sourcets;
+            RTC_LOG(LS_VERBOSE) << "LiveAudioSource::onData source ts:" << sourcets / 1000;
 
             if (m_decoder.get() != NULL)
             {
-
-                // waiting
-                if ((m_wait) && (m_prevts != 0))
+                // map the presentation time on the clock shared with the video of the source
+                int64_t localUs = m_clock->toLocalUs(SourceClock::kAudio, sourcets);
+                if (m_wait)
                 {
-                    int64_t periodSource = sourcets - m_previmagets;
-                    int64_t periodDecode = ts - m_prevts;
-
-                    RTC_LOG(LS_VERBOSE) << "LiveAudioSource::onData interframe decode:" << periodDecode << " source:" << periodSource;
-                    int64_t delayms = periodSource - periodDecode;
-                    if ((delayms > 0) && (delayms < 1000))
-                    {
-                        std::this_thread::sleep_for(std::chrono::milliseconds(delayms));
-                    }
+                    m_clock->waitUntil(localUs);
                 }
 
-                int maxDecodedBufferSize = m_decoder->PacketDuration(buffer, size) * m_channel * sizeof(int16_t);
-                int16_t *decoded = new int16_t[maxDecodedBufferSize];
-                webrtc::AudioDecoder::SpeechType speech_type;
-                int decodedBufferSize = m_decoder->Decode(buffer, size, m_freq, maxDecodedBufferSize, decoded, &speech_type);
-                RTC_LOG(LS_VERBOSE) << "LiveAudioSource::onData size:" << size << " decodedBufferSize:" << decodedBufferSize << " maxDecodedBufferSize: " << maxDecodedBufferSize << " channels: " << m_channel;
-                if (decodedBufferSize > 0)
+                if (m_encodedCodec != EncodedAudioFrame::kUnknown)
                 {
-                    for (int i = 0; i < decodedBufferSize; ++i)
-                    {
-                        m_buffer.push(decoded[i]);
-                    }
+                    this->forwardPacket(buffer, size, segmentLength, localUs);
                 }
                 else
                 {
-                    RTC_LOG(LS_ERROR) << "LiveAudioSource::onData error:Decode Audio failed";
-                }
-                delete[] decoded;
-                while (m_buffer.size() > segmentLength * m_channel)
-                {
-                    int16_t *outbuffer = new int16_t[segmentLength * m_channel];
-                    for (int i = 0; i < segmentLength * m_channel; ++i)
+                    // PacketDuration is in samples per channel, Decode expects a size in bytes and returns a number of samples
+                    int packetDuration = m_decoder->PacketDuration(buffer, size);
+                    if (packetDuration <= 0)
                     {
-                        uint16_t value = m_buffer.front();
-                        outbuffer[i] = value;
-                        m_buffer.pop();
+                        packetDuration = m_freq * kMaxPacketDurationMs / 1000;
                     }
-                    std::lock_guard<std::mutex> lock(m_sink_lock);
-                    for (auto *sink : m_sinks)
+                    size_t maxDecodedSamples = packetDuration * m_channel;
+                    if (m_decoded.size() < maxDecodedSamples)
                     {
-                        sink->OnData(outbuffer, 16, m_freq, m_channel, segmentLength);
+                        m_decoded.resize(maxDecodedSamples);
+                    }
+                    webrtc::AudioDecoder::SpeechType speech_type;
+                    int decodedSamples = m_decoder->Decode(buffer, size, m_freq, m_decoded.size() * sizeof(int16_t), m_decoded.data(), &speech_type);
+                    RTC_LOG(LS_VERBOSE) << "LiveAudioSource::onData size:" << size << " decodedSamples:" << decodedSamples << " maxDecodedSamples: " << maxDecodedSamples << " channels: " << m_channel;
+                    // the buffered samples were captured before this packet
+                    int64_t captureUs = localUs - (int64_t)(m_bufferSize / m_channel) * 1000000 / m_freq;
+                    if (decodedSamples > 0)
+                    {
+                        this->pushSamples(m_decoded.data(), decodedSamples);
+                    }
+                    else
+                    {
+                        RTC_LOG(LS_ERROR) << "LiveAudioSource::onData error:Decode Audio failed";
                     }
-                    delete[] outbuffer;
-                }
 
-                m_previmagets = sourcets;
-                m_prevts = std::chrono::high_resolution_clock::now().time_since_epoch().count() / 1000 / 1000;
+                    size_t segmentSamples = segmentLength * m_channel;
+                    while (m_bufferSize >= segmentSamples)
+                    {
+                        const int16_t *outbuffer = this->popSamples(segmentSamples);
+                        std::lock_guard<std::mutex> lock(m_sink_lock);
+                        for (auto *sink : m_sinks)
+                        {
+                            sink->OnData(outbuffer, 16, m_freq, m_channel, segmentLength, captureUs / 1000);
+                        }
+                        captureUs += 10000;
+                    }
+                }
 
                 success = true;
             }
@@ -158,6 +190,79 @@ public:
         return success;
     }
 
+private:
+    // split the packet over the 10ms mono frames it lasts, NullAudioEncoder gathers them back
+    void forwardPacket(const unsigned char *buffer, size_t size, int segmentLength, int64_t captureUs)
+    {
+        int packetDuration = m_decoder->PacketDuration(buffer, size);
+        if (packetDuration <= 0)
+        {
+            RTC_LOG(LS_ERROR) << "LiveAudioSource::forwardPacket cannot get packet duration size:" << size;
+            return;
+        }
+        int nbFrames = std::max(1, packetDuration / segmentLength);
+        size_t capacity = EncodedAudioFrame::capacity(segmentLength);
+        if (size > nbFrames * capacity)
+        {
+            RTC_LOG(LS_ERROR) << "LiveAudioSource::forwardPacket packet too large size:" << size << " frames:" << nbFrames;
+            return;
+        }
+        RTC_LOG(LS_VERBOSE) << "LiveAudioSource::forwardPacket size:" << size << " duration:" << packetDuration << " frames:" << nbFrames;
+
+        m_segment.resize(segmentLength);
+        for (int i = 0; i < nbFrames; i++)
+        {
+            size_t chunk = std::min(size, capacity);
+            int flags = ((i == 0) ? EncodedAudioFrame::kFirst : 0) | ((i == nbFrames - 1) ? EncodedAudioFrame::kLast : 0);
+            EncodedAudioFrame::write(m_segment.data(), segmentLength, m_encodedCodec, flags, buffer, chunk);
+            buffer += chunk;
+            size -= chunk;
+
+            std::lock_guard<std::mutex> lock(m_sink_lock);
+            for (auto *sink : m_sinks)
+            {
+                sink->OnData(m_segment.data(), 16, m_freq, 1, segmentLength, captureUs / 1000);
+            }
+            captureUs += 10000;
+        }
+    }
+
+    // append decoded samples to the ring buffer, it grows only when the source produces more than it can hold
+    void pushSamples(const int16_t *samples, size_t count)
+    {
+        if (m_bufferSize + count > m_buffer.size())
+        {
+            std::vector<int16_t> buffer(std::max(m_buffer.size() * 2, m_bufferSize + count));
+            size_t first = std::min(m_bufferSize, m_buffer.size() - m_bufferStart);
+            std::copy_n(m_buffer.begin() + m_bufferStart, first, buffer.begin());
+            std::copy_n(m_buffer.begin(), m_bufferSize - first, buffer.begin() + first);
+            m_buffer.swap(buffer);
+            m_bufferStart = 0;
+        }
+        size_t end = (m_bufferStart + m_bufferSize) % m_buffer.size();
+        size_t first = std::min(count, m_buffer.size() - end);
+        std::copy_n(samples, first, m_buffer.begin() + end);
+        std::copy_n(samples + first, count - first, m_buffer.begin());
+        m_bufferSize += count;
+    }
+
+    // remove samples from the ring buffer, they are copied only when they wrap around the end of the buffer
+    const int16_t *popSamples(size_t count)
+    {
+        const int16_t *samples = m_buffer.data() + m_bufferStart;
+        size_t first = m_buffer.size() - m_bufferStart;
+        if (first < count)
+        {
+            m_segment.resize(count);
+            std::copy_n(m_buffer.begin() + m_bufferStart, first, m_segment.begin());
+            std::copy_n(m_buffer.begin(), count - first, m_segment.begin() + first);
+            samples = m_segment.data();
+        }
+        m_bufferStart = (m_bufferStart + count) % m_buffer.size();
+        m_bufferSize -= count;
+        return samples;
+    }
+
 protected:
     LiveAudioSource(webrtc::scoped_refptr<webrtc::AudioDecoderFactory> audioDecoderFactory, const std::string &uri, const std::map<std::string, std::string> &opts, bool wait)
         : m_env(m_stop)
@@ -166,10 +271,19 @@ protected:
         , m_factory(audioDecoderFactory)
         , m_freq(8000)
         , m_channel(1)
+        , m_buffer(kMaxPacketDurationMs * 48 * 2 * 4)
+        , m_bufferStart(0)
+        , m_bufferSize(0)
+        , m_passthrough(false)
+        , m_session(false)
+        , m_encodedCodec(EncodedAudioFrame::kUnknown)
         , m_wait(wait)
-        , m_previmagets(0)
-        , m_prevts(0)
+        , m_clock(SourceClock::Get(uri))
     {
+        if (opts.find("passthrough") != opts.end())
+        {
+            m_passthrough = (opts.at("passthrough") == "1");
+        }
         m_liveclient.start();
         m_capturethread = std::thread(&LiveAudioSource::CaptureThread, this);
     }
@@ -192,13 +306,23 @@ private:
     std::unique_ptr<webrtc::AudioDecoder>           m_decoder;
     int                                             m_freq;
     int                                             m_channel;
-    std::queue<uint16_t>                            m_buffer;
+    std::vector<int16_t>                            m_decoded;
+    std::vector<int16_t>                            m_buffer;
+    size_t                                          m_bufferStart;
+    size_t                                          m_bufferSize;
+    std::vector<int16_t>                            m_segment;
     std::list<webrtc::AudioTrackSinkInterface *>    m_sinks;
     std::mutex                                      m_sink_lock;
 
     std::map<std::string, std::string>              m_codec;
 
+    bool                                            m_passthrough;
+    std::mutex                                      m_formatMutex;
+    std::condition_variable                         m_formatCond;
+    bool                                            m_session;
+    EncodedAudioFrame::Codec                        m_encodedCodec;
+    std::optional<webrtc::SdpAudioFormat>           m_encodedFormat;
+
     bool                                            m_wait;
-    int64_t                                         m_previmagets;
-    int64_t                                         m_prevts;
+    std::shared_ptr<SourceClock>                    m_clock;
 };
@@ -18,6 +18,7 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <limits>
 
 #include "environment.h"
 
@@ -38,15 +39,17 @@
 #include "api/video_codecs/video_decoder.h"
 
 #include "VideoDecoder.h"
+#include "JpegScaledDecoder.h"
 
 template <typename T>
 class LiveVideoSource : public VideoDecoder, public T::Callback
 {
 public:
     LiveVideoSource(const std::string &uri, const std::map<std::string, std::string> &opts, std::unique_ptr<webrtc::VideoDecoderFactory>& videoDecoderFactory, bool wait) :
-	    VideoDecoder(opts, videoDecoderFactory, wait),
+	    VideoDecoder(opts, videoDecoderFactory, wait, uri),
         m_env(m_stop),
-	    m_liveclient(m_env, this, uri.c_str(), opts, webrtc::LogMessage::GetLogToDebug()<=2) {
+	    m_liveclient(m_env, this, uri.c_str(), opts, webrtc::LogMessage::GetLogToDebug()<=2),
+        m_prevTimestamp(0), m_lastJPEGTimestamp(0), m_waitKeyFrame(false) {
             m_liveclient.start();
             this->Start();
     }
@@ -64,10 +67,21 @@ public:
         RTC_LOG(LS_INFO) << "LiveVideoSource::stop";
         m_liveclient.stop();
         m_env.stop();
-        m_capturethread.join();
+        if (m_capturethread.joinable()) {
+            m_capturethread.join();
+        }
     }
     bool IsRunning() { return (m_stop == 0); }
 
+    // forget the parameter sets and the timestamps of the previous session, the frames are skipped until the next key frame
+    void resync()
+    {
+        m_cfg.clear();
+        m_codec.clear();
+        m_prevTimestamp = 0;
+        m_waitKeyFrame = true;
+    }
+
     void CaptureThread()
     {
         m_env.mainloop();
@@ -165,7 +179,11 @@ public:
                 {
                     RTC_LOG(LS_VERBOSE) << "LiveVideoSource:onData SLICE NALU:" << nalu_type;
                 }
-                if (m_prevTimestamp && ts < m_prevTimestamp && m_decoder && strcmp(m_decoder->ImplementationName(),"FFmpeg")==0) 
+                if (m_waitKeyFrame)
+                {
+                    RTC_LOG(LS_VERBOSE) << "LiveVideoSource:onData skip frame until key frame";
+                }
+                else if (m_prevTimestamp && ts < m_prevTimestamp && m_decoder && strcmp(m_decoder->ImplementationName(),"FFmpeg")==0) 
                 {
                     RTC_LOG(LS_ERROR) << "LiveVideoSource:onData drop frame in past for FFmpeg:" << (m_prevTimestamp-ts);
 
@@ -180,6 +198,7 @@ public:
         if (idrContent.size() > 0) {
             webrtc::scoped_refptr<webrtc::EncodedImageBuffer> frame = webrtc::EncodedImageBuffer::Create(idrContent.data(), idrContent.size());
             PostFrame(frame, ts, webrtc::VideoFrameType::kVideoFrameKey);
+            m_waitKeyFrame = false;
             RTC_LOG(LS_VERBOSE) << "LiveVideoSource:onData posted multi-slice IDR frame total_size=" << idrContent.size();
         }
     }
@@ -238,7 +257,11 @@ public:
                 {
                     RTC_LOG(LS_VERBOSE) << "LiveVideoSource:onData SLICE NALU:" << nalu_type;
                 }
-                if (m_prevTimestamp && ts < m_prevTimestamp && m_decoder && strcmp(m_decoder->ImplementationName(),"FFmpeg")==0)
+                if (m_waitKeyFrame)
+                {
+                    RTC_LOG(LS_VERBOSE) << "LiveVideoSource:onData skip frame until key frame";
+                }
+                else if (m_prevTimestamp && ts < m_prevTimestamp && m_decoder && strcmp(m_decoder->ImplementationName(),"FFmpeg")==0)
                 {
                     RTC_LOG(LS_ERROR) << "LiveVideoSource:onData drop frame in past for FFmpeg:" << (m_prevTimestamp-ts);
 
@@ -253,21 +276,49 @@ public:
         if (idrContent.size() > 0) {
             webrtc::scoped_refptr<webrtc::EncodedImageBuffer> frame = webrtc::EncodedImageBuffer::Create(idrContent.data(), idrContent.size());
             PostFrame(frame, ts, webrtc::VideoFrameType::kVideoFrameKey);
+            m_waitKeyFrame = false;
             RTC_LOG(LS_VERBOSE) << "LiveVideoSource:onData posted H265 multi-slice IDR frame total_size=" << idrContent.size();
         }
     }
 
     int onJPEGData(unsigned char *buffer, ssize_t size, int64_t ts, const std::string & codec) {
         int res = 0;
+        // each JPEG frame is independent, frames above the rate wanted by the sinks are not decoded
+        int maxFramerate = m_scaler.maxFramerate();
+        if ( (maxFramerate > 0) && (maxFramerate < std::numeric_limits<int>::max()) && m_lastJPEGTimestamp && (ts - m_lastJPEGTimestamp < 1000 / maxFramerate) )
+        {
+            RTC_LOG(LS_VERBOSE) << "LiveVideoSource:onData skip JPEG frame for sinks wants";
+            return res;
+        }
+        m_lastJPEGTimestamp = ts;
+
         int32_t width = 0;
         int32_t height = 0;
         if (libyuv::MJPGSize(buffer, size, &width, &height) == 0)
         {
-            int stride_y = width;
-            int stride_uv = (width + 1) / 2;
+            int conversionResult = 0;
+            webrtc::scoped_refptr<webrtc::I420Buffer> I420buffer;
 
-            webrtc::scoped_refptr<webrtc::I420Buffer> I420buffer = webrtc::I420Buffer::Create(width, height, stride_y, stride_uv, stride_uv);
-            const int conversionResult = libyuv::ConvertToI420((const uint8_t *)buffer, size,
+            // decode directly at a reduced size when the output is downscaled
+            int targetWidth = 0;
+            int targetHeight = 0;
+            if (m_scaler.getDownscaledSize(width, height, targetWidth, targetHeight))
+            {
+                int denom = JpegScaledDecoder::getScaleDenom(width, height, targetWidth, targetHeight);
+                if (denom > 1)
+                {
+                    I420buffer = m_jpegDecoder.decode(buffer, size, denom);
+                    RTC_LOG(LS_VERBOSE) << "LiveVideoSource:onData JPEG scaled decoding 1/" << denom;
+                }
+            }
+
+            if (!I420buffer)
+            {
+                int stride_y = width;
+                int stride_uv = (width + 1) / 2;
+
+                I420buffer = webrtc::I420Buffer::Create(width, height, stride_y, stride_uv, stride_uv);
+                conversionResult = libyuv::ConvertToI420((const uint8_t *)buffer, size,
                                                                 I420buffer->MutableDataY(), I420buffer->StrideY(),
                                                                 I420buffer->MutableDataU(), I420buffer->StrideU(),
                                                                 I420buffer->MutableDataV(), I420buffer->StrideV(),
@@ -275,6 +326,7 @@ public:
                                                                 width, height,
                                                                 width, height,
                                                                 libyuv::kRotate0, ::libyuv::FOURCC_MJPG);
+            }
 
             if (conversionResult >= 0)
             {
@@ -336,9 +388,9 @@ public:
 
 private:
     char        m_stop;
-    Environment m_env;
 
 protected:
+    Environment m_env;
     T m_liveclient;
 
 private:
@@ -347,4 +399,7 @@ private:
     std::map<std::string, std::string> m_codec;
 
     uint64_t                           m_prevTimestamp;
+    JpegScaledDecoder                  m_jpegDecoder;
+    int64_t                            m_lastJPEGTimestamp;
+    bool                               m_waitKeyFrame;
 };
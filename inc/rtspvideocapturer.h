@@ -12,10 +12,14 @@
 
 #pragma once
 
+#include <memory>
+#include <vector>
 
 #include "livevideosource.h"
 #include "rtspconnectionclient.h"
 
+// the alternate urls of a stream (backup encoder, substream) are opened in turn when the current one is stalled
+// the decoder and its sinks are kept, so the viewers do not need to renegotiate
 class RTSPVideoCapturer : public LiveVideoSource<RTSPConnection>
 {
 	public:
@@ -27,13 +31,31 @@ class RTSPVideoCapturer : public LiveVideoSource<RTSPConnection>
 		}
 		
 		// overide RTSPConnection::Callback
+		virtual bool    onData(const char* id, unsigned char* buffer, ssize_t size, struct timeval presentationTime) override;
 		virtual void    onConnectionTimeout(RTSPConnection& connection) override {
-				connection.start();
+				this->restart(connection, 0);
 		}
 		virtual void    onDataTimeout(RTSPConnection& connection) override {
-				connection.start();
+				this->restart(connection, 0);
 		}
 		virtual void    onError(RTSPConnection& connection,const char* erro) override;
+
+	private:
+		void            restart(RTSPConnection& connection, unsigned int delay);
+		RTSPConnection& getConnection(size_t index);
+		void            failover();
+		static void     TaskFailover(void* clientData) {
+				static_cast<RTSPVideoCapturer*>(clientData)->failover();
+		}
+
+	private:
+		std::map<std::string,std::string>                  m_opts;
+		std::vector<std::string>                           m_urls;
+		size_t                                             m_current;
+		std::map<size_t, std::unique_ptr<RTSPConnection>>  m_alternates;
+		int64_t                                            m_failoverMs;
+		int64_t                                            m_lastDataTime;
+		TaskToken                                          m_failoverTask;
 };
 
 
@@ -0,0 +1,74 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <string>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "api/peer_connection_interface.h"
+#include "api/video/video_frame.h"
+#include "api/video/video_sink_interface.h"
+
+#include "VideoSource.h"
+
+// video source pulling a stream from the WHEP endpoint of an upstream instance (webrtc://host:port/stream or webrtcs://...)
+// with the null codec factory, the encoded frames are forwarded without being decoded
+class WebRtcVideoSource : public VideoSource, public webrtc::PeerConnectionObserver, public webrtc::VideoSinkInterface<webrtc::VideoFrame>
+{
+public:
+	static WebRtcVideoSource* Create(const std::string & url, const std::map<std::string,std::string> & opts, webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> peerConnectionFactory, bool useNullCodec);
+	virtual ~WebRtcVideoSource();
+
+	int width() const { return m_width; }
+	int height() const { return m_height; }
+
+	// overide webrtc::VideoSinkInterface
+	void OnFrame(const webrtc::VideoFrame& frame) override;
+
+	// overide webrtc::PeerConnectionObserver
+	void OnSignalingChange(webrtc::PeerConnectionInterface::SignalingState state) override {}
+	void OnDataChannel(webrtc::scoped_refptr<webrtc::DataChannelInterface> channel) override {}
+	void OnIceCandidate(const webrtc::IceCandidate* candidate) override {}
+	void OnIceGatheringChange(webrtc::PeerConnectionInterface::IceGatheringState state) override;
+	void OnConnectionChange(webrtc::PeerConnectionInterface::PeerConnectionState state) override;
+	void OnTrack(webrtc::scoped_refptr<webrtc::RtpTransceiverInterface> transceiver) override;
+
+private:
+	WebRtcVideoSource(const std::string & url, const std::map<std::string,std::string> & opts, webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> peerConnectionFactory, bool useNullCodec);
+
+	void ConnectionThread();
+	bool connect();
+	void disconnect();
+	int request(const std::string & method, const std::string & uri, const std::string & body, std::string & answer, std::string & location);
+
+private:
+	webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> m_peerConnectionFactory;
+	webrtc::scoped_refptr<webrtc::PeerConnectionInterface>        m_pc;
+	std::string                                                   m_host;
+	int                                                           m_port;
+	bool                                                          m_ssl;
+	std::string                                                   m_whepUri;
+	std::string                                                   m_location;
+	std::thread                                                   m_thread;
+	std::mutex                                                    m_mutex;
+	std::condition_variable                                       m_cond;
+	bool                                                          m_stop;
+	bool                                                          m_gatheringComplete;
+	bool                                                          m_failed;
+	std::atomic<int>                                              m_width;
+	std::atomic<int>                                              m_height;
+};
@@ -0,0 +1,278 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#include <stdio.h>
+
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+
+#include "EncodedVideoFrameBuffer.h"
+#include "AnnexB.h"
+#include "Fmp4.h"
+#include "HlsPackager.h"
+
+static const uint32_t kDefaultSampleDuration = kFmp4Timescale / 30;
+static const int64_t  kMaxSampleDuration = kFmp4Timescale * 10;
+static const int      kDefaultPartDurationMs = 500;
+static const int      kDefaultSegmentDurationS = 2;
+static const size_t   kDefaultSegments = 6;
+// the parts are only listed for the last segments
+static const size_t   kPartSegments = 3;
+
+static std::string toSeconds(uint64_t duration) {
+	char value[32];
+	snprintf(value, sizeof(value), "%.5f", (double)duration / kFmp4Timescale);
+	return value;
+}
+
+/* ---------------------------------------------------------------------------
+**  HlsPackager
+** -------------------------------------------------------------------------*/
+HlsPackager::HlsPackager(const std::map<std::string,std::string> & opts)
+	: m_partTarget(kDefaultPartDurationMs * kFmp4Timescale / 1000), m_segmentTarget(kDefaultSegmentDurationS * kFmp4Timescale), m_maxSegments(kDefaultSegments)
+	, m_width(0), m_height(0), m_initVersion(0), m_discontinuity(0), m_firstMsn(0), m_maxSegmentDuration(0)
+	, m_samplesDuration(0), m_decodeTime(0), m_fragmentSeq(0), m_pending(false), m_pendingTimestamp(0)
+	, m_lastRequestTime(webrtc::TimeMillis()) {
+
+	if (opts.find("hlspart") != opts.end()) {
+		m_partTarget = std::stoull(opts.at("hlspart")) * kFmp4Timescale / 1000;
+	}
+	if (opts.find("hlssegment") != opts.end()) {
+		m_segmentTarget = std::stoull(opts.at("hlssegment")) * kFmp4Timescale;
+	}
+	if (opts.find("hlssegments") != opts.end()) {
+		m_maxSegments = std::max((size_t)2, (size_t)std::stoul(opts.at("hlssegments")));
+	}
+	RTC_LOG(LS_INFO) << "HlsPackager part:" << toSeconds(m_partTarget) << "s segment:" << toSeconds(m_segmentTarget) << "s segments:" << m_maxSegments;
+}
+
+void HlsPackager::OnFrame(const webrtc::VideoFrame& frame) {
+	if (frame.video_frame_buffer()->type() != webrtc::VideoFrameBuffer::Type::kNative) {
+		RTC_LOG(LS_VERBOSE) << "HlsPackager ignore decoded frame";
+		return;
+	}
+	EncodedVideoFrameBuffer* buffer = static_cast<EncodedVideoFrameBuffer*>(frame.video_frame_buffer().get());
+	std::string codec = buffer->getFormat().name;
+	if ( (codec != "H264") && (codec != "H265") ) {
+		RTC_LOG(LS_VERBOSE) << "HlsPackager codec not supported:" << codec;
+		return;
+	}
+	webrtc::EncodedImage image = buffer->getEncodedImage(frame.rtp_timestamp(), frame.ntp_time_ms());
+	if (!image.data() || (image.size() == 0)) {
+		return;
+	}
+	bool keyFrame = (image._frameType == webrtc::VideoFrameType::kVideoFrameKey);
+	int64_t timestamp = (frame.timestamp_us() ? frame.timestamp_us() : webrtc::TimeMicros()) * kFmp4Timescale / 1000000;
+	std::vector<uint8_t> config;
+	if (keyFrame) {
+		config = getDecoderConfiguration(codec, image.data(), image.size());
+	}
+	std::vector<uint8_t> payload = toLengthPrefixed(codec, image.data(), image.size());
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		// the duration of a sample is known when the next one is received
+		if (m_pending) {
+			int64_t duration = timestamp - m_pendingTimestamp;
+			if ( (duration <= 0) || (duration > kMaxSampleDuration) ) {
+				duration = kDefaultSampleDuration;
+			}
+			m_pendingSample.m_duration = duration;
+			m_samplesDuration += duration;
+			m_samples.push_back(std::move(m_pendingSample));
+			m_pending = false;
+		}
+
+		if (!config.empty() && ( (codec != m_codec) || (config != m_config) || (frame.width() != m_width) || (frame.height() != m_height) )) {
+			this->reset(codec, config, frame.width(), frame.height());
+		} else if (m_init.empty()) {
+			return;
+		} else if (keyFrame && !m_segments.empty() && (m_segments.back().m_duration + m_samplesDuration >= m_segmentTarget)) {
+			// the segments start with a key frame
+			this->closePart();
+			this->completeSegment();
+		} else if (!m_samples.empty() && (m_samplesDuration + m_samples.back().m_duration > m_partTarget)) {
+			this->closePart();
+		}
+
+		if (m_segments.empty() || m_segments.back().m_complete) {
+			m_segments.push_back(Segment());
+		}
+		m_pendingSample.m_data = std::move(payload);
+		m_pendingSample.m_keyFrame = keyFrame;
+		m_pendingTimestamp = timestamp;
+		m_pending = true;
+	}
+	m_cond.notify_all();
+}
+
+// a new init segment, the segments muxed with the previous one are dropped
+void HlsPackager::reset(const std::string & codec, const std::vector<uint8_t> & config, int width, int height) {
+	RTC_LOG(LS_INFO) << "HlsPackager codec:" << codec << " " << width << "x" << height;
+	m_codec = codec;
+	m_config = config;
+	m_width = width;
+	m_height = height;
+	m_init = buildFmp4Init(codec, config, width, height);
+	m_initVersion++;
+	if (!m_segments.empty()) {
+		m_firstMsn += m_segments.size();
+		m_discontinuity++;
+		m_segments.clear();
+	}
+	m_samples.clear();
+	m_samplesDuration = 0;
+	m_maxSegmentDuration = 0;
+}
+
+// moof and mdat of the samples received since the previous part
+void HlsPackager::closePart() {
+	if (m_samples.empty() || m_segments.empty()) {
+		return;
+	}
+	Part part;
+	part.m_data = buildFmp4Fragment(++m_fragmentSeq, m_decodeTime, m_samples);
+	part.m_duration = m_samplesDuration;
+	part.m_independent = m_samples.front().m_keyFrame;
+	Segment & segment = m_segments.back();
+	segment.m_parts.push_back(std::move(part));
+	segment.m_duration += m_samplesDuration;
+	m_decodeTime += m_samplesDuration;
+	m_samples.clear();
+	m_samplesDuration = 0;
+}
+
+void HlsPackager::completeSegment() {
+	if (m_segments.empty() || m_segments.back().m_complete) {
+		return;
+	}
+	m_segments.back().m_complete = true;
+	m_maxSegmentDuration = std::max(m_maxSegmentDuration, m_segments.back().m_duration);
+	while (m_segments.size() > m_maxSegments) {
+		m_segments.pop_front();
+		m_firstMsn++;
+	}
+}
+
+bool HlsPackager::isAvailable(uint64_t msn, int64_t part) {
+	if (msn < m_firstMsn) {
+		return true;
+	}
+	size_t index = msn - m_firstMsn;
+	if (index >= m_segments.size()) {
+		return false;
+	}
+	const Segment & segment = m_segments[index];
+	return segment.m_complete || ( (part >= 0) && ((uint64_t)part < segment.m_parts.size()) );
+}
+
+int HlsPackager::getPlaylist(const std::string & query, int64_t msn, int64_t part, int timeoutMs, std::string & playlist) {
+	m_lastRequestTime = webrtc::TimeMillis();
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (msn >= 0) {
+		// blocking playlist reload
+		if ((uint64_t)msn > m_firstMsn + m_segments.size() + 1) {
+			return 400;
+		}
+		if (!m_cond.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this, msn, part] { return this->isAvailable(msn, part); })) {
+			return 503;
+		}
+	} else if (!m_cond.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return !m_segments.empty() && !m_segments.front().m_parts.empty(); })) {
+		return 503;
+	}
+
+	std::ostringstream os;
+	os << "#EXTM3U\n";
+	os << "#EXT-X-VERSION:6\n";
+	os << "#EXT-X-TARGETDURATION:" << (std::max(m_segmentTarget, m_maxSegmentDuration) + kFmp4Timescale - 1) / kFmp4Timescale << "\n";
+	os << "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=" << toSeconds(3 * m_partTarget) << "\n";
+	os << "#EXT-X-PART-INF:PART-TARGET=" << toSeconds(m_partTarget) << "\n";
+	os << "#EXT-X-MEDIA-SEQUENCE:" << m_firstMsn << "\n";
+	if (m_discontinuity) {
+		os << "#EXT-X-DISCONTINUITY-SEQUENCE:" << m_discontinuity << "\n";
+	}
+	os << "#EXT-X-MAP:URI=\"init.mp4?" << query << "&init=" << m_initVersion << "\"\n";
+	for (size_t i = 0; i < m_segments.size(); i++) {
+		const Segment & segment = m_segments[i];
+		uint64_t seq = m_firstMsn + i;
+		if (i + kPartSegments >= m_segments.size()) {
+			for (size_t index = 0; index < segment.m_parts.size(); index++) {
+				const Part & item = segment.m_parts[index];
+				os << "#EXT-X-PART:DURATION=" << toSeconds(item.m_duration) << ",URI=\"part.m4s?" << query << "&msn=" << seq << "&part=" << index << "\"";
+				if (item.m_independent) {
+					os << ",INDEPENDENT=YES";
+				}
+				os << "\n";
+			}
+		}
+		if (segment.m_complete) {
+			os << "#EXTINF:" << toSeconds(segment.m_duration) << ",\n";
+			os << "segment.m4s?" << query << "&msn=" << seq << "\n";
+		}
+	}
+	uint64_t nextMsn = m_firstMsn + m_segments.size();
+	size_t nextPart = 0;
+	if (!m_segments.empty() && !m_segments.back().m_complete) {
+		nextMsn--;
+		nextPart = m_segments.back().m_parts.size();
+	}
+	os << "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"part.m4s?" << query << "&msn=" << nextMsn << "&part=" << nextPart << "\"\n";
+	playlist = os.str();
+	return 200;
+}
+
+int HlsPackager::getInit(std::string & data) {
+	m_lastRequestTime = webrtc::TimeMillis();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_init.empty()) {
+		return 404;
+	}
+	data = m_init;
+	return 200;
+}
+
+int HlsPackager::getSegment(uint64_t msn, std::string & data) {
+	m_lastRequestTime = webrtc::TimeMillis();
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if ( (msn < m_firstMsn) || (msn - m_firstMsn >= m_segments.size()) || !m_segments[msn - m_firstMsn].m_complete ) {
+		return 404;
+	}
+	for (const Part & part : m_segments[msn - m_firstMsn].m_parts) {
+		data.append(part.m_data);
+	}
+	return 200;
+}
+
+int HlsPackager::getPart(uint64_t msn, uint64_t part, int timeoutMs, std::string & data) {
+	m_lastRequestTime = webrtc::TimeMillis();
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if ( (msn < m_firstMsn) || (msn > m_firstMsn + m_segments.size()) ) {
+		return 404;
+	}
+	// the preload hint of the next part is answered as soon as it is muxed
+	m_cond.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this, msn, part] {
+		return (msn < m_firstMsn) || this->isAvailable(msn, part);
+	});
+	if ( (msn < m_firstMsn) || (msn - m_firstMsn >= m_segments.size()) ) {
+		return 404;
+	}
+	const Segment & segment = m_segments[msn - m_firstMsn];
+	if (part >= segment.m_parts.size()) {
+		return segment.m_complete ? 404 : 503;
+	}
+	data = segment.m_parts[part].m_data;
+	return 200;
+}
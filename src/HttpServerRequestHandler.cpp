@@ -20,6 +20,13 @@
 #include <fstream>
 #include <iterator>
 #include <vector>
+#include <functional>
+#include <set>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 
 #include "prometheus/counter.h"
 #include "prometheus/gauge.h"
@@ -52,6 +59,7 @@ class RequestHandler : public CivetHandler
 {
   public:
 	RequestHandler(HttpServerRequestHandler::httpFunction & func, prometheus::Counter & counter): m_func(func), m_counter(counter) {
+        m_writerBuilder["indentation"] = "";
 	}	  
 	
     bool handle(CivetServer *server, struct mg_connection *conn)
@@ -86,12 +94,28 @@ class RequestHandler : public CivetHandler
             answer = mg_get_response_code_text(conn, code);
         }
 
-        RTC_LOG(LS_VERBOSE) << "code:" << code << " answer:" << answer;	
-        mg_printf(conn,"HTTP/1.1 %d OK\r\n", code);
+        // the lists are tagged with a hash of their content, unchanged content is not sent again
+        // the images and the HLS media are not hashed, they change with each request
+        std::map<std::string,std::string> & headers = std::get<1>(out);
+        if ((code == 200) && (strcmp(req_info->request_method, "GET") == 0) && (headers.find("X-Total-Count") != headers.end())) {
+            char etag[32];
+            snprintf(etag, sizeof(etag), "\"%zx\"", std::hash<std::string>()(answer));
+            headers["ETag"] = etag;
+            headers["Access-Control-Expose-Headers"] = "ETag, X-Total-Count";
+            const char* ifNoneMatch = mg_get_header(conn, "If-None-Match");
+            if (ifNoneMatch && (headers["ETag"] == ifNoneMatch)) {
+                code = 304;
+                answer.clear();
+            }
+        }
+
+        RTC_LOG(LS_VERBOSE) << "code:" << code << " size:" << answer.size() << " type:" << ((headers.find("Content-Type") != headers.end()) ? headers["Content-Type"] : "text/plain");
+        mg_printf(conn,"HTTP/1.1 %d %s\r\n", code, mg_get_response_code_text(conn, code));
         mg_printf(conn,"Access-Control-Allow-Origin: *\r\n");
-        mg_printf(conn,"Content-Type: text/plain\r\n");
+        if (headers.find("Content-Type") == headers.end()) {
+            mg_printf(conn,"Content-Type: text/plain\r\n");
+        }
         mg_printf(conn,"Content-Length: %zd\r\n", answer.size());
-        std::map<std::string,std::string> & headers = std::get<1>(out);
         for (auto & it : headers) {
             mg_printf(conn,"%s: %s\r\n", it.first.c_str(), it.second.c_str());
         } 
@@ -246,12 +270,134 @@ class PrometheusHandler : public CivetHandler
 
 class WebsocketHandler: public CivetWebSocketHandler {	
 	public:
-		WebsocketHandler(std::map<std::string,HttpServerRequestHandler::httpFunction> & func): m_func(func) {
+		WebsocketHandler(std::map<std::string,HttpServerRequestHandler::httpFunction> & func): m_func(func), m_subscriptionCount(0), m_running(true) {
+			m_jsonWriterBuilder["indentation"] = "";
+			m_sender = std::thread(&WebsocketHandler::sendLoop, this);
+		}
+
+		virtual ~WebsocketHandler() {
+			{
+				std::lock_guard<std::mutex> lock(m_eventMutex);
+				m_running = false;
+			}
+			m_eventCond.notify_all();
+			m_sender.join();
+		}
+
+		// queue an event for the connections subscribed to the peerid, the writes are done by the sender thread
+		void publish(const std::string & peerid, const Json::Value & event) {
+			if (!this->hasSubscribers()) {
+				return;
+			}
+			std::lock_guard<std::mutex> lock(m_eventMutex);
+			if (m_events.size() >= kMaxPendingEvents) {
+				RTC_LOG(LS_WARNING) << "WebsocketHandler::publish drop event peerid:" << peerid;
+				return;
+			}
+			m_events.push_back(std::make_pair(peerid, Json::writeString(m_jsonWriterBuilder, event)));
+			m_eventCond.notify_one();
+		}
+
+		bool hasSubscribers() {
+			return m_subscriptionCount != 0;
+		}
+
+		// a connection is subscribed to the events of the peer
+		bool hasSubscribers(const std::string & peerid) {
+			if (!this->hasSubscribers()) {
+				return false;
+			}
+			std::lock_guard<std::mutex> lock(m_subscriptionMutex);
+			for (auto & it : m_subscriptions) {
+				if ( (it.second.find("*") != it.second.end()) || (it.second.find(peerid) != it.second.end()) ) {
+					return true;
+				}
+			}
+			return false;
 		}
 				
 	private:
+		static const size_t kMaxPendingEvents = 1024;
+
 		std::map<std::string,HttpServerRequestHandler::httpFunction>      m_func;		
 		Json::StreamWriterBuilder                   m_jsonWriterBuilder;
+		std::mutex                                  m_subscriptionMutex;
+		std::map<struct mg_connection*, std::set<std::string>> m_subscriptions;
+		std::atomic<size_t>                         m_subscriptionCount;
+		std::map<struct mg_connection*, int>        m_writing;
+		std::condition_variable                     m_writingCond;
+		std::mutex                                  m_eventMutex;
+		std::condition_variable                     m_eventCond;
+		std::deque<std::pair<std::string,std::string>> m_events;
+		bool                                        m_running;
+		std::thread                                 m_sender;
+
+		void write(struct mg_connection *conn, const std::string & message) {
+			mg_lock_connection(conn);
+			mg_websocket_write(conn, MG_WEBSOCKET_OPCODE_TEXT, message.c_str(), message.size());
+			mg_unlock_connection(conn);
+		}
+
+		void sendLoop() {
+			std::unique_lock<std::mutex> lock(m_eventMutex);
+			while (m_running) {
+				if (m_events.empty()) {
+					m_eventCond.wait(lock);
+					continue;
+				}
+				std::pair<std::string,std::string> event = m_events.front();
+				m_events.pop_front();
+				lock.unlock();
+				// the connections are written without the subscription lock, their close waits the write in progress
+				std::vector<struct mg_connection*> connections;
+				{
+					std::lock_guard<std::mutex> subscriptionLock(m_subscriptionMutex);
+					for (auto & it : m_subscriptions) {
+						if ( (it.second.find("*") != it.second.end()) || (it.second.find(event.first) != it.second.end()) ) {
+							connections.push_back(it.first);
+							m_writing[it.first]++;
+						}
+					}
+				}
+				for (struct mg_connection* conn : connections) {
+					this->write(conn, event.second);
+					{
+						std::lock_guard<std::mutex> subscriptionLock(m_subscriptionMutex);
+						if (--m_writing[conn] == 0) {
+							m_writing.erase(conn);
+						}
+					}
+					m_writingCond.notify_all();
+				}
+				lock.lock();
+			}
+		}
+
+		Json::Value subscribe(struct mg_connection *conn, const std::string & request, const Json::Value & body) {
+			std::string peerid = body.get("peerid","").asString();
+			if (peerid.empty()) {
+				peerid = "*";
+			}
+			std::lock_guard<std::mutex> lock(m_subscriptionMutex);
+			std::set<std::string> & peers = m_subscriptions[conn];
+			if (request == "subscribe") {
+				peers.insert(peerid);
+			} else if (peerid == "*") {
+				peers.clear();
+			} else {
+				peers.erase(peerid);
+			}
+			Json::Value answer;
+			answer["subscribed"] = Json::Value(Json::arrayValue);
+			for (const std::string & peer : peers) {
+				answer["subscribed"].append(peer);
+			}
+			if (peers.empty()) {
+				m_subscriptions.erase(conn);
+			}
+			m_subscriptionCount = m_subscriptions.size();
+			return answer;
+		}
 	
 		virtual bool handleConnection(CivetServer *server, const struct mg_connection *conn) {
 			RTC_LOG(LS_INFO) << "WS connected";
@@ -268,7 +414,7 @@ class WebsocketHandler: public CivetWebSocketHandler {
 					char *data,
 					size_t data_len) {
 			int opcode = bits&0xf;
-			printf("WS got %lu bytes\n", (long unsigned)data_len);
+			RTC_LOG(LS_VERBOSE) << "WS got " << data_len << " bytes";
 						
 			if (opcode == MG_WEBSOCKET_OPCODE_TEXT) {
 				// parse in
@@ -280,13 +426,15 @@ class WebsocketHandler: public CivetWebSocketHandler {
 				{
 					RTC_LOG(LS_WARNING) << "Received unknown message:" << body;
 				}
-                std::cout << Json::writeString(m_jsonWriterBuilder,in) << std::endl;
+                RTC_LOG(LS_VERBOSE) << Json::writeString(m_jsonWriterBuilder,in);
 
                 std::string request = in.get("request","").asString();
                 auto it = m_func.find(request);
 
                 std::string answer;
-                if (it != m_func.end()) {
+                if ( (request == "subscribe") || (request == "unsubscribe") ) {
+                    answer = Json::writeString(m_jsonWriterBuilder, this->subscribe(conn, request, in.get("body","")));
+                } else if (it != m_func.end()) {
                     HttpServerRequestHandler::httpFunction func = it->second;
                             
                     // invoke API implementation
@@ -298,7 +446,7 @@ class WebsocketHandler: public CivetWebSocketHandler {
                     answer = mg_get_response_code_text(conn, 500);
                 }
 
-				mg_websocket_write(conn, MG_WEBSOCKET_OPCODE_TEXT, answer.c_str(), answer.size());
+				this->write(conn, answer);
 			}
 			
 			return true;
@@ -306,10 +454,63 @@ class WebsocketHandler: public CivetWebSocketHandler {
 
 		virtual void handleClose(CivetServer *server, const struct mg_connection *conn) {
 			RTC_LOG(LS_INFO) << "WS closed";	
+			std::unique_lock<std::mutex> lock(m_subscriptionMutex);
+			struct mg_connection* connection = const_cast<struct mg_connection*>(conn);
+			m_subscriptions.erase(connection);
+			m_subscriptionCount = m_subscriptions.size();
+			m_writingCond.wait(lock, [this, connection] { return m_writing.find(connection) == m_writing.end(); });
 		}
 		
 };
 
+class StreamWebsocketHandler: public CivetWebSocketHandler {
+	public:
+		StreamWebsocketHandler(const HttpServerRequestHandler::wsSubscribe & subscribe, const HttpServerRequestHandler::wsUnsubscribe & unsubscribe)
+			: m_subscribe(subscribe), m_unsubscribe(unsubscribe) {
+		}
+
+	private:
+		HttpServerRequestHandler::wsSubscribe   m_subscribe;
+		HttpServerRequestHandler::wsUnsubscribe m_unsubscribe;
+
+		virtual bool handleConnection(CivetServer *server, const struct mg_connection *conn) {
+			RTC_LOG(LS_INFO) << "WS stream connected";
+			return true;
+		}
+
+		static void closeConnection(struct mg_connection *conn) {
+			mg_lock_connection(conn);
+			mg_websocket_write(conn, MG_WEBSOCKET_OPCODE_CONNECTION_CLOSE, NULL, 0);
+			mg_unlock_connection(conn);
+		}
+
+		// the writer and the closer are called by the stream sender until the connection is unsubscribed
+		virtual void handleReadyState(CivetServer *server, struct mg_connection *conn) {
+			const struct mg_request_info *req_info = mg_get_request_info(conn);
+			bool subscribed = m_subscribe(conn, req_info, [conn](const std::string & data, bool binary) {
+				mg_lock_connection(conn);
+				int ret = mg_websocket_write(conn, binary ? MG_WEBSOCKET_OPCODE_BINARY : MG_WEBSOCKET_OPCODE_TEXT, data.c_str(), data.size());
+				mg_unlock_connection(conn);
+				return ret > 0;
+			}, [conn]() {
+				closeConnection(conn);
+			});
+			if (!subscribed) {
+				RTC_LOG(LS_WARNING) << "WS stream cannot subscribe:" << (req_info->query_string ? req_info->query_string : "");
+				closeConnection(conn);
+			}
+		}
+
+		virtual bool handleData(CivetServer *server, struct mg_connection *conn, int bits, char *data, size_t data_len) {
+			return ((bits&0xf) != MG_WEBSOCKET_OPCODE_CONNECTION_CLOSE);
+		}
+
+		virtual void handleClose(CivetServer *server, const struct mg_connection *conn) {
+			RTC_LOG(LS_INFO) << "WS stream closed";
+			m_unsubscribe(conn);
+		}
+};
+
 /* ---------------------------------------------------------------------------
 **  Constructor
 ** -------------------------------------------------------------------------*/
@@ -331,7 +532,8 @@ HttpServerRequestHandler::HttpServerRequestHandler(std::map<std::string,httpFunc
     this->addHandler("/metrics", handler);
     m_handlers.push_back(handler);
 
-    this->addWebSocketHandler("/ws", new WebsocketHandler(func));    
+    m_websocketHandler = new WebsocketHandler(func);
+    this->addWebSocketHandler("/ws", m_websocketHandler);
 }	
 
 /* ---------------------------------------------------------------------------
@@ -344,6 +546,33 @@ HttpServerRequestHandler::~HttpServerRequestHandler()
         m_handlers.pop_back();
         delete handler;
     }
+    this->removeWebSocketHandler("/ws");
+    delete m_websocketHandler;
+    for (auto & it : m_streamHandlers) {
+        this->removeWebSocketHandler(it.first);
+        delete it.second;
+    }
 }   
 
+/* ---------------------------------------------------------------------------
+**  push an event to the websocket subscribers
+** -------------------------------------------------------------------------*/
+void HttpServerRequestHandler::publish(const std::string & peerid, const Json::Value & event)
+{
+    m_websocketHandler->publish(peerid, event);
+}
+
+bool HttpServerRequestHandler::hasSubscribers(const std::string & peerid)
+{
+    return m_websocketHandler->hasSubscribers(peerid);
+}
 
+/* ---------------------------------------------------------------------------
+**  register a websocket pushing a stream
+** -------------------------------------------------------------------------*/
+void HttpServerRequestHandler::addStreamHandler(const std::string & uri, const wsSubscribe & subscribe, const wsUnsubscribe & unsubscribe)
+{
+    CivetWebSocketHandler* handler = new StreamWebsocketHandler(subscribe, unsubscribe);
+    this->addWebSocketHandler(uri, handler);
+    m_streamHandlers[uri] = handler;
+}
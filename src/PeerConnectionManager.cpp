@@ -34,6 +34,7 @@
 
 #include "VideoEncoderFactory.h"
 #include "VideoDecoderFactory.h"
+#include "AudioEncoderFactory.h"
 
 
 // Names used for a IceCandidate JSON object.
@@ -45,6 +46,30 @@ const char kCandidateSdpName[] = "candidate";
 const char kSessionDescriptionTypeName[] = "type";
 const char kSessionDescriptionSdpName[] = "sdp";
 
+// time to wait for the session of a passthrough audio source to know its codec
+const int kEncodedAudioFormatTimeoutMs = 2000;
+
+// time to keep the media list before enumerating devices again
+const int64_t kMediaListCacheMs = 5000;
+
+// period of the stats published to the websocket subscribers and of the release of the idle HTTP outputs
+const int kEventStatsPeriodMs = 1000;
+
+// time to wait for the first local candidates before sending an answer that does not wait the gathering completion
+const int kAnswerCandidateTimeoutMs = 500;
+
+// candidates gathered before the local description is set
+const int kIceCandidatePoolSize = 1;
+
+// time to wait for the first frame of a stream opened by a snapshot request
+const int kSnapshotTimeoutMs = 5000;
+
+// time without request before the snapshot or the LL-HLS packaging of a stream is released
+const int64_t kHttpOutputIdleMs = 60000;
+
+// time to hold the blocking LL-HLS requests
+const int kHlsRequestTimeoutMs = 10000;
+
 // character to remove from url to make webrtc label
 bool ignoreInLabel(char c)
 {
@@ -242,6 +267,53 @@ std::string getParam(const char *queryString, const char *paramName) {
 	return value;
 }
 
+// parse offset, limit and fields (comma separated) of a list request
+PeerConnectionManager::ListQuery getListQuery(const char *queryString) {
+	PeerConnectionManager::ListQuery query;
+	std::string offset = getParam(queryString, "offset");
+	if (!offset.empty()) {
+		query.m_offset = std::strtoul(offset.c_str(), NULL, 10);
+	}
+	std::string limit = getParam(queryString, "limit");
+	if (!limit.empty()) {
+		query.m_limit = std::strtoul(limit.c_str(), NULL, 10);
+	}
+	std::istringstream is(getParam(queryString, "fields"));
+	std::string field;
+	while (std::getline(is, field, ',')) {
+		if (!field.empty()) {
+			query.m_fields.insert(field);
+		}
+	}
+	return query;
+}
+
+// apply a list query to a JSON array of objects
+Json::Value selectList(const Json::Value &list, const PeerConnectionManager::ListQuery &query) {
+	Json::Value value(Json::arrayValue);
+	for (Json::ArrayIndex i = query.m_offset; (i < list.size()) && (value.size() < query.m_limit); i++) {
+		const Json::Value &item = list[i];
+		if (item.isObject() && !query.m_fields.empty()) {
+			Json::Value selected(Json::objectValue);
+			for (const std::string &field : query.m_fields) {
+				if (item.isMember(field)) {
+					selected[field] = item[field];
+				}
+			}
+			value.append(selected);
+		} else {
+			value.append(item);
+		}
+	}
+	return value;
+}
+
+std::map<std::string,std::string> getListHeaders(size_t total) {
+	std::map<std::string,std::string> headers;
+	headers["X-Total-Count"] = std::to_string(total);
+	return headers;
+}
+
 std::string getOptionValue(const std::string &options, const std::string &optionName) {
 	std::istringstream is(options);
 	std::string key, value;
@@ -255,10 +327,11 @@ std::string getOptionValue(const std::string &options, const std::string &option
 /* ---------------------------------------------------------------------------
 **  Constructor
 ** -------------------------------------------------------------------------*/
-PeerConnectionManager::PeerConnectionManager(const std::list<std::string> &iceServerList, const Json::Value & config, const webrtc::AudioDeviceModule::AudioLayer audioLayer, const std::string &publishFilter, const std::string & webrtcUdpPortRange, bool useNullCodec, bool usePlanB, int maxpc, webrtc::PeerConnectionInterface::IceTransportsType transportType, const std::string & basePath, const std::string & webrtcTrialsFields, const std::string & extraHost)
+PeerConnectionManager::PeerConnectionManager(const std::list<std::string> &iceServerList, const Json::Value & config, const webrtc::AudioDeviceModule::AudioLayer audioLayer, const std::string &publishFilter, const std::string & webrtcUdpPortRange, bool useNullCodec, bool usePlanB, int maxpc, webrtc::PeerConnectionInterface::IceTransportsType transportType, const std::string & basePath, const std::string & webrtcTrialsFields, const std::string & extraHost, int pcPoolSize, int shards, int snapshotInterval)
 	: m_webrtcenv(webrtc::CreateEnvironment(webrtc::FieldTrials::Create(webrtcTrialsFields))),
 	  m_signalingThread(webrtc::Thread::Create()),
 	  m_workerThread(webrtc::Thread::Create()),
+	  m_networkThread(webrtc::Thread::CreateWithSocketServer()),
 	  m_audioDecoderfactory(webrtc::CreateBuiltinAudioDecoderFactory()), 
 	  	m_builtin_video_decoder_factory(CreateDecoderFactory(false)),
 	  	m_null_video_decoder_factory(CreateDecoderFactory(true)),
@@ -271,7 +344,12 @@ PeerConnectionManager::PeerConnectionManager(const std::list<std::string> &iceSe
 	  m_maxpc(maxpc),
 	  m_transportType(transportType),
 	  m_webrtcTrialsFields(webrtcTrialsFields),
-	  m_extraHost(resolveHostnameToIp(extraHost))
+	  m_extraHost(resolveHostnameToIp(extraHost)),
+	  m_mediaListTime(0),
+	  m_statsRunning(false),
+	  m_pcPoolSize(pcPoolSize),
+	  m_pcPoolRunning(false),
+	  m_snapshotInterval(snapshotInterval)
 {
 	m_workerThread->SetName("worker", NULL);
 	m_workerThread->Start();
@@ -283,24 +361,26 @@ PeerConnectionManager::PeerConnectionManager(const std::list<std::string> &iceSe
 	m_signalingThread->SetName("signaling", NULL);
 	m_signalingThread->Start();
 
-	std::unique_ptr<webrtc::FieldTrialsView> builtin_field_trials = webrtc::FieldTrials::Create(webrtcTrialsFields);
-	m_builtin_peer_connection_factory = webrtc::CreatePeerConnectionFactory(NULL,  m_workerThread.get(), m_signalingThread.get(), 
-													m_audioDeviceModule, webrtc::CreateBuiltinAudioEncoderFactory(), m_audioDecoderfactory,
-													CreateEncoderFactory(false), CreateDecoderFactory(false),
-													NULL, NULL, NULL, std::move(builtin_field_trials));
+	m_networkThread->SetName("network", NULL);
+	m_networkThread->Start();
 
-	std::unique_ptr<webrtc::FieldTrialsView> null_field_trials = webrtc::FieldTrials::Create(webrtcTrialsFields);
-	m_null_peer_connection_factory = webrtc::CreatePeerConnectionFactory(NULL,  m_workerThread.get(), m_signalingThread.get(), 
-													m_audioDeviceModule, webrtc::CreateBuiltinAudioEncoderFactory(), m_audioDecoderfactory,
-													CreateEncoderFactory(true), CreateDecoderFactory(true),
-													NULL, NULL, NULL, std::move(null_field_trials));
+	// the first shard uses the audio device module, the others a fake one so the device is only recorded for the peer connections using it
+	for (int index = 0; index <= std::max(shards, 1); index++) {
+		m_shards.push_back(this->createShard(index));
+	}
+	m_builtin_peer_connection_factory = m_shards[0]->m_builtin_peer_connection_factory;
+	m_null_peer_connection_factory = m_shards[0]->m_null_peer_connection_factory;
 
 	// build video audio map
 	m_videoaudiomap = getV4l2AlsaMap();
 
+	// configuration shared by all the PeerConnections
+	m_rtcConfig = this->createRTCConfiguration();
+
 	// register api in http server
 	m_func[basePath + "/api/getMediaList"] = [this](const struct mg_request_info *req_info, const Json::Value &in) -> HttpServerRequestHandler::httpFunctionReturn {
-		return std::make_tuple(200, std::map<std::string,std::string>(),this->getMediaList());
+		Json::Value list = this->getMediaList();
+		return std::make_tuple(200, getListHeaders(list.size()), selectList(list, getListQuery(req_info->query_string)));
 	};
 
 	m_func[basePath + "/api/getVideoDeviceList"] = [this](const struct mg_request_info *req_info, const Json::Value &in) -> HttpServerRequestHandler::httpFunctionReturn {
@@ -339,6 +419,33 @@ PeerConnectionManager::PeerConnectionManager(const std::list<std::string> &iceSe
 		return this->whep(req_info->request_method, url, peerid, videourl, audiourl, options, useNullCodec, in);	
 	};
 
+	m_func[basePath + "/api/whip"] = [this](const struct mg_request_info *req_info, const Json::Value &in) -> HttpServerRequestHandler::httpFunctionReturn {
+		std::string peerid   = getParam(req_info->query_string, "peerid");
+		std::string name     = getParam(req_info->query_string, "url");
+		std::string options  = getParam(req_info->query_string, "options");
+		bool useNullCodec = m_useNullCodec || (getOptionValue(options, "nullcodec") == "1");
+		std::string url(req_info->request_uri);
+		url.append("?").append(req_info->query_string ? req_info->query_string : "");
+		return this->whip(req_info->request_method, url, peerid, name, useNullCodec, in);
+	};
+
+	m_func[basePath + "/api/snapshot"] = [this](const struct mg_request_info *req_info, const Json::Value &in) -> HttpServerRequestHandler::httpFunctionReturn {
+		std::string videourl = getParam(req_info->query_string, "url");
+		std::string audiourl = getParam(req_info->query_string, "audiourl");
+		std::string options  = getParam(req_info->query_string, "options");
+		// an encoded source is snapshotted from its passthrough stream, only its key frames are decoded
+		std::string nullcodec = getOptionValue(options, "nullcodec");
+		bool useNullCodec = m_useNullCodec || (nullcodec == "1") || (nullcodec.empty() && this->isEncodedSource(videourl));
+		return this->snapshot(videourl, audiourl, options, useNullCodec);
+	};
+
+	// LL-HLS packaging of the null codec streams, the media URIs are relative to the playlist
+	for (const std::string file : {"index.m3u8", "init.mp4", "segment.m4s", "part.m4s"}) {
+		m_func[basePath + "/api/hls/" + file] = [this, file](const struct mg_request_info *req_info, const Json::Value &in) -> HttpServerRequestHandler::httpFunctionReturn {
+			return this->hls(file, req_info->query_string);
+		};
+	}
+
 	m_func[basePath + "/api/hangup"] = [this](const struct mg_request_info *req_info, const Json::Value &in) -> HttpServerRequestHandler::httpFunctionReturn {
 		std::string peerid   = getParam(req_info->query_string, "peerid");
 		return std::make_tuple(200, std::map<std::string,std::string>(),this->hangUp(peerid));
@@ -367,11 +474,14 @@ PeerConnectionManager::PeerConnectionManager(const std::list<std::string> &iceSe
 	};
 
 	m_func[basePath + "/api/getPeerConnectionList"] = [this](const struct mg_request_info *req_info, const Json::Value &in) -> HttpServerRequestHandler::httpFunctionReturn {
-		return std::make_tuple(200, std::map<std::string,std::string>(),this->getPeerConnectionList());
+		size_t total = 0;
+		Json::Value list = this->getPeerConnectionList(getListQuery(req_info->query_string), total);
+		return std::make_tuple(200, getListHeaders(total), list);
 	};
 
 	m_func[basePath + "/api/getStreamList"] = [this](const struct mg_request_info *req_info, const Json::Value &in) -> HttpServerRequestHandler::httpFunctionReturn {
-		return std::make_tuple(200, std::map<std::string,std::string>(),this->getStreamList());
+		Json::Value list = this->getStreamList();
+		return std::make_tuple(200, getListHeaders(list.size()), selectList(list, getListQuery(req_info->query_string)));
 	};
 
 	m_func[basePath + "/api/version"] = [](const struct mg_request_info *req_info, const Json::Value &in) -> HttpServerRequestHandler::httpFunctionReturn {
@@ -394,17 +504,113 @@ PeerConnectionManager::PeerConnectionManager(const std::list<std::string> &iceSe
 		}
 		return std::make_tuple(200, std::map<std::string,std::string>(), answer);
 	};
+
+	// publish the stats and release the idle HTTP outputs
+	m_statsRunning = true;
+	m_statsThread = std::thread(&PeerConnectionManager::statsLoop, this);
 }
 
 /* ---------------------------------------------------------------------------
 **  Destructor
 ** -------------------------------------------------------------------------*/
 PeerConnectionManager::~PeerConnectionManager() {
+	{
+		std::lock_guard<std::mutex> lock(m_eventMutex);
+		m_statsRunning = false;
+	}
+	m_eventCond.notify_all();
+	if (m_statsThread.joinable()) {
+		m_statsThread.join();
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_pcPoolMutex);
+		m_pcPoolRunning = false;
+	}
+	m_pcPoolCond.notify_all();
+	if (m_pcPoolThread.joinable()) {
+		m_pcPoolThread.join();
+	}
+	for (auto & it : m_pc_pool) {
+		for (PeerConnectionObserver* obs : it.second) {
+			delete obs;
+		}
+	}
+	m_pc_pool.clear();
+	{
+		std::lock_guard<std::mutex> mlock(m_streamMapMutex);
+		for (auto & it : m_stream_map) {
+			this->removeStreamSinks(it.first, it.second.first);
+		}
+	}
 	m_workerThread->BlockingCall([this] {
 		m_audioDeviceModule->Release();
     });	
 }
 
+/* ---------------------------------------------------------------------------
+**  set the callback that receives the session events, the stats are collected periodically for the subscribed peers
+** -------------------------------------------------------------------------*/
+void PeerConnectionManager::setEventCallback(const eventCallback & callback, const eventSubscribed & subscribed) {
+	std::lock_guard<std::mutex> lock(m_eventMutex);
+	m_eventCallback = callback;
+	m_eventSubscribed = subscribed;
+}
+
+void PeerConnectionManager::publishEvent(const std::string & peerid, const std::string & type, const Json::Value & event) {
+	// a pooled PeerConnection has no peer yet
+	if (peerid.empty()) {
+		return;
+	}
+	std::lock_guard<std::mutex> lock(m_eventMutex);
+	if (m_eventCallback && (!m_eventSubscribed || m_eventSubscribed(peerid))) {
+		Json::Value message;
+		message["peerid"] = peerid;
+		message["type"] = type;
+		message["data"] = event;
+		m_eventCallback(peerid, message);
+	}
+}
+
+void PeerConnectionManager::publishState(const std::string & peerid, const std::string & type, const std::string & state) {
+	Json::Value event;
+	event["state"] = state;
+	this->publishEvent(peerid, type, event);
+}
+
+void PeerConnectionManager::statsLoop() {
+	std::unique_lock<std::mutex> lock(m_eventMutex);
+	while (m_statsRunning) {
+		m_eventCond.wait_for(lock, std::chrono::milliseconds(kEventStatsPeriodMs));
+		if (!m_statsRunning) {
+			break;
+		}
+		bool publishing = (m_eventCallback != nullptr);
+		eventSubscribed subscribed = m_eventSubscribed;
+		lock.unlock();
+		if (publishing) {
+			// GetStats is a call on the signaling thread, it is done without the peer map lock and only for the subscribed peers
+			std::list<std::pair<webrtc::scoped_refptr<webrtc::PeerConnectionInterface>, webrtc::scoped_refptr<PeerConnectionStatsCollectorCallback>>> peers;
+			{
+				std::lock_guard<std::mutex> peerlock(m_peerMapMutex);
+				for (auto & it : m_peer_connectionobs_map) {
+					if (!subscribed || subscribed(it.first)) {
+						peers.push_back(std::make_pair(it.second->getPeerConnection(), it.second->getStatsCallback()));
+					}
+				}
+			}
+			// the stats deltas are published when the reports are delivered
+			for (auto & peer : peers) {
+				if (peer.first) {
+					peer.first->GetStats(peer.second.get());
+				}
+			}
+		}
+		// the snapshots and the LL-HLS packaging are released even when no request is received anymore
+		this->releaseIdleOutputs();
+		lock.lock();
+	}
+}
+
 // from https://stackoverflow.com/a/12468109/3102264
 std::string random_string( size_t length )
 {
@@ -474,6 +680,14 @@ std::tuple<int, std::map<std::string,std::string>,Json::Value> PeerConnectionMan
 			}
     	}
 
+		// answer with the server candidates gathered after the answer was sent
+		if (httpcode == 200) {
+			answersdp = this->getIceCandidateFragment(peerid);
+			if (!answersdp.empty()) {
+				headers["Content-Type"] = "application/trickle-ice-sdpfrag";
+			}
+		}
+
 	} else {
 		std::string offersdp(in.asString());
 		RTC_LOG(LS_WARNING) << "offer:" << offersdp;
@@ -494,155 +708,743 @@ std::tuple<int, std::map<std::string,std::string>,Json::Value> PeerConnectionMan
 	return std::make_tuple(httpcode, headers, answersdp);
 }
 
-void PeerConnectionManager::createAudioModule(webrtc::AudioDeviceModule::AudioLayer audioLayer) {
-#ifdef HAVE_SOUND
-	m_audioDeviceModule = webrtc::CreateAudioDeviceModule(m_webrtcenv, audioLayer);
-	if (m_audioDeviceModule->Init() != 0) {
-		RTC_LOG(LS_WARNING) << "audio init fails -> disable audio capture";
-		m_audioDeviceModule = new webrtc::FakeAudioDeviceModule();
+std::tuple<int, std::map<std::string,std::string>,Json::Value> PeerConnectionManager::whip(const std::string & method,
+		const std::string & url,
+		const std::string & requestPeerId,
+		const std::string & name,
+		bool useNullCodec,
+		const Json::Value &in) {
+
+	// hangup and trickle ICE are the same than WHEP
+	if ( (method == "DELETE") || (method == "PATCH") ) {
+		return this->whep(method, url, requestPeerId, name, "", "", useNullCodec, in);
 	}
-#else
-	m_audioDeviceModule = new webrtc::FakeAudioDeviceModule();
-#endif	
-}
-/* ---------------------------------------------------------------------------
-**  return deviceList as JSON vector
-** -------------------------------------------------------------------------*/
-const Json::Value PeerConnectionManager::getMediaList()
-{
-	Json::Value value(Json::arrayValue);
 
-	const std::list<std::string> videoCaptureDevice = CapturerFactory::GetVideoCaptureDeviceList(m_publishFilter, m_useNullCodec);
-	for (auto videoDevice : videoCaptureDevice)
-	{
-		Json::Value media;
-		media["video"] = videoDevice;
+	std::map<std::string,std::string> headers;
+	if (name.empty() || (this->sanitizeLabel(name) != name)) {
+		RTC_LOG(LS_ERROR) << "WHIP invalid stream name:" << name;
+		return std::make_tuple(400, headers, Json::Value(""));
+	}
 
-		std::map<std::string, std::string>::iterator it = m_videoaudiomap.find(videoDevice);
-		if (it != m_videoaudiomap.end())
-		{
-			media["audio"] = it->second;
-		}
-		value.append(media);
+	std::string locationurl(url);
+	std::string peerid(requestPeerId);
+	if (peerid.empty()) {
+		peerid = random_string(32);
+		locationurl.append("&").append("peerid=").append(peerid);
 	}
 
-	const std::list<std::string> videoList = CapturerFactory::GetVideoSourceList(m_publishFilter, m_useNullCodec);
-	for (auto videoSource : videoList)
+	// the name is reserved by the first publisher, until it hangs up or fails
 	{
-		Json::Value media;
-		media["video"] = videoSource;
-		value.append(media);
+		std::lock_guard<std::mutex> mlock(m_streamMapMutex);
+		if (m_published_map.find(name) != m_published_map.end()) {
+			RTC_LOG(LS_ERROR) << "WHIP stream already published:" << name;
+			return std::make_tuple(409, headers, Json::Value(""));
+		}
+		m_published_map[name] = std::make_pair(peerid, useNullCodec);
 	}
 
-	for( auto it = m_config.begin() ; it != m_config.end() ; it++ ) {
-		std::string name = it.key().asString();
-		Json::Value media(*it);
-		if (media.isMember("video")) {
-			media["video"]=name;
-		} 
-		if (media.isMember("audio")) {
-			media["audio"]=name;
-		} 
-		value.append(media);
-	}
+	int httpcode = 501;
+	std::string answersdp;
+	std::unique_ptr<webrtc::SessionDescriptionInterface> offer(webrtc::CreateSessionDescription(webrtc::SdpType::kOffer, in.asString(), NULL));
+	PeerConnectionObserver *peerConnectionObserver = offer ? this->CreatePeerConnection(peerid, useNullCodec, false) : NULL;
+	if (!peerConnectionObserver) {
+		RTC_LOG(LS_ERROR) << "WHIP cannot create PeerConnection for offer:" << in.asString();
+		this->unpublish(name, peerid);
+		httpcode = 400;
+	} else if (!peerConnectionObserver->getPeerConnection().get()) {
+		RTC_LOG(LS_ERROR) << "Failed to initialize PeerConnection";
+		delete peerConnectionObserver;
+		this->unpublish(name, peerid);
+	} else {
+		peerConnectionObserver->setPublishName(name);
+		{
+			std::lock_guard<std::mutex> peerlock(m_peerMapMutex);
+			m_peer_connectionobs_map.insert(std::pair<std::string, PeerConnectionObserver *>(peerid, peerConnectionObserver));
+		}
 
-	return value;
+		// the tracks are registered by OnTrack while the offer is applied
+		std::unique_ptr<webrtc::SessionDescriptionInterface> desc = this->answerOffer(peerConnectionObserver, offer.release(), true);
+		if (desc.get()) {
+			desc->ToString(&answersdp);
+			headers["Location"] = locationurl;
+			headers["Access-Control-Expose-Headers"] = "Location";
+			headers["Content-Type"] = "application/sdp";
+			httpcode = 201;
+		} else {
+			RTC_LOG(LS_ERROR) << "Failed to create answer - no SDP";
+			this->hangUp(peerid);
+		}
+	}
+	return std::make_tuple(httpcode, headers, answersdp);
 }
 
 /* ---------------------------------------------------------------------------
-**  return video device List as JSON vector
+**  register a track received by WHIP as a source of the published stream
 ** -------------------------------------------------------------------------*/
-const Json::Value PeerConnectionManager::getVideoDeviceList()
+void PeerConnectionManager::publishTrack(const std::string & name, const webrtc::scoped_refptr<webrtc::MediaStreamTrackInterface> & track)
 {
-	Json::Value value(Json::arrayValue);
-
-	const std::list<std::string> videoCaptureDevice = CapturerFactory::GetVideoCaptureDeviceList(m_publishFilter, m_useNullCodec);
-	for (auto videoDevice : videoCaptureDevice)
-	{
-		value.append(videoDevice);
+	if (!track) {
+		return;
 	}
+	RTC_LOG(LS_INFO) << "publish stream:" << name << " track:" << track->kind() << " id:" << track->id();
+	std::lock_guard<std::mutex> mlock(m_streamMapMutex);
+	AudioVideoPair & pair = m_stream_map[name];
+	if (track->kind() == webrtc::MediaStreamTrackInterface::kVideoKind) {
+		pair.first = static_cast<webrtc::VideoTrackInterface*>(track.get())->GetSource();
+	} else if (track->kind() == webrtc::MediaStreamTrackInterface::kAudioKind) {
+		pair.second = static_cast<webrtc::AudioTrackInterface*>(track.get())->GetSource();
+	}
+}
 
-	return value;
+void PeerConnectionManager::unpublish(const std::string & name, const std::string & peerid)
+{
+	std::lock_guard<std::mutex> mlock(m_streamMapMutex);
+	std::map<std::string, std::pair<std::string,bool>>::iterator it = m_published_map.find(name);
+	if ( (it != m_published_map.end()) && (it->second.first == peerid) ) {
+		RTC_LOG(LS_INFO) << "unpublish stream:" << name;
+		m_published_map.erase(it);
+		std::map<std::string, AudioVideoPair>::iterator stream = m_stream_map.find(name);
+		if (stream != m_stream_map.end()) {
+			this->removeStreamSinks(name, stream->second.first);
+			m_stream_map.erase(stream);
+		}
+	}
 }
 
 /* ---------------------------------------------------------------------------
-**  return audio device List as JSON vector
+**  detach the recorder, the time-shift buffer, the snapshot, the LL-HLS packager and the websockets of a stream, called with the stream map locked
 ** -------------------------------------------------------------------------*/
-const Json::Value PeerConnectionManager::getAudioDeviceList()
+void PeerConnectionManager::removeStreamSinks(const std::string & streamLabel, const webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface> & videoSource)
 {
-	Json::Value value(Json::arrayValue);
-
-	const std::list<std::string> audioCaptureDevice = CapturerFactory::GetAudioCaptureDeviceList(m_publishFilter, m_audioDeviceModule);
-	for (auto audioDevice : audioCaptureDevice)
-	{
-		value.append(audioDevice);
+	std::map<std::string, std::unique_ptr<SegmentRecorder>>::iterator it = m_recorder_map.find(streamLabel);
+	if (it != m_recorder_map.end()) {
+		if (videoSource) {
+			videoSource->RemoveSink(it->second.get());
+		}
+		m_recorder_map.erase(it);
+	}
+	// the viewers replaying the buffer keep it alive
+	std::map<std::string, std::shared_ptr<TimeShiftBuffer>>::iterator timeshift = m_timeshift_map.find(streamLabel);
+	if (timeshift != m_timeshift_map.end()) {
+		if (videoSource) {
+			videoSource->RemoveSink(timeshift->second.get());
+		}
+		m_timeshift_map.erase(timeshift);
+	}
+	// a pending snapshot request keeps its sink alive
+	std::map<std::string, std::shared_ptr<SnapshotSink>>::iterator snapshot = m_snapshot_map.find(streamLabel);
+	if (snapshot != m_snapshot_map.end()) {
+		if (videoSource) {
+			videoSource->RemoveSink(snapshot->second.get());
+		}
+		m_snapshot_map.erase(snapshot);
+	}
+	std::map<std::string, std::shared_ptr<HlsPackager>>::iterator packager = m_hls_map.find(streamLabel);
+	if (packager != m_hls_map.end()) {
+		if (videoSource) {
+			videoSource->RemoveSink(packager->second.get());
+		}
+		m_hls_map.erase(packager);
+	}
+	// the websocket connections are closed with the stream, their close is then ignored by unsubscribeStream
+	std::map<std::string, std::map<std::string, std::shared_ptr<WebsocketStreamSink>>>::iterator websocket = m_websocket_map.find(streamLabel);
+	if (websocket != m_websocket_map.end()) {
+		for (auto & sink : websocket->second) {
+			if (videoSource) {
+				videoSource->RemoveSink(sink.second.get());
+			}
+			sink.second->close();
+		}
+		m_websocket_map.erase(websocket);
+		for (std::map<const void*, std::pair<std::string,std::string>>::iterator subscriber = m_websocket_subscribers.begin(); subscriber != m_websocket_subscribers.end(); ) {
+			if (subscriber->second.first == streamLabel) {
+				subscriber = m_websocket_subscribers.erase(subscriber);
+			} else {
+				++subscriber;
+			}
+		}
 	}
-
-	return value;
 }
 
-const Json::Value PeerConnectionManager::getAudioPlayoutList()
+/* ---------------------------------------------------------------------------
+**  the published streams live as long as their publisher, the HTTP outputs until they are idle, called with the stream map locked
+** -------------------------------------------------------------------------*/
+bool PeerConnectionManager::streamKeptOpen(const std::string & streamLabel)
 {
-	Json::Value value(Json::arrayValue);
-
-	const std::list<std::string> audioPlayoutDevice = CapturerFactory::GetAudioPlayoutDeviceList(m_publishFilter, m_audioDeviceModule);
-	for (auto audioDevice : audioPlayoutDevice)
-	{
-		value.append(audioDevice);
-	}
-
-	return value;
+	return (m_published_map.find(streamLabel) != m_published_map.end())
+		|| (m_snapshot_map.find(streamLabel) != m_snapshot_map.end())
+		|| (m_hls_map.find(streamLabel) != m_hls_map.end())
+		|| (m_websocket_map.find(streamLabel) != m_websocket_map.end());
 }
 
 /* ---------------------------------------------------------------------------
-**  return iceServers as JSON vector
+**  JPEG of the latest frame of a stream, shared by the requests received during the snapshot interval
 ** -------------------------------------------------------------------------*/
-const Json::Value PeerConnectionManager::getIceServers(const std::string &clientIp)
+std::tuple<int,std::map<std::string,std::string>,Json::Value> PeerConnectionManager::snapshot(const std::string & videourl, const std::string & audiourl, const std::string & options, bool useNullCodec)
 {
-	Json::Value urls(Json::arrayValue);
+	std::string streamLabel;
+	std::map<std::string, std::string> opts;
+	std::string audio;
+	if (!this->prepareStream(videourl, audiourl, options, useNullCodec, streamLabel, opts, audio))
+	{
+		return std::make_tuple(400, std::map<std::string,std::string>(), Json::Value(""));
+	}
 
-	for (auto iceServer : m_iceServerList)
+	std::shared_ptr<SnapshotSink> sink;
 	{
-		Json::Value server;
-		Json::Value urlList(Json::arrayValue);
-		webrtc::PeerConnectionInterface::IceServer srv = getIceServerFromUrl(iceServer, clientIp);
-		RTC_LOG(LS_INFO) << "ICE URL:" << srv.uri;
-		if (srv.uri.find("turn:") == 0) {
-			urlList.append(srv.uri+"?transport=udp");
-			urlList.append(srv.uri+"?transport=tcp");
-		} else {
-			urlList.append(srv.uri);
+		std::lock_guard<std::mutex> mlock(m_streamMapMutex);
+		std::map<std::string, AudioVideoPair>::iterator it = m_stream_map.find(streamLabel);
+		if ( (it == m_stream_map.end()) || !it->second.first )
+		{
+			RTC_LOG(LS_ERROR) << "Cannot find video of stream:" << streamLabel;
+			return std::make_tuple(404, std::map<std::string,std::string>(), Json::Value(""));
+		}
+		std::map<std::string, std::shared_ptr<SnapshotSink>>::iterator snapshot = m_snapshot_map.find(streamLabel);
+		if (snapshot != m_snapshot_map.end())
+		{
+			sink = snapshot->second;
+		}
+		else
+		{
+			// the passthrough streams are decoded with the builtin decoders, only their last key frame
+			sink = std::make_shared<SnapshotSink>(m_webrtcenv, m_builtin_video_decoder_factory, m_snapshotInterval);
+			it->second.first->AddOrUpdateSink(sink.get(), webrtc::VideoSinkWants());
+			m_snapshot_map[streamLabel] = sink;
 		}
-		server["urls"] = urlList;
-		if (srv.username.length() > 0)
-			server["username"] = srv.username;
-		if (srv.password.length() > 0)
-			server["credential"] = srv.password;
-		urls.append(server);
 	}
 
-	Json::Value iceServers;
-	iceServers["iceServers"] = urls;
-	if (m_transportType == webrtc::PeerConnectionInterface::IceTransportsType::kRelay) {
-		iceServers["iceTransportPolicy"] = "relay";
-	} else {
-		iceServers["iceTransportPolicy"] = "all";
+	std::string jpeg = sink->getJpeg(kSnapshotTimeoutMs);
+	if (jpeg.empty())
+	{
+		RTC_LOG(LS_WARNING) << "No frame for the snapshot of stream:" << streamLabel;
+		return std::make_tuple(404, std::map<std::string,std::string>(), Json::Value(""));
 	}
-
-	return iceServers;
+	std::map<std::string,std::string> headers;
+	headers["Content-Type"] = "image/jpeg";
+	return std::make_tuple(200, headers, Json::Value(jpeg));
 }
 
 /* ---------------------------------------------------------------------------
-**  get PeerConnection associated with peerid
+**  detach the HTTP outputs not requested anymore and close the streams only opened for them
 ** -------------------------------------------------------------------------*/
-webrtc::scoped_refptr<webrtc::PeerConnectionInterface> PeerConnectionManager::getPeerConnection(const std::string &peerid)
+template<typename Output, typename Streams>
+void detachIdleOutputs(std::map<std::string, std::shared_ptr<Output>> & outputs, Streams & streams, int64_t now, std::list<std::string> & idleStreams)
 {
-	webrtc::scoped_refptr<webrtc::PeerConnectionInterface> peerConnection;
-	std::map<std::string, PeerConnectionObserver *>::iterator it = m_peer_connectionobs_map.find(peerid);
-	if (it != m_peer_connectionobs_map.end())
+	typename std::map<std::string, std::shared_ptr<Output>>::iterator it = outputs.begin();
+	while (it != outputs.end())
 	{
-		peerConnection = it->second->getPeerConnection();
-	}
+		if (now - it->second->getLastRequestTime() > kHttpOutputIdleMs)
+		{
+			RTC_LOG(LS_INFO) << "release idle output of stream:" << it->first;
+			typename Streams::iterator stream = streams.find(it->first);
+			if ( (stream != streams.end()) && stream->second.first )
+			{
+				stream->second.first->RemoveSink(it->second.get());
+			}
+			idleStreams.push_back(it->first);
+			it = outputs.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+void PeerConnectionManager::releaseIdleOutputs()
+{
+	std::list<std::string> idleStreams;
+	{
+		std::lock_guard<std::mutex> mlock(m_streamMapMutex);
+		int64_t now = webrtc::TimeMillis();
+		detachIdleOutputs(m_snapshot_map, m_stream_map, now, idleStreams);
+		detachIdleOutputs(m_hls_map, m_stream_map, now, idleStreams);
+	}
+
+	for (const std::string & streamLabel : idleStreams)
+	{
+		if (!this->streamStillUsed(streamLabel))
+		{
+			std::lock_guard<std::mutex> mlock(m_streamMapMutex);
+			std::map<std::string, AudioVideoPair>::iterator it = m_stream_map.find(streamLabel);
+			if ( (it != m_stream_map.end()) && !this->streamKeptOpen(streamLabel) )
+			{
+				RTC_LOG(LS_INFO) << "idle stream closed " << streamLabel;
+				this->removeStreamSinks(streamLabel, it->second.first);
+				m_stream_map.erase(it);
+			}
+		}
+	}
+}
+
+/* ---------------------------------------------------------------------------
+**  LL-HLS playlist, init segment, segments and parts of a stream, packaged from its encoded frames
+** -------------------------------------------------------------------------*/
+std::tuple<int,std::map<std::string,std::string>,Json::Value> PeerConnectionManager::hls(const std::string & file, const char* queryString)
+{
+	std::string videourl = getParam(queryString, "url");
+	std::string audiourl = getParam(queryString, "audiourl");
+	std::string options  = getParam(queryString, "options");
+
+	// the access units are packaged as they are received, the stream needs null codec
+	std::string streamLabel;
+	std::map<std::string, std::string> opts;
+	std::string audio;
+	if (!this->prepareStream(videourl, audiourl, options, true, streamLabel, opts, audio))
+	{
+		return std::make_tuple(400, std::map<std::string,std::string>(), Json::Value(""));
+	}
+
+	std::shared_ptr<HlsPackager> packager;
+	{
+		std::lock_guard<std::mutex> mlock(m_streamMapMutex);
+		std::map<std::string, AudioVideoPair>::iterator it = m_stream_map.find(streamLabel);
+		if ( (it == m_stream_map.end()) || !it->second.first )
+		{
+			RTC_LOG(LS_ERROR) << "Cannot find video of stream:" << streamLabel;
+			return std::make_tuple(404, std::map<std::string,std::string>(), Json::Value(""));
+		}
+		std::map<std::string, std::shared_ptr<HlsPackager>>::iterator existing = m_hls_map.find(streamLabel);
+		if (existing != m_hls_map.end())
+		{
+			packager = existing->second;
+		}
+		else
+		{
+			packager = std::make_shared<HlsPackager>(opts);
+			it->second.first->AddOrUpdateSink(packager.get(), webrtc::VideoSinkWants());
+			m_hls_map[streamLabel] = packager;
+		}
+	}
+
+	std::map<std::string,std::string> headers;
+	std::string data;
+	int code = 404;
+	if (file == "index.m3u8")
+	{
+		// the media URIs keep the stream parameters of the playlist request as they are encoded
+		std::string query;
+		std::istringstream is(queryString ? queryString : "");
+		std::string param;
+		while (std::getline(is, param, '&'))
+		{
+			if ( (param.find("url=") == 0) || (param.find("audiourl=") == 0) || (param.find("options=") == 0) )
+			{
+				query += (query.empty() ? "" : "&") + param;
+			}
+		}
+		std::string msn = getParam(queryString, "_HLS_msn");
+		std::string part = getParam(queryString, "_HLS_part");
+		code = packager->getPlaylist(query, msn.empty() ? -1 : std::strtoll(msn.c_str(), NULL, 10), part.empty() ? -1 : std::strtoll(part.c_str(), NULL, 10), kHlsRequestTimeoutMs, data);
+		headers["Content-Type"] = "application/vnd.apple.mpegurl";
+		headers["Cache-Control"] = "no-cache";
+	}
+	else if (file == "init.mp4")
+	{
+		code = packager->getInit(data);
+		headers["Content-Type"] = "video/mp4";
+	}
+	else
+	{
+		std::string msn = getParam(queryString, "msn");
+		std::string part = getParam(queryString, "part");
+		if (msn.empty() || ( (file == "part.m4s") && part.empty() ))
+		{
+			code = 400;
+		}
+		else if (file == "part.m4s")
+		{
+			code = packager->getPart(std::strtoull(msn.c_str(), NULL, 10), std::strtoull(part.c_str(), NULL, 10), kHlsRequestTimeoutMs, data);
+		}
+		else
+		{
+			code = packager->getSegment(std::strtoull(msn.c_str(), NULL, 10), data);
+		}
+		headers["Content-Type"] = "video/iso.segment";
+	}
+	if (code != 200)
+	{
+		return std::make_tuple(code, std::map<std::string,std::string>(), Json::Value(""));
+	}
+	return std::make_tuple(code, headers, Json::Value(data));
+}
+
+/* ---------------------------------------------------------------------------
+**  push the encoded frames of a stream to a websocket connection, the connections with the same format share a sink
+** -------------------------------------------------------------------------*/
+bool PeerConnectionManager::subscribeStream(const void* id, const char* queryString, const WebsocketStreamSink::writer & writer, const WebsocketStreamSink::closer & closer)
+{
+	this->releaseIdleOutputs();
+
+	std::string videourl = getParam(queryString, "url");
+	std::string audiourl = getParam(queryString, "audiourl");
+	std::string options  = getParam(queryString, "options");
+	std::string format   = getParam(queryString, "format");
+	if (format.empty())
+	{
+		format = "raw";
+	}
+	if ( (format != "raw") && (format != "fmp4") )
+	{
+		RTC_LOG(LS_ERROR) << "Unknown websocket stream format:" << format;
+		return false;
+	}
+
+	// the access units are sent as they are received, the stream needs null codec
+	std::string streamLabel;
+	std::map<std::string, std::string> opts;
+	std::string audio;
+	if (!this->prepareStream(videourl, audiourl, options, true, streamLabel, opts, audio))
+	{
+		return false;
+	}
+
+	std::lock_guard<std::mutex> mlock(m_streamMapMutex);
+	std::map<std::string, AudioVideoPair>::iterator it = m_stream_map.find(streamLabel);
+	if ( (it == m_stream_map.end()) || !it->second.first )
+	{
+		RTC_LOG(LS_ERROR) << "Cannot find video of stream:" << streamLabel;
+		return false;
+	}
+	std::shared_ptr<WebsocketStreamSink> & sink = m_websocket_map[streamLabel][format];
+	if (!sink)
+	{
+		sink = std::make_shared<WebsocketStreamSink>(format);
+		it->second.first->AddOrUpdateSink(sink.get(), webrtc::VideoSinkWants());
+	}
+	sink->addSubscriber(id, writer, closer);
+	m_websocket_subscribers[id] = std::make_pair(streamLabel, format);
+	return true;
+}
+
+/* ---------------------------------------------------------------------------
+**  remove a websocket connection, the sink is detached with its last connection and the stream closed when no more used
+** -------------------------------------------------------------------------*/
+void PeerConnectionManager::unsubscribeStream(const void* id)
+{
+	std::string streamLabel;
+	std::string format;
+	std::shared_ptr<WebsocketStreamSink> sink;
+	{
+		std::lock_guard<std::mutex> mlock(m_streamMapMutex);
+		std::map<const void*, std::pair<std::string,std::string>>::iterator subscriber = m_websocket_subscribers.find(id);
+		if (subscriber == m_websocket_subscribers.end())
+		{
+			return;
+		}
+		streamLabel = subscriber->second.first;
+		format = subscriber->second.second;
+		m_websocket_subscribers.erase(subscriber);
+		std::map<std::string, std::map<std::string, std::shared_ptr<WebsocketStreamSink>>>::iterator websocket = m_websocket_map.find(streamLabel);
+		if ( (websocket != m_websocket_map.end()) && (websocket->second.find(format) != websocket->second.end()) )
+		{
+			sink = websocket->second[format];
+		}
+	}
+	if (!sink)
+	{
+		return;
+	}
+	// wait the write in progress outside of the stream lock, a slow connection should not block the API
+	sink->removeSubscriber(id);
+
+	{
+		std::lock_guard<std::mutex> mlock(m_streamMapMutex);
+		std::map<std::string, std::map<std::string, std::shared_ptr<WebsocketStreamSink>>>::iterator websocket = m_websocket_map.find(streamLabel);
+		if ( (websocket == m_websocket_map.end()) || (websocket->second.find(format) == websocket->second.end()) )
+		{
+			return;
+		}
+		// a connection could have subscribed in the meantime
+		if ( (websocket->second[format] != sink) || (sink->getSubscriberCount() != 0) )
+		{
+			return;
+		}
+		std::map<std::string, AudioVideoPair>::iterator it = m_stream_map.find(streamLabel);
+		if ( (it != m_stream_map.end()) && it->second.first )
+		{
+			it->second.first->RemoveSink(sink.get());
+		}
+		websocket->second.erase(format);
+		if (websocket->second.empty())
+		{
+			m_websocket_map.erase(websocket);
+		}
+	}
+
+	if (!this->streamStillUsed(streamLabel))
+	{
+		std::lock_guard<std::mutex> mlock(m_streamMapMutex);
+		std::map<std::string, AudioVideoPair>::iterator it = m_stream_map.find(streamLabel);
+		if ( (it != m_stream_map.end()) && !this->streamKeptOpen(streamLabel) )
+		{
+			RTC_LOG(LS_INFO) << "websocket stream closed " << streamLabel;
+			this->removeStreamSinks(streamLabel, it->second.first);
+			m_stream_map.erase(it);
+		}
+	}
+}
+
+/* ---------------------------------------------------------------------------
+**  local candidates as a SDP fragment
+** -------------------------------------------------------------------------*/
+std::string PeerConnectionManager::getIceCandidateFragment(const std::string &peerid)
+{
+	Json::Value candidateList;
+	bool complete = false;
+	{
+		std::lock_guard<std::mutex> peerlock(m_peerMapMutex);
+		std::map<std::string, PeerConnectionObserver *>::iterator it = m_peer_connectionobs_map.find(peerid);
+		if (it != m_peer_connectionobs_map.end()) {
+			candidateList = it->second->getIceCandidateList();
+			complete = (it->second->getGatheringState() == webrtc::PeerConnectionInterface::kIceGatheringComplete);
+		}
+	}
+
+	std::map<std::string, std::string> candidatesByMid;
+	for (const Json::Value & candidate : candidateList) {
+		candidatesByMid[candidate[kCandidateSdpMidName].asString()] += "a=" + candidate[kCandidateSdpName].asString() + "\r\n";
+	}
+	std::string fragment;
+	for (auto & it : candidatesByMid) {
+		fragment += "a=mid:" + it.first + "\r\n" + it.second;
+		if (complete) {
+			fragment += "a=end-of-candidates\r\n";
+		}
+	}
+	return fragment;
+}
+
+void PeerConnectionManager::createAudioModule(webrtc::AudioDeviceModule::AudioLayer audioLayer) {
+#ifdef HAVE_SOUND
+	m_audioDeviceModule = webrtc::CreateAudioDeviceModule(m_webrtcenv, audioLayer);
+	if (m_audioDeviceModule->Init() != 0) {
+		RTC_LOG(LS_WARNING) << "audio init fails -> disable audio capture";
+		m_audioDeviceModule = new webrtc::FakeAudioDeviceModule();
+	}
+#else
+	m_audioDeviceModule = new webrtc::FakeAudioDeviceModule();
+#endif	
+}
+/* ---------------------------------------------------------------------------
+**  create the PeerConnectionFactories of a shard
+** -------------------------------------------------------------------------*/
+std::unique_ptr<PeerConnectionManager::Shard> PeerConnectionManager::createShard(size_t index) {
+	std::unique_ptr<Shard> shard(new Shard());
+	if (index == 0) {
+		shard->m_networkThread = m_networkThread.get();
+		shard->m_workerThread = m_workerThread.get();
+		shard->m_audioDeviceModule = m_audioDeviceModule;
+	} else if (index == 1) {
+		// the first shard without audio device shares the threads of the audio device one
+		shard->m_networkThread = m_networkThread.get();
+		shard->m_workerThread = m_workerThread.get();
+		shard->m_audioDeviceModule = new webrtc::FakeAudioDeviceModule();
+	} else {
+		std::unique_ptr<webrtc::Thread> networkThread = webrtc::Thread::CreateWithSocketServer();
+		networkThread->SetName("network" + std::to_string(index), NULL);
+		networkThread->Start();
+		shard->m_networkThread = networkThread.get();
+		m_shardThreads.push_back(std::move(networkThread));
+
+		std::unique_ptr<webrtc::Thread> workerThread = webrtc::Thread::Create();
+		workerThread->SetName("worker" + std::to_string(index), NULL);
+		workerThread->Start();
+		shard->m_workerThread = workerThread.get();
+		m_shardThreads.push_back(std::move(workerThread));
+
+		// the audio device is only recorded by the first shard
+		shard->m_audioDeviceModule = new webrtc::FakeAudioDeviceModule();
+	}
+
+	std::unique_ptr<webrtc::FieldTrialsView> builtin_field_trials = webrtc::FieldTrials::Create(m_webrtcTrialsFields);
+	shard->m_builtin_peer_connection_factory = webrtc::CreatePeerConnectionFactory(shard->m_networkThread, shard->m_workerThread, m_signalingThread.get(), 
+													shard->m_audioDeviceModule, webrtc::CreateBuiltinAudioEncoderFactory(), m_audioDecoderfactory,
+													CreateEncoderFactory(false), CreateDecoderFactory(false),
+													NULL, NULL, NULL, std::move(builtin_field_trials));
+
+	std::unique_ptr<webrtc::FieldTrialsView> null_field_trials = webrtc::FieldTrials::Create(m_webrtcTrialsFields);
+	shard->m_null_peer_connection_factory = webrtc::CreatePeerConnectionFactory(shard->m_networkThread, shard->m_workerThread, m_signalingThread.get(), 
+													shard->m_audioDeviceModule, webrtc::make_ref_counted<AudioEncoderFactory>(), m_audioDecoderfactory,
+													CreateEncoderFactory(true), CreateDecoderFactory(true),
+													NULL, NULL, NULL, std::move(null_field_trials));
+	return shard;
+}
+
+/* ---------------------------------------------------------------------------
+**  shard with the fewest PeerConnections, the audio device is only available in the first one and only used by it
+** -------------------------------------------------------------------------*/
+size_t PeerConnectionManager::selectShard(bool useAudioDevice) {
+	size_t selected = 0;
+	if (!useAudioDevice) {
+		selected = 1;
+		for (size_t index = 2; index < m_shards.size(); index++) {
+			if (m_shards[index]->m_peerCount < m_shards[selected]->m_peerCount) {
+				selected = index;
+			}
+		}
+	}
+	return selected;
+}
+
+bool PeerConnectionManager::useAudioDevice(const std::string & audiourl) {
+	std::string audio = audiourl;
+	if (m_config.isMember(audio)) {
+		audio = m_config[audio]["audio"].asString();
+	}
+	return !audio.empty() && !CapturerFactory::IsLiveAudioSource(audio);
+}
+
+/* ---------------------------------------------------------------------------
+**  return deviceList as JSON vector
+** -------------------------------------------------------------------------*/
+const Json::Value PeerConnectionManager::getMediaList()
+{
+	// device enumeration is expensive, the list is kept for a while
+	std::lock_guard<std::mutex> lock(m_mediaListMutex);
+	int64_t now = webrtc::TimeMillis();
+	if (!m_mediaList.isNull() && (now - m_mediaListTime < kMediaListCacheMs))
+	{
+		return m_mediaList;
+	}
+
+	Json::Value value(Json::arrayValue);
+
+	const std::list<std::string> videoCaptureDevice = CapturerFactory::GetVideoCaptureDeviceList(m_publishFilter, m_useNullCodec);
+	for (auto videoDevice : videoCaptureDevice)
+	{
+		Json::Value media;
+		media["video"] = videoDevice;
+
+		std::map<std::string, std::string>::iterator it = m_videoaudiomap.find(videoDevice);
+		if (it != m_videoaudiomap.end())
+		{
+			media["audio"] = it->second;
+		}
+		value.append(media);
+	}
+
+	const std::list<std::string> videoList = CapturerFactory::GetVideoSourceList(m_publishFilter, m_useNullCodec);
+	for (auto videoSource : videoList)
+	{
+		Json::Value media;
+		media["video"] = videoSource;
+		value.append(media);
+	}
+
+	for( auto it = m_config.begin() ; it != m_config.end() ; it++ ) {
+		std::string name = it.key().asString();
+		Json::Value media(*it);
+		if (media.isMember("video")) {
+			media["video"]=name;
+		} 
+		if (media.isMember("audio")) {
+			media["audio"]=name;
+		} 
+		// the urls of the configuration are not exposed
+		media.removeMember("alternates");
+		value.append(media);
+	}
+
+	m_mediaList = value;
+	m_mediaListTime = now;
+	return value;
+}
+
+/* ---------------------------------------------------------------------------
+**  return video device List as JSON vector
+** -------------------------------------------------------------------------*/
+const Json::Value PeerConnectionManager::getVideoDeviceList()
+{
+	Json::Value value(Json::arrayValue);
+
+	const std::list<std::string> videoCaptureDevice = CapturerFactory::GetVideoCaptureDeviceList(m_publishFilter, m_useNullCodec);
+	for (auto videoDevice : videoCaptureDevice)
+	{
+		value.append(videoDevice);
+	}
+
+	return value;
+}
+
+/* ---------------------------------------------------------------------------
+**  return audio device List as JSON vector
+** -------------------------------------------------------------------------*/
+const Json::Value PeerConnectionManager::getAudioDeviceList()
+{
+	Json::Value value(Json::arrayValue);
+
+	const std::list<std::string> audioCaptureDevice = CapturerFactory::GetAudioCaptureDeviceList(m_publishFilter, m_audioDeviceModule);
+	for (auto audioDevice : audioCaptureDevice)
+	{
+		value.append(audioDevice);
+	}
+
+	return value;
+}
+
+const Json::Value PeerConnectionManager::getAudioPlayoutList()
+{
+	Json::Value value(Json::arrayValue);
+
+	const std::list<std::string> audioPlayoutDevice = CapturerFactory::GetAudioPlayoutDeviceList(m_publishFilter, m_audioDeviceModule);
+	for (auto audioDevice : audioPlayoutDevice)
+	{
+		value.append(audioDevice);
+	}
+
+	return value;
+}
+
+/* ---------------------------------------------------------------------------
+**  return iceServers as JSON vector
+** -------------------------------------------------------------------------*/
+const Json::Value PeerConnectionManager::getIceServers(const std::string &clientIp)
+{
+	Json::Value urls(Json::arrayValue);
+
+	for (auto iceServer : m_iceServerList)
+	{
+		Json::Value server;
+		Json::Value urlList(Json::arrayValue);
+		webrtc::PeerConnectionInterface::IceServer srv = getIceServerFromUrl(iceServer, clientIp);
+		RTC_LOG(LS_INFO) << "ICE URL:" << srv.uri;
+		if (srv.uri.find("turn:") == 0) {
+			urlList.append(srv.uri+"?transport=udp");
+			urlList.append(srv.uri+"?transport=tcp");
+		} else {
+			urlList.append(srv.uri);
+		}
+		server["urls"] = urlList;
+		if (srv.username.length() > 0)
+			server["username"] = srv.username;
+		if (srv.password.length() > 0)
+			server["credential"] = srv.password;
+		urls.append(server);
+	}
+
+	Json::Value iceServers;
+	iceServers["iceServers"] = urls;
+	if (m_transportType == webrtc::PeerConnectionInterface::IceTransportsType::kRelay) {
+		iceServers["iceTransportPolicy"] = "relay";
+	} else {
+		iceServers["iceTransportPolicy"] = "all";
+	}
+
+	return iceServers;
+}
+
+/* ---------------------------------------------------------------------------
+**  get PeerConnection associated with peerid
+** -------------------------------------------------------------------------*/
+webrtc::scoped_refptr<webrtc::PeerConnectionInterface> PeerConnectionManager::getPeerConnection(const std::string &peerid)
+{
+	webrtc::scoped_refptr<webrtc::PeerConnectionInterface> peerConnection;
+	std::map<std::string, PeerConnectionObserver *>::iterator it = m_peer_connectionobs_map.find(peerid);
+	if (it != m_peer_connectionobs_map.end())
+	{
+		peerConnection = it->second->getPeerConnection();
+	}
 	return peerConnection;
 }
 /* ---------------------------------------------------------------------------
@@ -698,9 +1500,8 @@ const Json::Value PeerConnectionManager::createOffer(const std::string &peerid,
 	RTC_LOG(LS_INFO) << __FUNCTION__ << " video:" << videourl << " audio:" << audiourl << " options:" << options;
 	Json::Value offer;
 	bool useNullCodec = m_useNullCodec;
-	webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> peerConnectionFactory = useNullCodec ? m_null_peer_connection_factory : m_builtin_peer_connection_factory;
 
-	PeerConnectionObserver *peerConnectionObserver = this->CreatePeerConnection(peerid, useNullCodec);
+	PeerConnectionObserver *peerConnectionObserver = this->CreatePeerConnection(peerid, useNullCodec, this->useAudioDevice(audiourl));
 	if (!peerConnectionObserver)
 	{
 		RTC_LOG(LS_ERROR) << "Failed to initialize PeerConnection";
@@ -709,7 +1510,7 @@ const Json::Value PeerConnectionManager::createOffer(const std::string &peerid,
 	{
 		webrtc::scoped_refptr<webrtc::PeerConnectionInterface> peerConnection = peerConnectionObserver->getPeerConnection();
 
-		if (!this->AddStreams(peerConnection.get(), videourl, audiourl, options, peerConnectionFactory, useNullCodec))
+		if (!this->AddStreams(peerConnection.get(), videourl, audiourl, options, peerConnectionObserver->getPeerConnectionFactory(), useNullCodec))
 		{
 			RTC_LOG(LS_ERROR) << "Can't add stream";
 		} else {
@@ -822,23 +1623,22 @@ const Json::Value PeerConnectionManager::setAnswer(const std::string &peerid, co
 }
 
 
-std::unique_ptr<webrtc::SessionDescriptionInterface> PeerConnectionManager::getAnswer(const std::string & peerid, const std::string& sdpoffer, const std::string & videourl, const std::string & audiourl, const std::string & options, bool waitgatheringcompletion, bool useNullCodec) {
+std::unique_ptr<webrtc::SessionDescriptionInterface> PeerConnectionManager::getAnswer(const std::string & peerid, const std::string& sdpoffer, const std::string & videourl, const std::string & audiourl, const std::string & options, bool waitcandidates, bool useNullCodec) {
 	std::unique_ptr<webrtc::SessionDescriptionInterface> answer;
 	std::unique_ptr<webrtc::SessionDescriptionInterface> session_description(webrtc::CreateSessionDescription(webrtc::SdpType::kOffer, sdpoffer, NULL));
 	if (!session_description) {
 		RTC_LOG(LS_WARNING) << "Can't parse received session description message.";
 	} else {
-		answer = this->getAnswer(peerid, session_description.release(), videourl, audiourl, options, waitgatheringcompletion, useNullCodec);
+		answer = this->getAnswer(peerid, session_description.release(), videourl, audiourl, options, waitcandidates, useNullCodec);
 	}
 	return answer;
 }
 
 
-std::unique_ptr<webrtc::SessionDescriptionInterface> PeerConnectionManager::getAnswer(const std::string & peerid, webrtc::SessionDescriptionInterface *session_description, const std::string & videourl, const std::string & audiourl, const std::string & options, bool waitgatheringcompletion, bool useNullCodec) {
+std::unique_ptr<webrtc::SessionDescriptionInterface> PeerConnectionManager::getAnswer(const std::string & peerid, webrtc::SessionDescriptionInterface *session_description, const std::string & videourl, const std::string & audiourl, const std::string & options, bool waitcandidates, bool useNullCodec) {
 	std::unique_ptr<webrtc::SessionDescriptionInterface> answer;
-	webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> peerConnectionFactory = useNullCodec ? m_null_peer_connection_factory : m_builtin_peer_connection_factory;
 
-	PeerConnectionObserver *peerConnectionObserver = this->CreatePeerConnection(peerid, useNullCodec);
+	PeerConnectionObserver *peerConnectionObserver = this->CreatePeerConnection(peerid, useNullCodec, this->useAudioDevice(audiourl));
 	if (!peerConnectionObserver)
 	{
 		RTC_LOG(LS_ERROR) << "Failed to initialize PeerConnectionObserver";
@@ -860,60 +1660,77 @@ std::unique_ptr<webrtc::SessionDescriptionInterface> PeerConnectionManager::getA
 		}
 		
 		// add local stream
-		if (!this->AddStreams(peerConnection.get(), videourl, audiourl, options, peerConnectionFactory, useNullCodec))
+		if (!this->AddStreams(peerConnection.get(), videourl, audiourl, options, peerConnectionObserver->getPeerConnectionFactory(), useNullCodec))
 		{
 			RTC_LOG(LS_ERROR) << "Can't add stream";
 		} else {
-			// set remote offer
-			std::promise<std::unique_ptr<webrtc::SessionDescriptionInterface>> remotepromise;
-			webrtc::scoped_refptr<SetSessionDescriptionObserver> remoteSessionObserver(SetSessionDescriptionObserver::Create(peerConnection, remotepromise));
-			peerConnection->SetRemoteDescription(remoteSessionObserver.get(), session_description);
-			// waiting for remote description
-			std::future<std::unique_ptr<webrtc::SessionDescriptionInterface>> remotefuture = remotepromise.get_future();
-			if (remotefuture.wait_for(std::chrono::milliseconds(5000)) == std::future_status::ready)
-			{
-				RTC_LOG(LS_INFO) << "remote_description is ready";
-			}
-			else
-			{
-				remoteSessionObserver->cancel();
-				RTC_LOG(LS_ERROR) << "remote_description timeout";
-			}
+			answer = this->answerOffer(peerConnectionObserver, session_description, waitcandidates);
+		}
 
-			// create answer
-			webrtc::PeerConnectionInterface::RTCOfferAnswerOptions rtcoptions;
-			std::promise<std::unique_ptr<webrtc::SessionDescriptionInterface>> localpromise;
-			webrtc::scoped_refptr<CreateSessionDescriptionObserver> localSessionObserver(CreateSessionDescriptionObserver::Create(peerConnection, localpromise));
-			peerConnection->CreateAnswer(localSessionObserver.get(), rtcoptions);
-
-			// wait gathering completion
-			if (waitgatheringcompletion) {
-				int retry = 5;
-				while ( (peerConnectionObserver->getGatheringState() != webrtc::PeerConnectionInterface::IceGatheringState::kIceGatheringComplete) && (retry > 0) ) {
-					RTC_LOG(LS_ERROR) << "waiting..." << retry;
-					retry --;
-					std::this_thread::sleep_for(std::chrono::milliseconds(250));
-				}
-			}
+	}
+	return answer;
+}
+
+/* ---------------------------------------------------------------------------
+**  set the remote offer and create the answer
+** -------------------------------------------------------------------------*/
+std::unique_ptr<webrtc::SessionDescriptionInterface> PeerConnectionManager::answerOffer(PeerConnectionObserver* peerConnectionObserver, webrtc::SessionDescriptionInterface *session_description, bool waitcandidates) {
+	std::unique_ptr<webrtc::SessionDescriptionInterface> answer;
+	webrtc::scoped_refptr<webrtc::PeerConnectionInterface> peerConnection = peerConnectionObserver->getPeerConnection();
+
+	// set remote offer
+	std::promise<std::unique_ptr<webrtc::SessionDescriptionInterface>> remotepromise;
+	webrtc::scoped_refptr<SetSessionDescriptionObserver> remoteSessionObserver(SetSessionDescriptionObserver::Create(peerConnection, remotepromise));
+	peerConnection->SetRemoteDescription(remoteSessionObserver.get(), session_description);
+	// waiting for remote description
+	std::future<std::unique_ptr<webrtc::SessionDescriptionInterface>> remotefuture = remotepromise.get_future();
+	if (remotefuture.wait_for(std::chrono::milliseconds(5000)) == std::future_status::ready)
+	{
+		RTC_LOG(LS_INFO) << "remote_description is ready";
+	}
+	else
+	{
+		remoteSessionObserver->cancel();
+		RTC_LOG(LS_ERROR) << "remote_description timeout";
+	}
+
+	// create answer
+	webrtc::PeerConnectionInterface::RTCOfferAnswerOptions rtcoptions;
+	std::promise<std::unique_ptr<webrtc::SessionDescriptionInterface>> localpromise;
+	webrtc::scoped_refptr<CreateSessionDescriptionObserver> localSessionObserver(CreateSessionDescriptionObserver::Create(peerConnection, localpromise));
+	peerConnection->CreateAnswer(localSessionObserver.get(), rtcoptions);
 
-			// waiting for answer
-			std::future<std::unique_ptr<webrtc::SessionDescriptionInterface>> localfuture = localpromise.get_future();
-			if (localfuture.wait_for(std::chrono::milliseconds(5000)) == std::future_status::ready)
-			{
-				answer = localfuture.get();
-				if (!answer)
-				{
-					RTC_LOG(LS_ERROR) << "Failed to create answer - no SDP";
-				}
+	// waiting for answer
+	std::future<std::unique_ptr<webrtc::SessionDescriptionInterface>> localfuture = localpromise.get_future();
+	if (localfuture.wait_for(std::chrono::milliseconds(5000)) == std::future_status::ready)
+	{
+		answer = localfuture.get();
+		if (!answer)
+		{
+			RTC_LOG(LS_ERROR) << "Failed to create answer - no SDP";
+		}
+		else if (waitcandidates)
+		{
+			// answer with the first gathered candidates, the others are sent by trickle ICE
+			if (!peerConnectionObserver->waitIceCandidate(kAnswerCandidateTimeoutMs)) {
+				RTC_LOG(LS_WARNING) << "No candidate gathered in " << kAnswerCandidateTimeoutMs << "ms";
 			}
-			else
-			{
-				RTC_LOG(LS_ERROR) << "Failed to create answer - timeout";
-				localSessionObserver->cancel();
+			std::unique_ptr<webrtc::SessionDescriptionInterface> local = m_signalingThread->BlockingCall([peerConnection] {
+				std::unique_ptr<webrtc::SessionDescriptionInterface> desc;
+				if (peerConnection->local_description()) {
+					desc = peerConnection->local_description()->Clone();
+				}
+				return desc;
+			});
+			if (local) {
+				answer = std::move(local);
 			}
-
 		}
-
+	}
+	else
+	{
+		RTC_LOG(LS_ERROR) << "Failed to create answer - timeout";
+		localSessionObserver->cancel();
 	}
 	return answer;
 }
@@ -998,6 +1815,12 @@ const Json::Value PeerConnectionManager::hangUp(const std::string &peerid)
 	{
 		webrtc::scoped_refptr<webrtc::PeerConnectionInterface> peerConnection = pcObserver->getPeerConnection();
 
+		// a WHIP publisher removes its stream
+		if (!pcObserver->getPublishName().empty())
+		{
+			this->unpublish(pcObserver->getPublishName(), peerid);
+		}
+
 		std::vector<webrtc::scoped_refptr<webrtc::RtpSenderInterface>> localstreams = peerConnection->GetSenders();
 		for (auto stream : localstreams)
 		{
@@ -1010,8 +1833,9 @@ const Json::Value PeerConnectionManager::hangUp(const std::string &peerid)
 					RTC_LOG(LS_ERROR) << "hangUp stream is no more used " << streamLabel;
 					std::lock_guard<std::mutex> mlock(m_streamMapMutex);
 					std::map<std::string, std::pair<webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface>, webrtc::scoped_refptr<webrtc::AudioSourceInterface>>>::iterator it = m_stream_map.find(streamLabel);
-					if (it != m_stream_map.end())
+					if ( (it != m_stream_map.end()) && !this->streamKeptOpen(streamLabel) )
 					{
+						this->removeStreamSinks(streamLabel, it->second.first);
 						m_stream_map.erase(it);
 					}
 
@@ -1062,85 +1886,128 @@ const Json::Value PeerConnectionManager::getIceCandidateList(const std::string &
 /* ---------------------------------------------------------------------------
 **  get PeerConnection list
 ** -------------------------------------------------------------------------*/
-const Json::Value PeerConnectionManager::getPeerConnectionList()
+const Json::Value PeerConnectionManager::getPeerConnectionList(const ListQuery & query, size_t & total)
 {
 	Json::Value value(Json::arrayValue);
 
-	std::lock_guard<std::mutex> peerlock(m_peerMapMutex);
-	for (auto it : m_peer_connectionobs_map)
+	// the PeerConnections of the page are copied, their states are proxy calls on the signaling thread done without the peer map lock
+	struct Peer
+	{
+		std::string                                                  m_peerid;
+		webrtc::scoped_refptr<webrtc::PeerConnectionInterface>       m_peerConnection;
+		webrtc::scoped_refptr<PeerConnectionStatsCollectorCallback>  m_statsCallback;
+		uint64_t                                                     m_creationTime;
+		Json::Value                                                  m_candidateList;
+	};
+	std::list<Peer> peers;
+	{
+		std::lock_guard<std::mutex> peerlock(m_peerMapMutex);
+		total = m_peer_connectionobs_map.size();
+		size_t index = 0;
+		for (auto it : m_peer_connectionobs_map)
+		{
+			if (peers.size() >= query.m_limit)
+			{
+				break;
+			}
+			if (index++ < query.m_offset)
+			{
+				continue;
+			}
+			peers.push_back({it.first, it.second->getPeerConnection(), it.second->getStatsCallback(), it.second->getCreationTime(), query.hasField("candidateList") ? it.second->getIceCandidateList() : Json::Value()});
+		}
+	}
+
+	for (const Peer & peer : peers)
 	{
 		Json::Value content;
 
 		// get local SDP
-		webrtc::scoped_refptr<webrtc::PeerConnectionInterface> peerConnection = it.second->getPeerConnection();
+		webrtc::scoped_refptr<webrtc::PeerConnectionInterface> peerConnection = peer.m_peerConnection;
 		if ((peerConnection) && (peerConnection->local_description()))
 		{
-			content["pc_state"] =  std::string(webrtc::PeerConnectionInterface::AsString(peerConnection->peer_connection_state()));
-			content["signaling_state"] =  std::string(webrtc::PeerConnectionInterface::AsString(peerConnection->signaling_state()));
-			content["ice_state"] =  std::string(webrtc::PeerConnectionInterface::AsString(peerConnection->ice_connection_state()));
+			if (query.hasField("pc_state")) {
+				content["pc_state"] =  std::string(webrtc::PeerConnectionInterface::AsString(peerConnection->peer_connection_state()));
+			}
+			if (query.hasField("signaling_state")) {
+				content["signaling_state"] =  std::string(webrtc::PeerConnectionInterface::AsString(peerConnection->signaling_state()));
+			}
+			if (query.hasField("ice_state")) {
+				content["ice_state"] =  std::string(webrtc::PeerConnectionInterface::AsString(peerConnection->ice_connection_state()));
+			}
 
-			int64_t durationMs = (webrtc::TimeMicros() - it.second->getCreationTime()) / 1000;
-			content["duration_ms"] = (Json::Int64)durationMs;
+			if (query.hasField("duration_ms")) {
+				int64_t durationMs = (webrtc::TimeMicros() - peer.m_creationTime) / 1000;
+				content["duration_ms"] = (Json::Int64)durationMs;
+			}
 
-			it.second->triggerStatsUpdate();
-			content["bytes_sent"]             = (Json::UInt64)it.second->getBytesSent();
-			content["bytes_received"]         = (Json::UInt64)it.second->getBytesReceived();
-			content["bandwidth_sent_bps"]     = (Json::UInt64)it.second->getBandwidthSentBps();
-			content["bandwidth_received_bps"] = (Json::UInt64)it.second->getBandwidthRecvBps();			
+			if (query.hasField("bytes_sent") || query.hasField("bytes_received") || query.hasField("bandwidth_sent_bps") || query.hasField("bandwidth_received_bps")) {
+				peerConnection->GetStats(peer.m_statsCallback.get());
+				content["bytes_sent"]             = (Json::UInt64)peer.m_statsCallback->getBytesSent();
+				content["bytes_received"]         = (Json::UInt64)peer.m_statsCallback->getBytesReceived();
+				content["bandwidth_sent_bps"]     = (Json::UInt64)peer.m_statsCallback->getBandwidthSentBps();
+				content["bandwidth_received_bps"] = (Json::UInt64)peer.m_statsCallback->getBandwidthRecvBps();			
+			}
 
-			std::string sdp;
-			peerConnection->local_description()->ToString(&sdp);
-			content["sdp"] = sdp;
+			if (query.hasField("sdp")) {
+				std::string sdp;
+				peerConnection->local_description()->ToString(&sdp);
+				content["sdp"] = sdp;
+			}
 
-			content["candidateList"] = it.second->getIceCandidateList();
+			if (query.hasField("candidateList")) {
+				content["candidateList"] = peer.m_candidateList;
+			}
 
-			Json::Value streams;
-			std::vector<webrtc::scoped_refptr<webrtc::RtpSenderInterface>> localstreams = peerConnection->GetSenders();
-			for (auto localStream : localstreams)
-			{
-				if (localStream != NULL)
+			if (query.hasField("streams")) {
+				Json::Value streams;
+				std::vector<webrtc::scoped_refptr<webrtc::RtpSenderInterface>> localstreams = peerConnection->GetSenders();
+				for (auto localStream : localstreams)
 				{
-					webrtc::scoped_refptr<webrtc::MediaStreamTrackInterface> mediaTrack = localStream->track();			
-					if (mediaTrack) {
-						Json::Value track;
-						track["kind"] = mediaTrack->kind();
-						if (track["kind"] == "video") {
-							webrtc::VideoTrackInterface* videoTrack = (webrtc::VideoTrackInterface*)mediaTrack.get();
-							webrtc::VideoTrackSourceInterface::Stats stats;
-							if (videoTrack->GetSource())
-							{
-								track["state"] = videoTrack->GetSource()->state();
-								if (videoTrack->GetSource()->GetStats(&stats))
+					if (localStream != NULL)
+					{
+						webrtc::scoped_refptr<webrtc::MediaStreamTrackInterface> mediaTrack = localStream->track();			
+						if (mediaTrack) {
+							Json::Value track;
+							track["kind"] = mediaTrack->kind();
+							if (track["kind"] == "video") {
+								webrtc::VideoTrackInterface* videoTrack = (webrtc::VideoTrackInterface*)mediaTrack.get();
+								webrtc::VideoTrackSourceInterface::Stats stats;
+								if (videoTrack->GetSource())
+								{
+									track["state"] = videoTrack->GetSource()->state();
+									if (videoTrack->GetSource()->GetStats(&stats))
+									{
+										track["width"] = stats.input_width;
+										track["height"] = stats.input_height;
+									}
+								}							
+							} else if (track["kind"] == "audio") {
+								webrtc::AudioTrackInterface* audioTrack = (webrtc::AudioTrackInterface*)mediaTrack.get();
+								if (audioTrack->GetSource())
 								{
-									track["width"] = stats.input_width;
-									track["height"] = stats.input_height;
+									track["state"] = audioTrack->GetSource()->state();
 								}
-							}							
-						} else if (track["kind"] == "audio") {
-							webrtc::AudioTrackInterface* audioTrack = (webrtc::AudioTrackInterface*)mediaTrack.get();
-							if (audioTrack->GetSource())
-							{
-								track["state"] = audioTrack->GetSource()->state();
+								int level = 0;
+								if (audioTrack->GetSignalLevel(&level)) {
+									track["level"] = level;
+								}							
 							}
-							int level = 0;
-							if (audioTrack->GetSignalLevel(&level)) {
-								track["level"] = level;
-							}							
-						}
 
-						std::string streamLabel = localStream->stream_ids()[0];		
-						if (!streams.isMember(streamLabel)) {
-							streams[streamLabel] = Json::Value(Json::objectValue);
-						}			
-						streams[streamLabel][mediaTrack->id()] = track;
+							std::string streamLabel = localStream->stream_ids()[0];		
+							if (!streams.isMember(streamLabel)) {
+								streams[streamLabel] = Json::Value(Json::objectValue);
+							}			
+							streams[streamLabel][mediaTrack->id()] = track;
+						}
 					}
 				}
+				content["streams"] = streams;
 			}
-			content["streams"] = streams;
 		}
 		
 		Json::Value pc;
-		pc[it.first] = content;
+		pc[peer.m_peerid] = content;
 		value.append(pc);
 	}
 	return value;
@@ -1165,7 +2032,62 @@ const Json::Value PeerConnectionManager::getStreamList()
 ** -------------------------------------------------------------------------*/
 bool PeerConnectionManager::InitializePeerConnection()
 {
-	return (m_builtin_peer_connection_factory.get() != NULL) && (m_null_peer_connection_factory.get() != NULL);
+	bool initialized = true;
+	for (const std::unique_ptr<Shard> & shard : m_shards) {
+		initialized = initialized && (shard->m_builtin_peer_connection_factory.get() != NULL) && (shard->m_null_peer_connection_factory.get() != NULL);
+	}
+	if (initialized && (m_pcPoolSize > 0)) {
+		m_pcPoolRunning = true;
+		m_pcPoolThread = std::thread(&PeerConnectionManager::poolLoop, this);
+	}
+	return initialized;
+}
+
+/* ---------------------------------------------------------------------------
+**  keep m_pcPoolSize PeerConnections ready for each factory
+** -------------------------------------------------------------------------*/
+void PeerConnectionManager::poolLoop()
+{
+	std::unique_lock<std::mutex> lock(m_pcPoolMutex);
+	while (m_pcPoolRunning) {
+		// refill the smallest pool
+		std::pair<size_t,bool> key(0, false);
+		for (size_t index = 0; index < m_shards.size(); index++) {
+			for (bool useNullCodec : {false, true}) {
+				if (m_pc_pool[std::make_pair(index, useNullCodec)].size() < m_pc_pool[key].size()) {
+					key = std::make_pair(index, useNullCodec);
+				}
+			}
+		}
+		if (m_pc_pool[key].size() >= (size_t)m_pcPoolSize) {
+			m_pcPoolCond.wait(lock);
+			continue;
+		}
+		lock.unlock();
+		PeerConnectionObserver *obs = new PeerConnectionObserver(this, "", m_rtcConfig, *m_shards[key.first], key.second);
+		lock.lock();
+		if (!obs->getPeerConnection().get()) {
+			// do not loop on a factory that fails
+			delete obs;
+			m_pcPoolCond.wait_for(lock, std::chrono::seconds(1));
+		} else {
+			m_pc_pool[key].push_back(obs);
+		}
+	}
+}
+
+PeerConnectionManager::PeerConnectionObserver *PeerConnectionManager::getPooledPeerConnection(const std::string &peerid, size_t shard, bool useNullCodec)
+{
+	PeerConnectionObserver *obs = NULL;
+	std::lock_guard<std::mutex> lock(m_pcPoolMutex);
+	std::list<PeerConnectionObserver*> & pool = m_pc_pool[std::make_pair(shard, useNullCodec)];
+	if (!pool.empty()) {
+		obs = pool.front();
+		pool.pop_front();
+		obs->setPeerId(peerid);
+		m_pcPoolCond.notify_all();
+	}
+	return obs;
 }
 
 /* ---------------------------------------------------------------------------
@@ -1178,6 +2100,10 @@ std::string PeerConnectionManager::getOldestPeerCannection()
 	std::lock_guard<std::mutex> peerlock(m_peerMapMutex);
 	if ( (m_maxpc > 0) && (m_peer_connectionobs_map.size() >= m_maxpc) ) {
 		for (auto it : m_peer_connectionobs_map) {
+			// a publisher is the source of its viewers, it is never evicted
+			if (!it.second->getPublishName().empty()) {
+				continue;
+			}
 			uint64_t creationTime = it.second->getCreationTime();
 			if (creationTime < oldestpc) {
 				oldestpc = creationTime;
@@ -1189,15 +2115,10 @@ std::string PeerConnectionManager::getOldestPeerCannection()
 }
 
 /* ---------------------------------------------------------------------------
-**  create a new PeerConnection
+**  configuration of the PeerConnections
 ** -------------------------------------------------------------------------*/
-PeerConnectionManager::PeerConnectionObserver *PeerConnectionManager::CreatePeerConnection(const std::string &peerid, bool useNullCodec)
+webrtc::PeerConnectionInterface::RTCConfiguration PeerConnectionManager::createRTCConfiguration()
 {
-	std::string oldestpeerid = this->getOldestPeerCannection();
-	if (!oldestpeerid.empty()) {
-		this->hangUp(oldestpeerid);
-	}
-
 	webrtc::PeerConnectionInterface::RTCConfiguration config;
 	if (m_usePlanB) {
 		config.sdp_semantics = webrtc::SdpSemantics::kPlanB;
@@ -1211,6 +2132,9 @@ PeerConnectionManager::PeerConnectionObserver *PeerConnectionManager::CreatePeer
 	}
 	config.type = m_transportType;
 
+	// start gathering when the PeerConnection is created, the candidates are ready when the answer is built
+	config.ice_candidate_pool_size = kIceCandidatePoolSize;
+
 	// Use example From https://soru.site/questions/51578447/api-c-webrtcyi-kullanarak-peerconnection-ve-ucretsiz-baglant-noktasn-serbest-nasl
 	int minPort = 0;
 	int maxPort = 65535;
@@ -1226,14 +2150,33 @@ PeerConnectionManager::PeerConnectionObserver *PeerConnectionManager::CreatePeer
 	config.port_allocator_config.min_port = minPort;
 	config.port_allocator_config.max_port = maxPort;
 
-	RTC_LOG(LS_INFO) << __FUNCTION__ << "CreatePeerConnection peerid:" << peerid << " webrtcPortRange:" << minPort << ":" << maxPort;
-	webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> peerConnectionFactory = useNullCodec ? m_null_peer_connection_factory : m_builtin_peer_connection_factory;
-	if (!peerConnectionFactory) {
+	RTC_LOG(LS_INFO) << __FUNCTION__ << " webrtcPortRange:" << minPort << ":" << maxPort;
+	return config;
+}
+
+/* ---------------------------------------------------------------------------
+**  create a new PeerConnection
+** -------------------------------------------------------------------------*/
+PeerConnectionManager::PeerConnectionObserver *PeerConnectionManager::CreatePeerConnection(const std::string &peerid, bool useNullCodec, bool useAudioDevice)
+{
+	std::string oldestpeerid = this->getOldestPeerCannection();
+	if (!oldestpeerid.empty()) {
+		this->hangUp(oldestpeerid);
+	}
+
+	size_t shard = this->selectShard(useAudioDevice);
+	RTC_LOG(LS_INFO) << __FUNCTION__ << "CreatePeerConnection peerid:" << peerid << " shard:" << shard;
+	if (!m_shards[shard]->m_builtin_peer_connection_factory || !m_shards[shard]->m_null_peer_connection_factory) {
 		RTC_LOG(LS_ERROR) << __FUNCTION__ << "CreatePeerConnection failed factory not initialized useNullCodec:" << useNullCodec;
 		return NULL;
 	}
 
-	PeerConnectionObserver *obs = new PeerConnectionObserver(this, peerid, config, peerConnectionFactory);
+	PeerConnectionObserver *obs = this->getPooledPeerConnection(peerid, shard, useNullCodec);
+	if (obs) {
+		return obs;
+	}
+
+	obs = new PeerConnectionObserver(this, peerid, m_rtcConfig, *m_shards[shard], useNullCodec);
 	if (!obs)
 	{
 		RTC_LOG(LS_ERROR) << __FUNCTION__ << "CreatePeerConnection failed";
@@ -1250,18 +2193,86 @@ webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface> PeerConnectionManager::
 	RTC_LOG(LS_INFO) << "videourl:" << videourl;
 	std::unique_ptr<webrtc::VideoDecoderFactory> &videoDecoderFactory = useNullCodec ? m_null_video_decoder_factory : m_builtin_video_decoder_factory;
 
-	return CapturerFactory::CreateVideoSource(videourl, opts, m_publishFilter, m_builtin_peer_connection_factory, videoDecoderFactory);
+	webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> peerConnectionFactory = useNullCodec ? m_null_peer_connection_factory : m_builtin_peer_connection_factory;
+
+	return CapturerFactory::CreateVideoSource(videourl, opts, m_publishFilter, peerConnectionFactory, videoDecoderFactory, useNullCodec);
 }
 
-webrtc::scoped_refptr<webrtc::AudioSourceInterface> PeerConnectionManager::CreateAudioSource(const std::string &audiourl, const std::map<std::string, std::string> &opts, const webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> &peerConnectionFactory)
+webrtc::scoped_refptr<webrtc::AudioSourceInterface> PeerConnectionManager::CreateAudioSource(const std::string &audiourl, const std::map<std::string, std::string> &opts, const webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> &peerConnectionFactory, bool useNullCodec)
 {
 	RTC_LOG(LS_INFO) << "audiourl:" << audiourl;
 
-	return m_workerThread->BlockingCall([this, audiourl, opts, peerConnectionFactory] {
-		return CapturerFactory::CreateAudioSource(audiourl, opts, m_publishFilter, peerConnectionFactory, m_audioDecoderfactory, m_audioDeviceModule);
+	// live sources do not use the audio device module, they are created without waiting for the worker thread
+	if (CapturerFactory::IsLiveAudioSource(audiourl))
+	{
+		return CapturerFactory::CreateAudioSource(audiourl, opts, m_publishFilter, peerConnectionFactory, m_audioDecoderfactory, m_audioDeviceModule, useNullCodec);
+	}
+
+	return m_workerThread->BlockingCall([this, audiourl, opts, peerConnectionFactory, useNullCodec] {
+		return CapturerFactory::CreateAudioSource(audiourl, opts, m_publishFilter, peerConnectionFactory, m_audioDecoderfactory, m_audioDeviceModule, useNullCodec);
     });
 }
 
+/* ---------------------------------------------------------------------------
+**  restrict the audio codecs of a sender to the format forwarded by its source
+** -------------------------------------------------------------------------*/
+void PeerConnectionManager::SetEncodedAudioCodec(webrtc::PeerConnectionInterface *peer_connection, const webrtc::scoped_refptr<webrtc::RtpSenderInterface> &sender, const webrtc::SdpAudioFormat &format, const webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> &peerConnectionFactory)
+{
+	std::vector<webrtc::RtpCodecCapability> codecs;
+	for (const webrtc::RtpCodecCapability &codec : peerConnectionFactory->GetRtpSenderCapabilities(webrtc::MediaType::AUDIO).codecs)
+	{
+		if (absl::EqualsIgnoreCase(codec.name, format.name) && (codec.clock_rate == format.clockrate_hz))
+		{
+			codecs.push_back(codec);
+		}
+	}
+	if (codecs.empty())
+	{
+		RTC_LOG(LS_WARNING) << "No audio codec to forward " << format.name;
+		return;
+	}
+
+	for (const webrtc::scoped_refptr<webrtc::RtpTransceiverInterface> &transceiver : peer_connection->GetTransceivers())
+	{
+		if (transceiver->sender() == sender)
+		{
+			webrtc::RTCError error = transceiver->SetCodecPreferences(codecs);
+			if (!error.ok())
+			{
+				RTC_LOG(LS_WARNING) << "Cannot restrict audio codec to " << format.name << " error:" << error.message();
+			}
+		}
+	}
+}
+
+/* ---------------------------------------------------------------------------
+**  the source of a stream gives encoded frames, it could be opened with null codec
+** -------------------------------------------------------------------------*/
+bool PeerConnectionManager::isEncodedSource(const std::string &videourl)
+{
+	{
+		std::lock_guard<std::mutex> mlock(m_streamMapMutex);
+		std::map<std::string, std::pair<std::string,bool>>::iterator published = m_published_map.find(videourl);
+		if (published != m_published_map.end())
+		{
+			return published->second.second;
+		}
+	}
+	std::string video = videourl;
+	if (m_config.isMember(video))
+	{
+		video = m_config[video]["video"].asString();
+	}
+	for (const char* prefix : {"rtsp://", "rtsps://", "file://", "rtp://", "rtmp://", "webrtc://", "webrtcs://"})
+	{
+		if (video.find(prefix) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
 const std::string PeerConnectionManager::sanitizeLabel(const std::string &label)
 {
 	std::string out(label);
@@ -1279,16 +2290,10 @@ const std::string PeerConnectionManager::sanitizeLabel(const std::string &label)
 }
 
 /* ---------------------------------------------------------------------------
-**  Add a stream to a PeerConnection
+**  resolve the options and the label of a stream, creating its sources when it is not yet in the stream map
 ** -------------------------------------------------------------------------*/
-bool PeerConnectionManager::AddStreams(webrtc::PeerConnectionInterface *peer_connection, const std::string &videourl, const std::string &audiourl, const std::string &options, const webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> &peerConnectionFactory, bool useNullCodec)
+bool PeerConnectionManager::prepareStream(const std::string &videourl, const std::string &audiourl, const std::string &options, bool useNullCodec, std::string & streamLabel, std::map<std::string, std::string> & opts, std::string & audio)
 {
-	bool ret = false;
-	if (!peerConnectionFactory) {
-		RTC_LOG(LS_ERROR) << "PeerConnectionFactory is not initialized";
-		return false;
-	}
-
 	// compute options
 	std::string optstring = options;
 	if (m_config.isMember(videourl)) {
@@ -1304,7 +2309,6 @@ bool PeerConnectionManager::AddStreams(webrtc::PeerConnectionInterface *peer_con
 
 	// convert options string into map
 	std::istringstream is(optstring);
-	std::map<std::string, std::string> opts;
 	std::string key, value;
 	while (std::getline(std::getline(is, key, '='), value, '&'))
 	{
@@ -1316,23 +2320,34 @@ bool PeerConnectionManager::AddStreams(webrtc::PeerConnectionInterface *peer_con
 		video = m_config[video]["video"].asString();
 	}
 
-	std::string audio = audiourl;
-	if (m_config.isMember(audio)) {
-		audio = m_config[audio]["audio"].asString();
+	// the alternate urls of the video are only read from the configuration
+	opts.erase("alternates");
+	if (m_config.isMember(videourl) && m_config[videourl]["alternates"].isArray()) {
+		std::string alternates;
+		for (const Json::Value & alternate : m_config[videourl]["alternates"]) {
+			alternates += (alternates.empty() ? "" : " ") + alternate.asString();
+		}
+		opts["alternates"] = alternates;
 	}
 
-	// set bandwidth
-	if (opts.find("bitrate") != opts.end())
-	{
-		int bitrate = std::stoi(opts.at("bitrate"));
-
-		webrtc::BitrateSettings bitrateParam;
-		bitrateParam.min_bitrate_bps = std::optional<int>(bitrate / 2);
-		bitrateParam.start_bitrate_bps = std::optional<int>(bitrate);
-		bitrateParam.max_bitrate_bps = std::optional<int>(bitrate * 2);
-		peer_connection->SetBitrate(bitrateParam);
+	// the options writing on the disk or allocating memory are only read from the configuration
+	std::map<std::string, std::string> configopts;
+	if (m_config.isMember(videourl)) {
+		std::istringstream is(m_config[videourl]["options"].asString());
+		while (std::getline(std::getline(is, key, '='), value, '&')) {
+			configopts[key] = value;
+		}
+	}
+	for (const char* option : {"record", "recordsize", "recordduration", "recordretention", "timeshift", "timeshiftdir", "timeshiftsize"}) {
+		opts.erase(option);
+		if (configopts.find(option) != configopts.end()) {
+			opts[option] = configopts[option];
+		}
+	}
 
-		RTC_LOG(LS_WARNING) << "set bitrate:" << bitrate;
+	audio = audiourl;
+	if (m_config.isMember(audio)) {
+		audio = m_config[audio]["audio"].asString();
 	}
 
 	// keep capturer options (to improve!!!)
@@ -1355,30 +2370,155 @@ bool PeerConnectionManager::AddStreams(webrtc::PeerConnectionInterface *peer_con
 		{
 			optcapturer += opts["height"];
 		}
+		if (opts.find("failover") != opts.end())
+		{
+			optcapturer += opts["failover"];
+		}
 	}
 
 	// compute stream label removing space because SDP use label
-	std::string streamLabel = this->sanitizeLabel(videourl + "|" + audiourl + "|" + optcapturer + "|" + (useNullCodec ? "nullcoder" : "builtin"));
+	streamLabel = this->sanitizeLabel(videourl + "|" + audiourl + "|" + optcapturer + "|" + (useNullCodec ? "nullcoder" : "builtin"));
 
-	bool needToCreate = false;
+	// only one caller creates the sources of a stream, the others wait for it
+	std::shared_ptr<std::promise<AudioVideoPair>> creation;
+	std::shared_future<AudioVideoPair> pending;
 	{
 		std::lock_guard<std::mutex> mlock(m_streamMapMutex);
-		needToCreate = (m_stream_map.find(streamLabel) == m_stream_map.end());
+		std::map<std::string, std::pair<std::string,bool>>::iterator published = m_published_map.find(videourl);
+		if (published != m_published_map.end())
+		{
+			// the frames of a WHIP stream are forwarded as they are received, encoded with null codec
+			if (published->second.second != useNullCodec)
+			{
+				RTC_LOG(LS_ERROR) << "Published stream:" << videourl << " needs nullcodec=" << published->second.second;
+				return false;
+			}
+			streamLabel = videourl;
+		}
+		else if (m_stream_map.find(streamLabel) == m_stream_map.end())
+		{
+			std::map<std::string, std::shared_future<AudioVideoPair>>::iterator it = m_stream_creation.find(streamLabel);
+			if (it == m_stream_creation.end())
+			{
+				creation = std::make_shared<std::promise<AudioVideoPair>>();
+				m_stream_creation[streamLabel] = creation->get_future().share();
+			}
+			else
+			{
+				pending = it->second;
+			}
+		}
 	}
 
-	if (needToCreate)
+	if (creation)
 	{
 		// create sources outside the lock (expensive operations)
-		webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface> videoSource(this->CreateVideoSource(video, opts, useNullCodec));
-		webrtc::scoped_refptr<webrtc::AudioSourceInterface> audioSource(this->CreateAudioSource(audio, opts, peerConnectionFactory));
-		RTC_LOG(LS_INFO) << "Adding Stream to map";
-		std::lock_guard<std::mutex> mlock(m_streamMapMutex);
-		// double-check: another thread may have created it while we were creating sources
-		if (m_stream_map.find(streamLabel) == m_stream_map.end()) {
-			m_stream_map[streamLabel] = std::make_pair(videoSource, audioSource);
+		try
+		{
+			webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface> videoSource(this->CreateVideoSource(video, opts, useNullCodec));
+			// the sources are shared by the shards, the audio device sources belong to the first one
+			webrtc::scoped_refptr<webrtc::AudioSourceInterface> audioSource(this->CreateAudioSource(audio, opts, useNullCodec ? m_null_peer_connection_factory : m_builtin_peer_connection_factory, useNullCodec));
+			// record the encoded frames of the stream while it is ingested
+			std::unique_ptr<SegmentRecorder> recorder;
+			if (videoSource && (opts.find("record") != opts.end()))
+			{
+				if (!useNullCodec)
+				{
+					RTC_LOG(LS_ERROR) << "Recording needs null codec, ignore record for stream:" << streamLabel;
+				}
+				else
+				{
+					recorder.reset(new SegmentRecorder(m_config.isMember(videourl) ? videourl : streamLabel, opts));
+					videoSource->AddOrUpdateSink(recorder.get(), webrtc::VideoSinkWants());
+				}
+			}
+			// keep the last encoded frames for the viewers joining with an offset
+			std::shared_ptr<TimeShiftBuffer> timeshift;
+			if (videoSource && useNullCodec && (opts.find("timeshift") != opts.end()))
+			{
+				timeshift = std::make_shared<TimeShiftBuffer>(opts);
+				if (timeshift->isAllocated())
+				{
+					videoSource->AddOrUpdateSink(timeshift.get(), webrtc::VideoSinkWants());
+				}
+				else
+				{
+					RTC_LOG(LS_ERROR) << "No time-shift buffer for stream:" << streamLabel;
+					timeshift.reset();
+				}
+			}
+			RTC_LOG(LS_INFO) << "Adding Stream to map";
+			AudioVideoPair pair(videoSource, audioSource);
+			{
+				std::lock_guard<std::mutex> mlock(m_streamMapMutex);
+				m_stream_map[streamLabel] = pair;
+				if (recorder)
+				{
+					m_recorder_map[streamLabel] = std::move(recorder);
+				}
+				if (timeshift)
+				{
+					m_timeshift_map[streamLabel] = timeshift;
+				}
+				m_stream_creation.erase(streamLabel);
+			}
+			creation->set_value(pair);
+		}
+		catch (...)
+		{
+			{
+				std::lock_guard<std::mutex> mlock(m_streamMapMutex);
+				m_stream_creation.erase(streamLabel);
+			}
+			creation->set_exception(std::current_exception());
+			throw;
 		}
-		// else: another thread already inserted it; our sources will be released via refcount
 	}
+	else if (pending.valid())
+	{
+		RTC_LOG(LS_INFO) << "Waiting for the creation of stream:" << streamLabel;
+		pending.wait();
+	}
+
+	return true;
+}
+
+/* ---------------------------------------------------------------------------
+**  Add a stream to a PeerConnection
+** -------------------------------------------------------------------------*/
+bool PeerConnectionManager::AddStreams(webrtc::PeerConnectionInterface *peer_connection, const std::string &videourl, const std::string &audiourl, const std::string &options, const webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> &peerConnectionFactory, bool useNullCodec)
+{
+	bool ret = false;
+	if (!peerConnectionFactory) {
+		RTC_LOG(LS_ERROR) << "PeerConnectionFactory is not initialized";
+		return false;
+	}
+
+	std::string streamLabel;
+	std::map<std::string, std::string> opts;
+	std::string audio;
+	if (!this->prepareStream(videourl, audiourl, options, useNullCodec, streamLabel, opts, audio))
+	{
+		return false;
+	}
+
+	// set bandwidth
+	if (opts.find("bitrate") != opts.end())
+	{
+		int bitrate = std::stoi(opts.at("bitrate"));
+
+		webrtc::BitrateSettings bitrateParam;
+		bitrateParam.min_bitrate_bps = std::optional<int>(bitrate / 2);
+		bitrateParam.start_bitrate_bps = std::optional<int>(bitrate);
+		bitrateParam.max_bitrate_bps = std::optional<int>(bitrate * 2);
+		peer_connection->SetBitrate(bitrateParam);
+
+		RTC_LOG(LS_WARNING) << "set bitrate:" << bitrate;
+	}
+
+	// the encoded format of a passthrough audio source is waited once the stream map is unlocked
+	webrtc::scoped_refptr<webrtc::AudioSourceInterface> encodedAudioSource;
+	webrtc::scoped_refptr<webrtc::RtpSenderInterface> encodedAudioSender;
 
 	// create a new webrtc stream
 	{
@@ -1388,6 +2528,21 @@ bool PeerConnectionManager::AddStreams(webrtc::PeerConnectionInterface *peer_con
 		{
 				std::pair<webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface>, webrtc::scoped_refptr<webrtc::AudioSourceInterface>> pair = it->second;
 				webrtc::scoped_refptr<webrtc::VideoTrackSourceInterface> videoSource(pair.first);
+
+				// a viewer joining with an offset gets its own source replaying the time-shift buffer
+				std::map<std::string, std::shared_ptr<TimeShiftBuffer>>::iterator timeshift = m_timeshift_map.find(streamLabel);
+				if (videoSource && (opts.find("seek") != opts.end()))
+				{
+					if (timeshift == m_timeshift_map.end())
+					{
+						RTC_LOG(LS_WARNING) << "No time-shift buffer for stream:" << streamLabel << ", seek ignored";
+					}
+					else
+					{
+						videoSource = TrackSource<TimeShiftSource>::Create(std::unique_ptr<TimeShiftSource>(new TimeShiftSource(timeshift->second, opts)));
+					}
+				}
+
 				if (!videoSource)
 				{
 					RTC_LOG(LS_ERROR) << "Cannot create capturer video:" << videourl;
@@ -1414,7 +2569,12 @@ bool PeerConnectionManager::AddStreams(webrtc::PeerConnectionInterface *peer_con
 				else
 				{
 					webrtc::scoped_refptr<webrtc::AudioTrackInterface> audio_track = peerConnectionFactory->CreateAudioTrack(streamLabel + "_audio", audioSource.get());
-					if ((audio_track) && (!peer_connection->AddTrack(audio_track, {streamLabel}).ok()))
+					webrtc::RTCErrorOr<webrtc::scoped_refptr<webrtc::RtpSenderInterface>> sender;
+					if (audio_track)
+					{
+						sender = peer_connection->AddTrack(audio_track, {streamLabel});
+					}
+					if ((audio_track) && (!sender.ok()))
 					{
 						RTC_LOG(LS_ERROR) << "Adding AudioTrack to MediaStream failed";
 					} 
@@ -1422,6 +2582,14 @@ bool PeerConnectionManager::AddStreams(webrtc::PeerConnectionInterface *peer_con
 					{
 						RTC_LOG(LS_INFO) << "AudioTrack added to PeerConnection";
 						ret = true;
+
+#ifdef HAVE_LIVE555
+						if (audio_track && useNullCodec && !m_usePlanB && CapturerFactory::IsLiveAudioSource(audio))
+						{
+							encodedAudioSource = audioSource;
+							encodedAudioSender = sender.value();
+						}
+#endif
 					}
 				}
 		}
@@ -1431,6 +2599,19 @@ bool PeerConnectionManager::AddStreams(webrtc::PeerConnectionInterface *peer_con
 		}
 	}
 
+#ifdef HAVE_LIVE555
+	// the encoded packets of a passthrough source can only be sent with the same codec
+	if (encodedAudioSource)
+	{
+		EncodedAudioSource *encodedSource = static_cast<EncodedAudioSource *>(encodedAudioSource.get());
+		std::optional<webrtc::SdpAudioFormat> format = encodedSource->getEncodedFormat(kEncodedAudioFormatTimeoutMs);
+		if (format)
+		{
+			this->SetEncodedAudioCodec(peer_connection, encodedAudioSender, *format, peerConnectionFactory);
+		}
+	}
+#endif
+
 	return ret;
 }
 
@@ -1477,7 +2658,10 @@ void PeerConnectionManager::PeerConnectionObserver::OnIceCandidate(const webrtc:
 				extraMessage[kCandidateSdpMlineIndexName] = candidate->sdp_mline_index();
 				extraMessage[kCandidateSdpName] = extraSdp;
 				m_iceCandidateList.append(extraMessage);
+				m_peerConnectionManager->publishEvent(this->getPeerId(), "icecandidate", extraMessage);
 			}
 		}
 	}
+	m_iceCandidateCond.notify_all();
+	m_peerConnectionManager->publishEvent(this->getPeerId(), "icecandidate", jmessage);
 }
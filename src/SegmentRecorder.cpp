@@ -0,0 +1,375 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#include <time.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <stdlib.h>
+
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+#include <chrono>
+#include <algorithm>
+
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+
+#include "EncodedVideoFrameBuffer.h"
+#include "AnnexB.h"
+#include "SegmentRecorder.h"
+
+static const size_t  kMaxPendingFrames = 300;
+static const int64_t kMaxClusterDurationMs = 30000;
+static const int     kDefaultSegmentDurationS = 300;
+
+/* ---------------------------------------------------------------------------
+**  EBML helpers
+** -------------------------------------------------------------------------*/
+static void writeId(std::vector<uint8_t> & out, uint32_t id) {
+	for (int shift = 24; shift > 0; shift -= 8) {
+		if (id >> shift) {
+			out.push_back((id >> shift) & 0xFF);
+		}
+	}
+	out.push_back(id & 0xFF);
+}
+
+static void writeSize(std::vector<uint8_t> & out, uint64_t size) {
+	int len = 1;
+	while ((len < 8) && (size >= ((1ULL << (7 * len)) - 1))) {
+		len++;
+	}
+	uint64_t value = size | (1ULL << (7 * len));
+	for (int i = len - 1; i >= 0; i--) {
+		out.push_back((value >> (8 * i)) & 0xFF);
+	}
+}
+
+static void writeElement(std::vector<uint8_t> & out, uint32_t id, const std::vector<uint8_t> & payload) {
+	writeId(out, id);
+	writeSize(out, payload.size());
+	out.insert(out.end(), payload.begin(), payload.end());
+}
+
+static void writeUInt(std::vector<uint8_t> & out, uint32_t id, uint64_t value) {
+	std::vector<uint8_t> payload;
+	for (int shift = 56; shift > 0; shift -= 8) {
+		if ((value >> shift) || !payload.empty()) {
+			payload.push_back((value >> shift) & 0xFF);
+		}
+	}
+	payload.push_back(value & 0xFF);
+	writeElement(out, id, payload);
+}
+
+static void writeString(std::vector<uint8_t> & out, uint32_t id, const std::string & value) {
+	writeElement(out, id, std::vector<uint8_t>(value.begin(), value.end()));
+}
+
+// an invalid value keeps the default, the stream is opened anyway
+static int64_t getOption(const std::map<std::string,std::string> & opts, const char* name, int64_t defaultValue) {
+	std::map<std::string,std::string>::const_iterator it = opts.find(name);
+	if (it == opts.end()) {
+		return defaultValue;
+	}
+	char* end = NULL;
+	errno = 0;
+	long long value = strtoll(it->second.c_str(), &end, 10);
+	if ( (end == it->second.c_str()) || (*end != 0) || (errno != 0) || (value < 0) ) {
+		RTC_LOG(LS_ERROR) << "SegmentRecorder invalid " << name << ":" << it->second << " use:" << defaultValue;
+		return defaultValue;
+	}
+	return value;
+}
+
+// the segments are named <name>_YYYYMMDD_HHMMSS_mmm.mkv
+static bool isSegmentOf(const std::string & filename, const std::string & name) {
+	static const std::string pattern("00000000_000000_000.mkv");
+	if ( (filename.size() != name.size() + 1 + pattern.size()) || (filename.compare(0, name.size() + 1, name + "_") != 0) ) {
+		return false;
+	}
+	for (size_t i = 0; i < pattern.size(); i++) {
+		char c = filename[name.size() + 1 + i];
+		if ( (pattern[i] == '0') ? !isdigit(c) : (c != pattern[i]) ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/* ---------------------------------------------------------------------------
+**  SegmentRecorder
+** -------------------------------------------------------------------------*/
+SegmentRecorder::SegmentRecorder(const std::string & name, const std::map<std::string,std::string> & opts)
+	: m_directory(opts.at("record")), m_maxSize(0), m_maxDurationMs(kDefaultSegmentDurationS * 1000), m_retention(0)
+	, m_stop(false), m_waitKeyFrame(true)
+	, m_file(NULL), m_segmentOffset(0), m_segmentSize(0), m_segmentStartMs(0), m_clusterStartMs(0), m_lastTimestampMs(0) {
+
+	for (char c : name) {
+		m_name.push_back(isalnum(c) ? c : '_');
+	}
+	m_maxSize = getOption(opts, "recordsize", 0) * 1024 * 1024;
+	m_maxDurationMs = getOption(opts, "recordduration", kDefaultSegmentDurationS) * 1000;
+	m_retention = getOption(opts, "recordretention", 0);
+
+#ifndef _WIN32
+	// the segments of the previous runs count in the retention, the names sort by date
+	DIR *dirp = opendir(m_directory.c_str());
+	if (dirp != NULL) {
+		struct dirent *entry;
+		while ((entry = readdir(dirp)) != NULL) {
+			if (isSegmentOf(entry->d_name, m_name)) {
+				m_segments.push_back(m_directory + "/" + entry->d_name);
+			}
+		}
+		closedir(dirp);
+	}
+	std::sort(m_segments.begin(), m_segments.end());
+#endif
+	RTC_LOG(LS_INFO) << "SegmentRecorder " << m_directory << "/" << m_name << " size:" << m_maxSize << " duration:" << m_maxDurationMs << "ms retention:" << m_retention;
+	m_thread = std::thread(&SegmentRecorder::WriterThread, this);
+}
+
+SegmentRecorder::~SegmentRecorder() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_cond.notify_all();
+	m_thread.join();
+}
+
+void SegmentRecorder::OnFrame(const webrtc::VideoFrame& frame) {
+	if (frame.video_frame_buffer()->type() != webrtc::VideoFrameBuffer::Type::kNative) {
+		RTC_LOG(LS_VERBOSE) << "SegmentRecorder ignore decoded frame";
+		return;
+	}
+	EncodedVideoFrameBuffer* buffer = static_cast<EncodedVideoFrameBuffer*>(frame.video_frame_buffer().get());
+	webrtc::EncodedImage image = buffer->getEncodedImage(frame.rtp_timestamp(), frame.ntp_time_ms());
+
+	Frame encoded;
+	encoded.m_data = image.GetEncodedData();
+	encoded.m_codec = buffer->getFormat().name;
+	encoded.m_keyFrame = (image._frameType == webrtc::VideoFrameType::kVideoFrameKey);
+	// the capture time of the frame, the queue and the disk latency do not shift the timecodes
+	encoded.m_timestampMs = frame.timestamp_us() ? frame.timestamp_us() / 1000 : webrtc::TimeMillis();
+	encoded.m_width = frame.width();
+	encoded.m_height = frame.height();
+	if (!encoded.m_data) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_waitKeyFrame && !encoded.m_keyFrame) {
+			return;
+		}
+		// when the disk is too slow, skip the frames until the next key frame
+		if (m_queue.size() >= kMaxPendingFrames) {
+			RTC_LOG(LS_WARNING) << "SegmentRecorder " << m_name << " queue full, wait next key frame";
+			m_waitKeyFrame = true;
+			return;
+		}
+		m_waitKeyFrame = false;
+		m_queue.push_back(std::move(encoded));
+	}
+	m_cond.notify_one();
+}
+
+void SegmentRecorder::WriterThread() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true) {
+		m_cond.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+		if (m_queue.empty()) {
+			break;
+		}
+		Frame frame = std::move(m_queue.front());
+		m_queue.pop_front();
+		lock.unlock();
+		this->writeFrame(frame);
+		lock.lock();
+	}
+	lock.unlock();
+	this->closeSegment();
+}
+
+void SegmentRecorder::writeFrame(const Frame & received) {
+	// the timecodes of a segment never go backward
+	Frame frame(received);
+	frame.m_timestampMs = std::max(frame.m_timestampMs, m_lastTimestampMs);
+	m_lastTimestampMs = frame.m_timestampMs;
+
+	// segments start with a key frame
+	if ( m_file && frame.m_keyFrame && ( (frame.m_codec != m_codec)
+		|| (m_maxSize && (m_segmentSize + m_cluster.size() >= m_maxSize))
+		|| (m_maxDurationMs && (frame.m_timestampMs - m_segmentStartMs >= m_maxDurationMs)) ) ) {
+		this->closeSegment();
+	}
+	if (!m_file) {
+		if (!frame.m_keyFrame || !this->openSegment(frame)) {
+			return;
+		}
+	}
+
+	// a cluster for each GOP, the block timecode is relative to the cluster on 16 bits
+	if (frame.m_keyFrame || (frame.m_timestampMs - m_clusterStartMs > kMaxClusterDurationMs)) {
+		this->flushCluster();
+		m_clusterStartMs = frame.m_timestampMs;
+	}
+
+	std::vector<uint8_t> payload;
+	const uint8_t* data = frame.m_data->data();
+	size_t size = frame.m_data->size();
+	if ( (m_codec == "H264") || (m_codec == "H265") ) {
+		payload = toLengthPrefixed(m_codec, data, size);
+	} else {
+		payload.assign(data, data + size);
+	}
+
+	int16_t timecode = (int16_t)(frame.m_timestampMs - m_clusterStartMs);
+	writeId(m_cluster, 0xA3);
+	writeSize(m_cluster, payload.size() + 4);
+	m_cluster.push_back(0x81);
+	m_cluster.push_back((timecode >> 8) & 0xFF);
+	m_cluster.push_back(timecode & 0xFF);
+	m_cluster.push_back(frame.m_keyFrame ? 0x80 : 0x00);
+	m_cluster.insert(m_cluster.end(), payload.begin(), payload.end());
+}
+
+bool SegmentRecorder::openSegment(const Frame & frame) {
+	std::string codecId;
+	std::vector<uint8_t> codecPrivate;
+	if ( (frame.m_codec == "H264") || (frame.m_codec == "H265") ) {
+		codecId = (frame.m_codec == "H264") ? "V_MPEG4/ISO/AVC" : "V_MPEGH/ISO/HEVC";
+		codecPrivate = getDecoderConfiguration(frame.m_codec, frame.m_data->data(), frame.m_data->size());
+		if (codecPrivate.empty()) {
+			RTC_LOG(LS_WARNING) << "SegmentRecorder " << m_name << " no parameter sets in key frame";
+			return false;
+		}
+	} else if (frame.m_codec == "VP8") {
+		codecId = "V_VP8";
+	} else if (frame.m_codec == "VP9") {
+		codecId = "V_VP9";
+	} else {
+		RTC_LOG(LS_ERROR) << "SegmentRecorder " << m_name << " codec not supported:" << frame.m_codec;
+		return false;
+	}
+
+	auto now = std::chrono::system_clock::now();
+	time_t seconds = std::chrono::system_clock::to_time_t(now);
+	int ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000;
+	char date[32];
+	strftime(date, sizeof(date), "%Y%m%d_%H%M%S", localtime(&seconds));
+	char suffix[8];
+	snprintf(suffix, sizeof(suffix), "_%03d", ms);
+	std::string path = m_directory + "/" + m_name + "_" + date + suffix + ".mkv";
+
+	m_file = fopen(path.c_str(), "wb");
+	if (!m_file) {
+		RTC_LOG(LS_ERROR) << "SegmentRecorder cannot open " << path << " error:" << strerror(errno);
+		return false;
+	}
+
+	std::vector<uint8_t> header;
+	std::vector<uint8_t> ebml;
+	writeUInt(ebml, 0x4286, 1);
+	writeUInt(ebml, 0x42F7, 1);
+	writeUInt(ebml, 0x42F2, 4);
+	writeUInt(ebml, 0x42F3, 8);
+	writeString(ebml, 0x4282, "matroska");
+	writeUInt(ebml, 0x4287, 4);
+	writeUInt(ebml, 0x4285, 2);
+	writeElement(header, 0x1A45DFA3, ebml);
+
+	// segment with an unknown size, it is set when the segment is closed
+	writeId(header, 0x18538067);
+	m_segmentOffset = header.size();
+	header.insert(header.end(), { 0x01, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF });
+
+	std::vector<uint8_t> info;
+	writeUInt(info, 0x2AD7B1, 1000000);
+	writeString(info, 0x4D80, "webrtc-streamer");
+	writeString(info, 0x5741, "webrtc-streamer");
+	writeElement(header, 0x1549A966, info);
+
+	std::vector<uint8_t> video;
+	writeUInt(video, 0xB0, frame.m_width);
+	writeUInt(video, 0xBA, frame.m_height);
+	std::vector<uint8_t> track;
+	writeUInt(track, 0xD7, 1);
+	writeUInt(track, 0x73C5, 1);
+	writeUInt(track, 0x83, 1);
+	writeUInt(track, 0x9C, 0);
+	writeString(track, 0x86, codecId);
+	if (!codecPrivate.empty()) {
+		writeElement(track, 0x63A2, codecPrivate);
+	}
+	writeElement(track, 0xE0, video);
+	std::vector<uint8_t> tracks;
+	writeElement(tracks, 0xAE, track);
+	writeElement(header, 0x1654AE6B, tracks);
+
+	fwrite(header.data(), 1, header.size(), m_file);
+	m_segmentSize = header.size();
+	m_segmentStartMs = frame.m_timestampMs;
+	m_clusterStartMs = frame.m_timestampMs;
+	m_codec = frame.m_codec;
+	RTC_LOG(LS_INFO) << "SegmentRecorder open " << path << " codec:" << codecId;
+
+	// retention of the segments, the current one and the ones of the previous runs included
+	m_segments.push_back(path);
+	while (m_retention && (m_segments.size() > m_retention)) {
+		RTC_LOG(LS_INFO) << "SegmentRecorder remove " << m_segments.front();
+		remove(m_segments.front().c_str());
+		m_segments.pop_front();
+	}
+	return true;
+}
+
+void SegmentRecorder::flushCluster() {
+	if (!m_file || m_cluster.empty()) {
+		return;
+	}
+	std::vector<uint8_t> timecode;
+	writeUInt(timecode, 0xE7, m_clusterStartMs - m_segmentStartMs);
+	std::vector<uint8_t> header;
+	writeId(header, 0x1F43B675);
+	writeSize(header, timecode.size() + m_cluster.size());
+	header.insert(header.end(), timecode.begin(), timecode.end());
+
+	fwrite(header.data(), 1, header.size(), m_file);
+	fwrite(m_cluster.data(), 1, m_cluster.size(), m_file);
+	fflush(m_file);
+	m_segmentSize += header.size() + m_cluster.size();
+	m_cluster.clear();
+}
+
+void SegmentRecorder::closeSegment() {
+	if (!m_file) {
+		return;
+	}
+	this->flushCluster();
+
+	uint64_t size = m_segmentSize - m_segmentOffset - 8;
+	uint8_t value[8];
+	for (int i = 0; i < 8; i++) {
+		value[i] = ((size | (1ULL << 56)) >> (8 * (7 - i))) & 0xFF;
+	}
+	fseek(m_file, m_segmentOffset, SEEK_SET);
+	fwrite(value, 1, sizeof(value), m_file);
+	fclose(m_file);
+	m_file = NULL;
+	m_codec.clear();
+}
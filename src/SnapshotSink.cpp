@@ -0,0 +1,201 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <setjmp.h>
+
+#include <vector>
+#include <chrono>
+
+#include <jpeglib.h>
+
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "api/video/i420_buffer.h"
+#include "api/video_codecs/video_codec.h"
+#include "libyuv/convert_from.h"
+
+#include "EncodedVideoFrameBuffer.h"
+#include "SnapshotSink.h"
+
+static const int kJpegQuality = 90;
+
+struct JpegErrorManager
+{
+	struct jpeg_error_mgr pub;
+	jmp_buf               setjmp_buffer;
+};
+
+static void onJpegError(j_common_ptr cinfo)
+{
+	char message[JMSG_LENGTH_MAX];
+	(*cinfo->err->format_message)(cinfo, message);
+	RTC_LOG(LS_ERROR) << "SnapshotSink jpeg error:" << message;
+	longjmp(((JpegErrorManager *)cinfo->err)->setjmp_buffer, 1);
+}
+
+SnapshotSink::SnapshotSink(const webrtc::Environment & env, std::unique_ptr<webrtc::VideoDecoderFactory> & decoderFactory, int intervalMs)
+	: m_env(env), m_decoderFactory(decoderFactory), m_intervalMs(intervalMs), m_keyFrameFormat(""), m_keyFrameWidth(0), m_keyFrameHeight(0), m_updated(false),
+	  m_jpegTime(0), m_decoderFormat(""), m_lastRequestTime(webrtc::TimeMillis()) {
+	RTC_LOG(LS_INFO) << "SnapshotSink interval:" << m_intervalMs << "ms";
+}
+
+void SnapshotSink::OnFrame(const webrtc::VideoFrame& frame) {
+	webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer = frame.video_frame_buffer();
+	if (buffer->type() == webrtc::VideoFrameBuffer::Type::kNative) {
+		// the encoded streams are only decoded on request, from their last key frame
+		EncodedVideoFrameBuffer* encoded = static_cast<EncodedVideoFrameBuffer*>(buffer.get());
+		webrtc::EncodedImage image = encoded->getEncodedImage(frame.rtp_timestamp(), frame.ntp_time_ms());
+		if (image._frameType != webrtc::VideoFrameType::kVideoFrameKey) {
+			return;
+		}
+		webrtc::scoped_refptr<webrtc::EncodedImageBuffer> keyFrame = webrtc::EncodedImageBuffer::Create(image.data(), image.size());
+		std::lock_guard<std::mutex> lock(m_frameMutex);
+		m_keyFrame = keyFrame;
+		m_keyFrameFormat = encoded->getFormat();
+		m_keyFrameWidth = frame.width();
+		m_keyFrameHeight = frame.height();
+		m_frame = nullptr;
+		m_updated = true;
+	} else {
+		// the decoded frames are only converted on request
+		std::lock_guard<std::mutex> lock(m_frameMutex);
+		m_frame = buffer;
+		m_keyFrame = nullptr;
+		m_updated = true;
+	}
+	m_frameCond.notify_all();
+}
+
+int32_t SnapshotSink::Decoded(webrtc::VideoFrame& decodedImage) {
+	m_decoded = decodedImage.video_frame_buffer()->ToI420();
+	return 0;
+}
+
+std::string SnapshotSink::getJpeg(int timeoutMs) {
+	int64_t now = webrtc::TimeMillis();
+	m_lastRequestTime = now;
+
+	// the requests received during an interval share the same snapshot
+	std::lock_guard<std::mutex> jpeglock(m_jpegMutex);
+	if (!m_jpeg.empty() && (now - m_jpegTime < m_intervalMs)) {
+		return m_jpeg;
+	}
+
+	webrtc::scoped_refptr<webrtc::VideoFrameBuffer> frame;
+	webrtc::scoped_refptr<webrtc::EncodedImageBuffer> keyFrame;
+	webrtc::SdpVideoFormat format("");
+	int width = 0;
+	int height = 0;
+	{
+		// only the first snapshot waits for a frame, the next ones keep the cached one until a new frame is received
+		std::unique_lock<std::mutex> lock(m_frameMutex);
+		if (!m_frameCond.wait_for(lock, std::chrono::milliseconds(m_jpeg.empty() ? timeoutMs : 0), [this] { return m_updated; })) {
+			return m_jpeg;
+		}
+		frame = m_frame;
+		keyFrame = m_keyFrame;
+		format = m_keyFrameFormat;
+		width = m_keyFrameWidth;
+		height = m_keyFrameHeight;
+		m_updated = false;
+	}
+
+	webrtc::scoped_refptr<webrtc::I420BufferInterface> i420;
+	if (frame) {
+		i420 = frame->ToI420();
+	} else if (keyFrame) {
+		i420 = this->decodeKeyFrame(keyFrame, format, width, height);
+	}
+	if (i420) {
+		std::string jpeg = encodeJpeg(i420, kJpegQuality);
+		if (!jpeg.empty()) {
+			m_jpeg = jpeg;
+			m_jpegTime = now;
+			RTC_LOG(LS_VERBOSE) << "SnapshotSink jpeg " << i420->width() << "x" << i420->height() << " size:" << m_jpeg.size();
+		}
+	}
+	return m_jpeg;
+}
+
+webrtc::scoped_refptr<webrtc::I420BufferInterface> SnapshotSink::decodeKeyFrame(const webrtc::scoped_refptr<webrtc::EncodedImageBuffer> & keyFrame, const webrtc::SdpVideoFormat & format, int width, int height) {
+	if (!m_decoder || (m_decoderFormat != format)) {
+		RTC_LOG(LS_INFO) << "SnapshotSink create decoder format:" << format.name << " " << width << "x" << height;
+		m_decoderFormat = format;
+		m_decoder = m_decoderFactory->Create(m_env, format);
+		if (!m_decoder) {
+			RTC_LOG(LS_ERROR) << "SnapshotSink no decoder for format:" << format.name;
+			return nullptr;
+		}
+		webrtc::VideoDecoder::Settings settings;
+		settings.set_max_render_resolution(webrtc::RenderResolution(width, height));
+		settings.set_codec_type(webrtc::PayloadStringToCodecType(format.name));
+		if (!m_decoder->Configure(settings)) {
+			RTC_LOG(LS_ERROR) << "SnapshotSink cannot configure decoder format:" << format.name;
+			m_decoder.reset();
+			return nullptr;
+		}
+		m_decoder->RegisterDecodeCompleteCallback(this);
+	}
+
+	webrtc::EncodedImage input_image;
+	input_image.SetEncodedData(keyFrame);
+	input_image._frameType = webrtc::VideoFrameType::kVideoFrameKey;
+	input_image.SetRtpTimestamp(webrtc::TimeMillis() * 90);
+	m_decoded = nullptr;
+	int res = m_decoder->Decode(input_image, false, webrtc::TimeMillis());
+	if (res != WEBRTC_VIDEO_CODEC_OK) {
+		RTC_LOG(LS_ERROR) << "SnapshotSink decode failure:" << res << " => reset decoder";
+		m_decoder.reset();
+		return nullptr;
+	}
+	return m_decoded;
+}
+
+std::string SnapshotSink::encodeJpeg(const webrtc::scoped_refptr<webrtc::I420BufferInterface> & buffer, int quality) {
+	int width = buffer->width();
+	int height = buffer->height();
+	std::vector<uint8_t> rgb(width * height * 3);
+	libyuv::I420ToRAW(buffer->DataY(), buffer->StrideY(), buffer->DataU(), buffer->StrideU(), buffer->DataV(), buffer->StrideV(), rgb.data(), width * 3, width, height);
+
+	struct jpeg_compress_struct cinfo;
+	JpegErrorManager error;
+	cinfo.err = jpeg_std_error(&error.pub);
+	error.pub.error_exit = onJpegError;
+	jpeg_create_compress(&cinfo);
+	unsigned char* data = NULL;
+	unsigned long size = 0;
+	std::string jpeg;
+	if (setjmp(error.setjmp_buffer)) {
+		jpeg_destroy_compress(&cinfo);
+		free(data);
+		return jpeg;
+	}
+	jpeg_mem_dest(&cinfo, &data, &size);
+	cinfo.image_width = width;
+	cinfo.image_height = height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, quality, TRUE);
+	jpeg_start_compress(&cinfo, TRUE);
+	while (cinfo.next_scanline < cinfo.image_height) {
+		JSAMPROW row = rgb.data() + cinfo.next_scanline * width * 3;
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg.assign((const char*)data, size);
+	jpeg_destroy_compress(&cinfo);
+	free(data);
+	return jpeg;
+}
@@ -0,0 +1,296 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include <chrono>
+#include <algorithm>
+#include <new>
+
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "api/video/encoded_image.h"
+
+#include "EncodedVideoFrameBuffer.h"
+#include "TimeShiftBuffer.h"
+
+static const size_t  kDefaultTimeShiftSizeMB = 64;
+static const size_t  kMaxTimeShiftSizeMB = 1024;
+static const int64_t kMaxReplayDelayMs = 1000;
+static const int     kReadTimeoutMs = 1000;
+
+// the whole value is a number followed by an optional unit, false otherwise
+static bool parseNumber(const std::string & value, int64_t & number, std::string & unit) {
+	char* end = NULL;
+	errno = 0;
+	long long parsed = strtoll(value.c_str(), &end, 10);
+	if ( (end == value.c_str()) || (errno != 0) ) {
+		return false;
+	}
+	number = parsed;
+	unit = end;
+	return true;
+}
+
+/* ---------------------------------------------------------------------------
+**  TimeShiftBuffer
+** -------------------------------------------------------------------------*/
+TimeShiftBuffer::TimeShiftBuffer(const std::map<std::string,std::string> & opts)
+	: m_data(NULL), m_capacity(kDefaultTimeShiftSizeMB * 1024 * 1024), m_durationMs(0), m_firstSeq(0), m_writeOffset(0) {
+
+	// an invalid duration leaves the buffer unallocated, the stream is opened without time-shift
+	int64_t duration = 0;
+	std::string unit;
+	if (!parseNumber(opts.at("timeshift"), duration, unit) || !unit.empty() || (duration <= 0)) {
+		RTC_LOG(LS_ERROR) << "TimeShiftBuffer invalid timeshift:" << opts.at("timeshift");
+		m_capacity = 0;
+		return;
+	}
+	m_durationMs = duration * 1000;
+
+	if (opts.find("timeshiftsize") != opts.end()) {
+		int64_t sizeMB = 0;
+		if (!parseNumber(opts.at("timeshiftsize"), sizeMB, unit) || !unit.empty()) {
+			RTC_LOG(LS_ERROR) << "TimeShiftBuffer invalid timeshiftsize:" << opts.at("timeshiftsize") << " use:" << kDefaultTimeShiftSizeMB << "MB";
+			sizeMB = kDefaultTimeShiftSizeMB;
+		}
+		if ( (sizeMB <= 0) || (sizeMB > (int64_t)kMaxTimeShiftSizeMB) ) {
+			RTC_LOG(LS_WARNING) << "TimeShiftBuffer size:" << sizeMB << "MB out of range, limited to " << kMaxTimeShiftSizeMB << "MB";
+			sizeMB = std::min(std::max(sizeMB, (int64_t)1), (int64_t)kMaxTimeShiftSizeMB);
+		}
+		m_capacity = sizeMB * 1024 * 1024;
+	}
+
+#ifndef _WIN32
+	// the ring file is unlinked once mapped, the kernel pages it out instead of growing the process memory
+	std::string path = "/tmp";
+	if (opts.find("timeshiftdir") != opts.end()) {
+		path = opts.at("timeshiftdir");
+	}
+	path += "/webrtc-streamer-timeshift-XXXXXX";
+	std::vector<char> filename(path.begin(), path.end());
+	filename.push_back(0);
+	int fd = mkstemp(filename.data());
+	if (fd == -1) {
+		RTC_LOG(LS_ERROR) << "TimeShiftBuffer cannot create " << path << " error:" << strerror(errno);
+	} else {
+		unlink(filename.data());
+		if (ftruncate(fd, m_capacity) == 0) {
+			void* data = mmap(NULL, m_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (data != MAP_FAILED) {
+				m_data = (uint8_t*)data;
+			}
+		}
+		if (!m_data) {
+			RTC_LOG(LS_ERROR) << "TimeShiftBuffer cannot map " << m_capacity << " bytes error:" << strerror(errno);
+		}
+		close(fd);
+	}
+#endif
+	if (!m_data) {
+		// without the ring file the frames are kept in memory, or not at all when it cannot be allocated
+		try {
+			m_memory.resize(m_capacity);
+			m_data = m_memory.data();
+		} catch (const std::bad_alloc &) {
+			RTC_LOG(LS_ERROR) << "TimeShiftBuffer cannot allocate " << m_capacity << " bytes";
+			m_capacity = 0;
+			return;
+		}
+	}
+	RTC_LOG(LS_INFO) << "TimeShiftBuffer duration:" << m_durationMs << "ms size:" << m_capacity;
+}
+
+TimeShiftBuffer::~TimeShiftBuffer() {
+#ifndef _WIN32
+	if (m_data && m_memory.empty()) {
+		munmap(m_data, m_capacity);
+	}
+#endif
+}
+
+void TimeShiftBuffer::OnFrame(const webrtc::VideoFrame& frame) {
+	if (frame.video_frame_buffer()->type() != webrtc::VideoFrameBuffer::Type::kNative) {
+		return;
+	}
+	EncodedVideoFrameBuffer* buffer = static_cast<EncodedVideoFrameBuffer*>(frame.video_frame_buffer().get());
+	webrtc::EncodedImage image = buffer->getEncodedImage(frame.rtp_timestamp(), frame.ntp_time_ms());
+	size_t size = image.size();
+	if ( (size == 0) || (size > m_capacity / 4) ) {
+		RTC_LOG(LS_WARNING) << "TimeShiftBuffer ignore frame size:" << size;
+		return;
+	}
+	// the frames are indexed by their capture time, the window follows the stream and not the arrival of its frames
+	int64_t timestampMs = frame.timestamp_us() ? frame.timestamp_us() / 1000 : webrtc::TimeMillis();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_index.empty()) {
+			timestampMs = std::max(timestampMs, m_index.back().m_timestampMs);
+		}
+		if (m_writeOffset + size > m_capacity) {
+			// the end of the ring is skipped, the frames stored there are the oldest
+			while (!m_index.empty() && (m_index.front().m_offset >= m_writeOffset)) {
+				m_index.pop_front();
+				m_firstSeq++;
+			}
+			m_writeOffset = 0;
+		}
+		while (!m_index.empty()
+			&& ( ((m_index.front().m_offset < m_writeOffset + size) && (m_index.front().m_offset + m_index.front().m_size > m_writeOffset))
+			  || (m_index.front().m_timestampMs < timestampMs - m_durationMs) ) ) {
+			m_index.pop_front();
+			m_firstSeq++;
+		}
+
+		memcpy(m_data + m_writeOffset, image.data(), size);
+		m_index.push_back({m_writeOffset, size, timestampMs, image._frameType == webrtc::VideoFrameType::kVideoFrameKey, frame.width(), frame.height(), buffer->getFormat()});
+		m_writeOffset += size;
+	}
+	m_cond.notify_all();
+}
+
+uint64_t TimeShiftBuffer::seek(int64_t offsetMs) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	// the offset is relative to the last buffered frame
+	int64_t target = (m_index.empty() ? webrtc::TimeMillis() : m_index.back().m_timestampMs) - offsetMs;
+	uint64_t seq = m_firstSeq + m_index.size();
+	for (size_t i = m_index.size(); i > 0; i--) {
+		const Entry & entry = m_index[i-1];
+		if (entry.m_keyFrame) {
+			seq = m_firstSeq + i - 1;
+			if (entry.m_timestampMs <= target) {
+				break;
+			}
+		}
+	}
+	return seq;
+}
+
+bool TimeShiftBuffer::read(uint64_t & seq, webrtc::scoped_refptr<webrtc::VideoFrameBuffer> & buffer, int64_t & timestampMs, int timeoutMs) {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (!m_cond.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this, &seq] { return seq < m_firstSeq + m_index.size(); })) {
+		return false;
+	}
+	if (seq < m_firstSeq) {
+		RTC_LOG(LS_WARNING) << "TimeShiftBuffer frame:" << seq << " overwritten";
+		std::deque<Entry>::iterator it = std::find_if(m_index.begin(), m_index.end(), [](const Entry & entry) { return entry.m_keyFrame; });
+		if (it == m_index.end()) {
+			seq = m_firstSeq + m_index.size();
+			return false;
+		}
+		seq = m_firstSeq + (it - m_index.begin());
+	}
+	const Entry & entry = m_index[seq - m_firstSeq];
+	webrtc::VideoFrameType frameType = entry.m_keyFrame ? webrtc::VideoFrameType::kVideoFrameKey : webrtc::VideoFrameType::kVideoFrameDelta;
+	buffer = webrtc::make_ref_counted<EncodedVideoFrameBuffer>(entry.m_width, entry.m_height, webrtc::EncodedImageBuffer::Create(m_data + entry.m_offset, entry.m_size), frameType, entry.m_format);
+	timestampMs = entry.m_timestampMs;
+	return true;
+}
+
+bool TimeShiftBuffer::isLive(uint64_t seq) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return seq + 1 >= m_firstSeq + m_index.size();
+}
+
+/* ---------------------------------------------------------------------------
+**  TimeShiftSource
+** -------------------------------------------------------------------------*/
+TimeShiftSource::TimeShiftSource(const std::shared_ptr<TimeShiftBuffer> & buffer, const std::map<std::string,std::string> & opts)
+	: m_buffer(buffer), m_offsetMs(getOffsetMs(opts.at("seek"))), m_speed(2), m_stop(false), m_width(0), m_height(0) {
+	if (opts.find("seekspeed") != opts.end()) {
+		char* end = NULL;
+		double speed = strtod(opts.at("seekspeed").c_str(), &end);
+		if ( (end == opts.at("seekspeed").c_str()) || (*end != 0) ) {
+			RTC_LOG(LS_ERROR) << "TimeShiftSource invalid seekspeed:" << opts.at("seekspeed");
+		} else {
+			m_speed = std::max(1.0, speed);
+		}
+	}
+	RTC_LOG(LS_INFO) << "TimeShiftSource offset:" << m_offsetMs << "ms speed:" << m_speed;
+	m_thread = std::thread(&TimeShiftSource::ReplayThread, this);
+}
+
+TimeShiftSource::~TimeShiftSource() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_cond.notify_all();
+	m_thread.join();
+}
+
+int64_t TimeShiftSource::getOffsetMs(const std::string & seek) {
+	std::string value(seek);
+	if (!value.empty() && (value[0] == '-')) {
+		value = value.substr(1);
+	}
+	int64_t offset = 0;
+	std::string unit;
+	if (!parseNumber(value, offset, unit) || (offset < 0)) {
+		RTC_LOG(LS_ERROR) << "TimeShiftSource invalid seek:" << seek << ", replay live";
+		return 0;
+	}
+	if (unit == "ms") {
+		return offset;
+	} else if (unit == "m") {
+		return offset * 60 * 1000;
+	} else if (!unit.empty() && (unit != "s")) {
+		RTC_LOG(LS_WARNING) << "TimeShiftSource unknown seek unit:" << unit << ", use seconds";
+	}
+	return offset * 1000;
+}
+
+void TimeShiftSource::ReplayThread() {
+	uint64_t seq = m_buffer->seek(m_offsetMs);
+	int64_t lastTimestampMs = 0;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (!m_stop) {
+		lock.unlock();
+		webrtc::scoped_refptr<webrtc::VideoFrameBuffer> buffer;
+		int64_t timestampMs = 0;
+		bool ready = m_buffer->read(seq, buffer, timestampMs, kReadTimeoutMs);
+		bool live = ready && m_buffer->isLive(seq);
+		lock.lock();
+		if (!ready) {
+			continue;
+		}
+		seq++;
+
+		// the buffered frames are paced faster than real time, the live ones are sent as they arrive
+		if (!live && lastTimestampMs) {
+			int64_t delayMs = std::min(kMaxReplayDelayMs, (int64_t)((timestampMs - lastTimestampMs) / m_speed));
+			if ( (delayMs > 0) && m_cond.wait_for(lock, std::chrono::milliseconds(delayMs), [this] { return m_stop; }) ) {
+				break;
+			}
+		}
+		lastTimestampMs = timestampMs;
+
+		m_width = buffer->width();
+		m_height = buffer->height();
+		webrtc::VideoFrame frame = webrtc::VideoFrame::Builder()
+			.set_video_frame_buffer(buffer)
+			.set_rotation(webrtc::kVideoRotation_0)
+			.set_timestamp_us(webrtc::TimeMicros())
+			.build();
+		lock.unlock();
+		m_broadcaster.OnFrame(frame);
+		lock.lock();
+	}
+}
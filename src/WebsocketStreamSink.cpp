@@ -0,0 +1,224 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#include <algorithm>
+
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "rtc_base/base64.h"
+#include "json/json.h"
+
+#include "EncodedVideoFrameBuffer.h"
+#include "AnnexB.h"
+#include "Fmp4.h"
+#include "WebsocketStreamSink.h"
+
+static const size_t   kMaxPendingFrames = 100;
+static const uint32_t kDefaultSampleDuration = kFmp4Timescale / 30;
+
+WebsocketStreamSink::WebsocketStreamSink(const std::string & format)
+	: m_fmp4(format == "fmp4"), m_width(0), m_height(0), m_fragmentSeq(0), m_firstTimestamp(-1), m_lastTimestamp(0), m_lastDuration(kDefaultSampleDuration)
+	, m_writing(NULL), m_stop(false) {
+	RTC_LOG(LS_INFO) << "WebsocketStreamSink format:" << (m_fmp4 ? "fmp4" : "raw");
+	m_thread = std::thread(&WebsocketStreamSink::SenderThread, this);
+}
+
+WebsocketStreamSink::~WebsocketStreamSink() {
+	this->stop();
+}
+
+void WebsocketStreamSink::OnFrame(const webrtc::VideoFrame& frame) {
+	if (frame.video_frame_buffer()->type() != webrtc::VideoFrameBuffer::Type::kNative) {
+		RTC_LOG(LS_VERBOSE) << "WebsocketStreamSink ignore decoded frame";
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_subscriberMutex);
+		if (m_subscribers.empty()) {
+			return;
+		}
+	}
+	EncodedVideoFrameBuffer* buffer = static_cast<EncodedVideoFrameBuffer*>(frame.video_frame_buffer().get());
+	std::string codec = buffer->getFormat().name;
+	if ( (codec != "H264") && (codec != "H265") ) {
+		RTC_LOG(LS_VERBOSE) << "WebsocketStreamSink codec not supported:" << codec;
+		return;
+	}
+	webrtc::EncodedImage image = buffer->getEncodedImage(frame.rtp_timestamp(), frame.ntp_time_ms());
+	if (!image.data() || (image.size() == 0)) {
+		return;
+	}
+	bool keyFrame = (image._frameType == webrtc::VideoFrameType::kVideoFrameKey);
+	int64_t timestampUs = frame.timestamp_us() ? frame.timestamp_us() : webrtc::TimeMicros();
+
+	// the header is serialized again when the parameter sets change
+	if (keyFrame) {
+		std::vector<uint8_t> config = getDecoderConfiguration(codec, image.data(), image.size());
+		if (!config.empty() && ( (codec != m_codec) || (config != m_config) || (frame.width() != m_width) || (frame.height() != m_height) )) {
+			m_codec = codec;
+			m_config = config;
+			m_width = frame.width();
+			m_height = frame.height();
+			if (m_fmp4) {
+				m_header = std::make_shared<const std::string>(buildFmp4Init(codec, config, m_width, m_height));
+			} else {
+				Json::Value decoderConfig;
+				decoderConfig["codec"] = getCodecString(codec, config);
+				decoderConfig["codedWidth"] = m_width;
+				decoderConfig["codedHeight"] = m_height;
+				decoderConfig["description"] = webrtc::Base64Encode(config);
+				Json::StreamWriterBuilder builder;
+				builder["indentation"] = "";
+				m_header = std::make_shared<const std::string>(Json::writeString(builder, decoderConfig));
+			}
+			RTC_LOG(LS_INFO) << "WebsocketStreamSink codec:" << getCodecString(codec, config) << " " << m_width << "x" << m_height;
+		}
+	}
+	if (!m_header) {
+		return;
+	}
+
+	std::vector<uint8_t> payload = toLengthPrefixed(codec, image.data(), image.size());
+	std::shared_ptr<std::string> data = std::make_shared<std::string>();
+	if (m_fmp4) {
+		// the duration of a frame is not known yet, the previous one is used and the decode time of the next fragment corrects it
+		if (m_firstTimestamp < 0) {
+			m_firstTimestamp = timestampUs;
+		}
+		int64_t timestamp = (timestampUs - m_firstTimestamp) * kFmp4Timescale / 1000000;
+		if ( (timestamp > m_lastTimestamp) && (timestamp - m_lastTimestamp < kFmp4Timescale * 10) ) {
+			m_lastDuration = timestamp - m_lastTimestamp;
+		}
+		timestamp = std::max(timestamp, m_lastTimestamp);
+		m_lastTimestamp = timestamp;
+		std::vector<Fmp4Sample> samples(1);
+		samples[0].m_data = std::move(payload);
+		samples[0].m_duration = m_lastDuration;
+		samples[0].m_keyFrame = keyFrame;
+		*data = buildFmp4Fragment(++m_fragmentSeq, timestamp, samples);
+	} else {
+		data->reserve(9 + payload.size());
+		data->push_back(keyFrame ? 1 : 0);
+		for (int i = 7; i >= 0; i--) {
+			data->push_back((char)((timestampUs >> (8 * i)) & 0xFF));
+		}
+		data->append(payload.begin(), payload.end());
+	}
+
+	Message message = {m_header, data, keyFrame};
+	{
+		std::lock_guard<std::mutex> lock(m_subscriberMutex);
+		for (auto & it : m_subscribers) {
+			Subscriber & subscriber = *it.second;
+			// a connection too slow skips the frames until the next key frame, the queued ones are dropped
+			if (subscriber.m_queue.size() >= kMaxPendingFrames) {
+				RTC_LOG(LS_WARNING) << "WebsocketStreamSink queue full, wait next key frame";
+				subscriber.m_queue.clear();
+				subscriber.m_waitKeyFrame = true;
+			}
+			if (subscriber.m_waitKeyFrame && !keyFrame) {
+				continue;
+			}
+			subscriber.m_waitKeyFrame = false;
+			subscriber.m_queue.push_back(message);
+		}
+	}
+	m_subscriberCond.notify_all();
+}
+
+void WebsocketStreamSink::addSubscriber(const void* id, const writer & writer, const closer & closer) {
+	std::unique_lock<std::mutex> lock(m_subscriberMutex);
+	// a reused id replaces the previous connection once its write is done
+	m_subscriberCond.wait(lock, [this, id] { return m_writing != id; });
+	m_subscribers[id] = std::make_shared<Subscriber>(writer, closer);
+}
+
+void WebsocketStreamSink::removeSubscriber(const void* id) {
+	std::unique_lock<std::mutex> lock(m_subscriberMutex);
+	m_subscribers.erase(id);
+	m_subscriberCond.wait(lock, [this, id] { return m_writing != id; });
+}
+
+size_t WebsocketStreamSink::getSubscriberCount() {
+	std::lock_guard<std::mutex> lock(m_subscriberMutex);
+	return m_subscribers.size();
+}
+
+void WebsocketStreamSink::stop() {
+	{
+		std::lock_guard<std::mutex> lock(m_subscriberMutex);
+		m_stop = true;
+	}
+	m_subscriberCond.notify_all();
+	if (m_thread.joinable()) {
+		m_thread.join();
+	}
+}
+
+void WebsocketStreamSink::close() {
+	this->stop();
+	std::map<const void*, std::shared_ptr<Subscriber>> subscribers;
+	{
+		std::lock_guard<std::mutex> lock(m_subscriberMutex);
+		subscribers.swap(m_subscribers);
+	}
+	for (auto & it : subscribers) {
+		it.second->m_closer();
+	}
+}
+
+void WebsocketStreamSink::SenderThread() {
+	std::unique_lock<std::mutex> lock(m_subscriberMutex);
+	while (!m_stop) {
+		// each turn sends one message of each connection, a slow connection delays the others by one write
+		std::vector<const void*> pending;
+		for (auto & it : m_subscribers) {
+			if (!it.second->m_queue.empty()) {
+				pending.push_back(it.first);
+			}
+		}
+		if (pending.empty()) {
+			m_subscriberCond.wait(lock);
+			continue;
+		}
+		for (const void* id : pending) {
+			std::map<const void*, std::shared_ptr<Subscriber>>::iterator it = m_subscribers.find(id);
+			if ( m_stop || (it == m_subscribers.end()) || it->second->m_queue.empty() ) {
+				continue;
+			}
+			std::shared_ptr<Subscriber> subscriber = it->second;
+			Message message = std::move(subscriber->m_queue.front());
+			subscriber->m_queue.pop_front();
+			// a new connection, or a new codec configuration, starts with the header and a key frame
+			bool sendHeader = (subscriber->m_header != message.m_header);
+			subscriber->m_header = message.m_header;
+			m_writing = id;
+			lock.unlock();
+
+			bool written = (!sendHeader || subscriber->m_writer(*message.m_header, m_fmp4)) && subscriber->m_writer(*message.m_data, true);
+			if (!written) {
+				RTC_LOG(LS_WARNING) << "WebsocketStreamSink write failed, close connection";
+				subscriber->m_closer();
+			}
+
+			lock.lock();
+			m_writing = NULL;
+			if (!written) {
+				it = m_subscribers.find(id);
+				if ( (it != m_subscribers.end()) && (it->second == subscriber) ) {
+					m_subscribers.erase(it);
+				}
+			}
+			m_subscriberCond.notify_all();
+		}
+	}
+}
@@ -0,0 +1,298 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include <functional>
+#include <set>
+#include <sstream>
+
+#include "absl/strings/match.h"
+#include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "json/json.h"
+
+#include "WorkerDispatcher.h"
+
+// time to wait the answer of a worker, longer than the blocking LL-HLS requests (10s)
+const int kWorkerTimeoutMs = 15000;
+
+static std::string getParam(const char *queryString, const char *paramName) {
+	std::string value;
+	if (queryString) {
+		CivetServer::getParam(queryString, paramName, value);
+	}
+	return value;
+}
+
+/* ---------------------------------------------------------------------------
+**  Civet HTTP callback 
+** -------------------------------------------------------------------------*/
+class DispatcherHandler : public CivetHandler
+{
+  public:
+	DispatcherHandler(WorkerDispatcher & dispatcher) : m_dispatcher(dispatcher) {}
+
+	bool handleGet(CivetServer *server, struct mg_connection *conn)    { return m_dispatcher.forward(conn); }
+	bool handlePost(CivetServer *server, struct mg_connection *conn)   { return m_dispatcher.forward(conn); }
+	bool handlePatch(CivetServer *server, struct mg_connection *conn)  { return m_dispatcher.forward(conn); }
+	bool handleDelete(CivetServer *server, struct mg_connection *conn) { return m_dispatcher.forward(conn); }
+
+  private:
+	WorkerDispatcher & m_dispatcher;
+};
+
+/* ---------------------------------------------------------------------------
+**  the websockets are served by each worker, they are not forwarded
+** -------------------------------------------------------------------------*/
+class UnavailableWebsocketHandler : public CivetWebSocketHandler
+{
+  public:
+	bool handleConnection(CivetServer *server, const struct mg_connection *conn) {
+		const struct mg_request_info *req_info = mg_get_request_info(conn);
+		RTC_LOG(LS_WARNING) << "WorkerDispatcher websocket not available with workers uri:" << req_info->local_uri;
+		mg_send_http_error(const_cast<struct mg_connection *>(conn), 501, "%s", "websocket not available with workers");
+		return false;
+	}
+};
+
+/* ---------------------------------------------------------------------------
+**  Constructor
+** -------------------------------------------------------------------------*/
+WorkerDispatcher::WorkerDispatcher(const std::vector<std::string> & workers, const std::string & basePath, const std::vector<std::string>& options) 
+	: CivetServer(options), m_workers(workers), m_basePath(basePath)
+{
+	m_handler = new DispatcherHandler(*this);
+	this->addHandler(basePath + "/api", m_handler);
+	m_websocketHandler = new UnavailableWebsocketHandler();
+	this->addWebSocketHandler("/ws", m_websocketHandler);
+}
+
+WorkerDispatcher::~WorkerDispatcher()
+{
+	this->close();
+	delete m_handler;
+	delete m_websocketHandler;
+}
+
+/* ---------------------------------------------------------------------------
+**  select the worker of a request
+** -------------------------------------------------------------------------*/
+bool WorkerDispatcher::getWorker(const struct mg_request_info *req_info, size_t & worker)
+{
+	// explicit worker, to get the lists of each worker
+	std::string index = getParam(req_info->query_string, "worker");
+	if (!index.empty()) {
+		if (index.find_first_not_of("0123456789") != std::string::npos) {
+			return false;
+		}
+		worker = std::strtoul(index.c_str(), NULL, 10) % m_workers.size();
+		return true;
+	}
+
+	// follow-up request of a peer
+	std::string peerid = getParam(req_info->query_string, "peerid");
+	if (!peerid.empty()) {
+		std::lock_guard<std::mutex> lock(m_peerMutex);
+		std::map<std::string, Peer>::iterator it = m_peers.find(peerid);
+		if (it != m_peers.end()) {
+			worker = it->second.m_worker;
+			return true;
+		}
+	}
+
+	// the streams are ingested by only one worker, the video (or the WHIP name) selects it whatever the audio
+	std::string url = getParam(req_info->query_string, "url");
+	if (url.empty()) {
+		url = getParam(req_info->query_string, "audiourl");
+	}
+	if (url.empty()) {
+		worker = 0;
+	} else {
+		worker = std::hash<std::string>()(url) % m_workers.size();
+	}
+	return true;
+}
+
+/* ---------------------------------------------------------------------------
+**  keep the worker of the peers
+** -------------------------------------------------------------------------*/
+void WorkerDispatcher::updatePeer(const struct mg_request_info *req_info, const struct mg_response_info *resp_info, size_t worker)
+{
+	std::string peerid = getParam(req_info->query_string, "peerid");
+	if (peerid.empty()) {
+		// WHEP peerid is given by the worker in the location
+		for (int i = 0; i < resp_info->num_headers; i++) {
+			if (absl::EqualsIgnoreCase(resp_info->http_headers[i].name, "Location")) {
+				const char* location = strchr(resp_info->http_headers[i].value, '?');
+				if (location) {
+					peerid = getParam(location + 1, "peerid");
+				}
+			}
+		}
+	}
+	if (!peerid.empty()) {
+		std::string uri(req_info->local_uri ? req_info->local_uri : "");
+		std::lock_guard<std::mutex> lock(m_peerMutex);
+		if ( (uri.find("/api/hangup") != std::string::npos) || (strcmp(req_info->request_method, "DELETE") == 0) ) {
+			m_peers.erase(peerid);
+		} else {
+			m_peers[peerid] = {worker, webrtc::TimeMillis()};
+		}
+	}
+}
+
+/* ---------------------------------------------------------------------------
+**  send a GET request to a worker
+** -------------------------------------------------------------------------*/
+bool WorkerDispatcher::request(size_t worker, const std::string & uri, std::string & answer)
+{
+	std::string address(m_workers[worker]);
+	std::string host(address.substr(0, address.find(':')));
+	int port = std::stoi(address.substr(address.find(':') + 1));
+
+	char error[256] = {0};
+	struct mg_connection *client = mg_connect_client(host.c_str(), port, 0, error, sizeof(error));
+	if (!client) {
+		RTC_LOG(LS_WARNING) << "WorkerDispatcher::request worker:" << worker << " error:" << error;
+		return false;
+	}
+	mg_printf(client, "GET %s HTTP/1.1\r\nHost: %s\r\nContent-Length: 0\r\n\r\n", uri.c_str(), address.c_str());
+
+	bool success = false;
+	if (mg_get_response(client, error, sizeof(error), kWorkerTimeoutMs) < 0) {
+		RTC_LOG(LS_WARNING) << "WorkerDispatcher::request worker:" << worker << " error:" << error;
+	} else if (mg_get_response_info(client)->status_code == 200) {
+		char buffer[4096];
+		int size = 0;
+		while ((size = mg_read(client, buffer, sizeof(buffer))) > 0) {
+			answer.append(buffer, size);
+		}
+		success = true;
+	}
+	mg_close_connection(client);
+	return success;
+}
+
+/* ---------------------------------------------------------------------------
+**  forget the peers that their worker does not have anymore
+**  (ICE timeout, worker restart), hangup and DELETE are not always sent
+** -------------------------------------------------------------------------*/
+void WorkerDispatcher::expirePeers()
+{
+	for (size_t worker = 0; worker < m_workers.size(); worker++) {
+		int64_t now = webrtc::TimeMillis();
+		std::string answer;
+		if (!this->request(worker, m_basePath + "/api/getPeerConnectionList", answer)) {
+			continue;
+		}
+		Json::Value list;
+		Json::CharReaderBuilder builder;
+		std::istringstream is(answer);
+		std::string errors;
+		if (!Json::parseFromStream(builder, is, &list, &errors) || !list.isArray()) {
+			RTC_LOG(LS_WARNING) << "WorkerDispatcher::expirePeers worker:" << worker << " error:" << errors;
+			continue;
+		}
+		std::set<std::string> peers;
+		for (const Json::Value & item : list) {
+			if (item.isObject()) {
+				for (const std::string & peerid : item.getMemberNames()) {
+					peers.insert(peerid);
+				}
+			}
+		}
+
+		// the peers registered after the request are kept
+		std::lock_guard<std::mutex> lock(m_peerMutex);
+		std::map<std::string, Peer>::iterator it = m_peers.begin();
+		while (it != m_peers.end()) {
+			if ( (it->second.m_worker == worker) && (it->second.m_time < now) && (peers.find(it->first) == peers.end()) ) {
+				RTC_LOG(LS_INFO) << "WorkerDispatcher::expirePeers worker:" << worker << " peerid:" << it->first;
+				it = m_peers.erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+}
+
+/* ---------------------------------------------------------------------------
+**  forward a request to its worker and its answer to the client
+** -------------------------------------------------------------------------*/
+bool WorkerDispatcher::forward(struct mg_connection *conn)
+{
+	const struct mg_request_info *req_info = mg_get_request_info(conn);
+	size_t worker = 0;
+	if (!this->getWorker(req_info, worker)) {
+		mg_send_http_error(conn, 400, "invalid worker");
+		return true;
+	}
+
+	std::string address(m_workers[worker]);
+	std::string host(address.substr(0, address.find(':')));
+	int port = std::stoi(address.substr(address.find(':') + 1));
+
+	char error[256] = {0};
+	struct mg_connection *client = mg_connect_client(host.c_str(), port, 0, error, sizeof(error));
+	if (!client) {
+		RTC_LOG(LS_ERROR) << "WorkerDispatcher::forward worker:" << worker << " error:" << error;
+		mg_send_http_error(conn, 502, "%s", error);
+		return true;
+	}
+
+	std::string body;
+	if (req_info->content_length > 0) {
+		body = CivetServer::getPostData(conn);
+	}
+
+	mg_printf(client, "%s %s%s%s HTTP/1.1\r\n", req_info->request_method, req_info->request_uri, req_info->query_string ? "?" : "", req_info->query_string ? req_info->query_string : "");
+	mg_printf(client, "Host: %s\r\n", address.c_str());
+	mg_printf(client, "X-Forwarded-For: %s\r\n", req_info->remote_addr);
+	for (const char* header : {"Content-Type", "If-None-Match"}) {
+		const char* value = mg_get_header(conn, header);
+		if (value) {
+			mg_printf(client, "%s: %s\r\n", header, value);
+		}
+	}
+	mg_printf(client, "Content-Length: %zd\r\n\r\n", body.size());
+	mg_write(client, body.c_str(), body.size());
+
+	if (mg_get_response(client, error, sizeof(error), kWorkerTimeoutMs) < 0) {
+		RTC_LOG(LS_ERROR) << "WorkerDispatcher::forward worker:" << worker << " error:" << error;
+		mg_close_connection(client);
+		mg_send_http_error(conn, 504, "%s", error);
+		return true;
+	}
+	const struct mg_response_info *resp_info = mg_get_response_info(client);
+	this->updatePeer(req_info, resp_info, worker);
+
+	std::string answer;
+	char buffer[4096];
+	int size = 0;
+	while ((size = mg_read(client, buffer, sizeof(buffer))) > 0) {
+		answer.append(buffer, size);
+	}
+
+	mg_printf(conn, "HTTP/1.1 %d %s\r\n", resp_info->status_code, mg_get_response_code_text(conn, resp_info->status_code));
+	for (int i = 0; i < resp_info->num_headers; i++) {
+		const char* name = resp_info->http_headers[i].name;
+		if ( !absl::EqualsIgnoreCase(name, "Content-Length") && !absl::EqualsIgnoreCase(name, "Connection") && !absl::EqualsIgnoreCase(name, "Transfer-Encoding") ) {
+			mg_printf(conn, "%s: %s\r\n", name, resp_info->http_headers[i].value);
+		}
+	}
+	mg_printf(conn, "Content-Length: %zd\r\n\r\n", answer.size());
+	mg_write(conn, answer.c_str(), answer.size());
+
+	mg_close_connection(client);
+	return true;
+}
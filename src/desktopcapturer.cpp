@@ -12,60 +12,131 @@
 
 #ifdef USE_X11
 
+#include <chrono>
+
 #include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
+#include "libyuv/planar_functions.h"
+#include "libyuv/scale_argb.h"
 
 #include "desktopcapturer.h"
 
+void DesktopCapturer::UpdateRect(const webrtc::DesktopFrame & frame, const webrtc::DesktopRect & rect) {
+	int srcWidth = frame.size().width();
+	int srcHeight = frame.size().height();
+	int dstWidth = m_canvas->width();
+	int dstHeight = m_canvas->height();
+
+	// expand the rect by one pixel for the scaling filter and map it in the output coordinates aligned on chroma samples
+	int left = std::max(0, rect.left() - 1) * dstWidth / srcWidth;
+	int top = std::max(0, rect.top() - 1) * dstHeight / srcHeight;
+	int right = (std::min(srcWidth, rect.right() + 1) * dstWidth + srcWidth - 1) / srcWidth;
+	int bottom = (std::min(srcHeight, rect.bottom() + 1) * dstHeight + srcHeight - 1) / srcHeight;
+	left &= ~1;
+	top &= ~1;
+	right = std::min(dstWidth, (right + 1) & ~1);
+	bottom = std::min(dstHeight, (bottom + 1) & ~1);
+	if ( (right <= left) || (bottom <= top) ) {
+		return;
+	}
+
+	const uint8_t* argb = frame.data();
+	int argbStride = frame.stride();
+	if ( (srcWidth != dstWidth) || (srcHeight != dstHeight) ) {
+		// scale only the updated area
+		m_scaled.resize(dstWidth * dstHeight * webrtc::DesktopFrame::kBytesPerPixel);
+		libyuv::ARGBScaleClip(frame.data(), frame.stride(), srcWidth, srcHeight,
+			m_scaled.data(), dstWidth * webrtc::DesktopFrame::kBytesPerPixel, dstWidth, dstHeight,
+			left, top, right - left, bottom - top, libyuv::kFilterBilinear);
+		argb = m_scaled.data();
+		argbStride = dstWidth * webrtc::DesktopFrame::kBytesPerPixel;
+	}
+
+	libyuv::ARGBToI420(argb + top * argbStride + left * webrtc::DesktopFrame::kBytesPerPixel, argbStride,
+		m_canvas->MutableDataY() + top * m_canvas->StrideY() + left, m_canvas->StrideY(),
+		m_canvas->MutableDataU() + (top / 2) * m_canvas->StrideU() + left / 2, m_canvas->StrideU(),
+		m_canvas->MutableDataV() + (top / 2) * m_canvas->StrideV() + left / 2, m_canvas->StrideV(),
+		right - left, bottom - top);
+}
+
 void DesktopCapturer::OnCaptureResult(webrtc::DesktopCapturer::Result result, std::unique_ptr<webrtc::DesktopFrame> frame) {
 	
-	RTC_LOG(LS_INFO) << "DesktopCapturer:OnCaptureResult";
+	RTC_LOG(LS_VERBOSE) << "DesktopCapturer:OnCaptureResult";
 	
 	if (result == webrtc::DesktopCapturer::Result::SUCCESS) {
-		int width = frame->stride() / webrtc::DesktopFrame::kBytesPerPixel;
-		int height = frame->rect().height();
-
-		webrtc::scoped_refptr<webrtc::I420Buffer> I420buffer = webrtc::I420Buffer::Create(width, height);
-
-		const int conversionResult = libyuv::ConvertToI420(frame->data(), 0,
-			I420buffer->MutableDataY(), I420buffer->StrideY(),
-			I420buffer->MutableDataU(), I420buffer->StrideU(),
-			I420buffer->MutableDataV(), I420buffer->StrideV(),
-			0, 0,
-			width, height,
-			I420buffer->width(), I420buffer->height(),
-			libyuv::kRotate0, ::libyuv::FOURCC_ARGB);									
-				
-		if (conversionResult >= 0) {
-			webrtc::VideoFrame videoFrame(I420buffer, webrtc::VideoRotation::kVideoRotation_0, webrtc::TimeMicros());
-			if ( (m_height == 0) && (m_width == 0) ) {
-				m_broadcaster.OnFrame(videoFrame);	
-
-			} else {
-				int height = m_height;
-				int width = m_width;
-				if (height == 0) {
-					height = (videoFrame.height() * width) / videoFrame.width();
-				}
-				else if (width == 0) {
-					width = (videoFrame.width() * height) / videoFrame.height();
-				}
-				int stride_y = width;
-				int stride_uv = (width + 1) / 2;
-				webrtc::scoped_refptr<webrtc::I420Buffer> scaled_buffer = webrtc::I420Buffer::Create(width, height, stride_y, stride_uv, stride_uv);
-				scaled_buffer->ScaleFrom(*videoFrame.video_frame_buffer()->ToI420());
-
-	            webrtc::VideoFrame frame = webrtc::VideoFrame::Builder()
-					.set_video_frame_buffer(scaled_buffer)
+		int srcWidth = frame->size().width();
+		int srcHeight = frame->size().height();
+		int width = m_width;
+		int height = m_height;
+		if ( (height == 0) && (width == 0) ) {
+			width = srcWidth;
+			height = srcHeight;
+		}
+		else if (height == 0) {
+			height = (srcHeight * width) / srcWidth;
+		}
+		else if (width == 0) {
+			width = (srcWidth * height) / srcHeight;
+		}
+
+		// apply the resolution and frame rate wanted by the sinks, a dropped frame still updates the persistent image
+		int64_t now = webrtc::TimeMicros();
+		int outWidth = width;
+		int outHeight = height;
+		bool keepFrame = this->AdaptFrame(width, height, now, outWidth, outHeight);
+		if (keepFrame) {
+			width = outWidth;
+			height = outHeight;
+		} else if (m_canvas) {
+			width = m_canvas->width();
+			height = m_canvas->height();
+		}
+
+		// the I420 image is kept between captures, only the updated region is converted
+		bool fullUpdate = false;
+		if (!m_canvas || (m_canvas->width() != width) || (m_canvas->height() != height) || (m_srcWidth != srcWidth) || (m_srcHeight != srcHeight)) {
+			RTC_LOG(LS_INFO) << "DesktopCapturer:OnCaptureResult size:" << srcWidth << "x" << srcHeight << " output:" << width << "x" << height;
+			m_canvas = webrtc::I420Buffer::Create(width, height);
+			m_srcWidth = srcWidth;
+			m_srcHeight = srcHeight;
+			fullUpdate = true;
+		}
+
+		if (fullUpdate) {
+			this->UpdateRect(*frame, webrtc::DesktopRect::MakeSize(frame->size()));
+			m_updated = true;
+		} else {
+			for (webrtc::DesktopRegion::Iterator it(frame->updated_region()); !it.IsAtEnd(); it.Advance()) {
+				this->UpdateRect(*frame, it.rect());
+				m_updated = true;
+			}
+		}
+
+		// unchanged frames are skipped, but the last image is repeated from time to time for new viewers
+		if (!keepFrame) {
+			RTC_LOG(LS_VERBOSE) << "DesktopCapturer:OnCaptureResult drop frame for sinks wants";
+		}
+		else if (m_updated || m_forceFrame.exchange(false) || (now - m_lastFrameTime > webrtc::kNumMicrosecsPerSec)) {
+			webrtc::scoped_refptr<webrtc::I420Buffer> buffer = m_bufferPool.CreateI420Buffer(width, height);
+			if (buffer) {
+				libyuv::I420Copy(m_canvas->DataY(), m_canvas->StrideY(),
+					m_canvas->DataU(), m_canvas->StrideU(),
+					m_canvas->DataV(), m_canvas->StrideV(),
+					buffer->MutableDataY(), buffer->StrideY(),
+					buffer->MutableDataU(), buffer->StrideU(),
+					buffer->MutableDataV(), buffer->StrideV(),
+					width, height);
+
+				webrtc::VideoFrame videoFrame = webrtc::VideoFrame::Builder()
+					.set_video_frame_buffer(buffer)
 					.set_rotation(webrtc::kVideoRotation_0)
-					.set_timestamp_us(webrtc::TimeMicros())
+					.set_timestamp_us(now)
 					.build();
-				
-						
-				m_broadcaster.OnFrame(frame);
+				m_broadcaster.OnFrame(videoFrame);
+				m_lastFrameTime = now;
+				m_updated = false;
 			}
-		} else {
-			RTC_LOG(LS_ERROR) << "DesktopCapturer:OnCaptureResult conversion error:" << conversionResult;
-		}				
+		}
 
 	} else {
 		RTC_LOG(LS_ERROR) << "DesktopCapturer:OnCaptureResult capture error:" << (int)result;
@@ -74,11 +145,37 @@ void DesktopCapturer::OnCaptureResult(webrtc::DesktopCapturer::Result result, st
 		
 void DesktopCapturer::CaptureThread() {
 	RTC_LOG(LS_INFO) << "DesktopCapturer:Run start";
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now();
 	while (IsRunning()) {
+		{
+			// nothing is captured while there is no sink
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cond.wait(lock, [this] { return !m_isrunning || m_broadcaster.frame_wanted(); });
+			if (!m_isrunning) {
+				break;
+			}
+		}
+
 		m_capturer->CaptureFrame();
+
+		// pace the capture with the fps option, limited by the sinks wants
+		int fps = m_fps;
+		int wantedFps = m_broadcaster.wants().max_framerate_fps;
+		if ( (wantedFps > 0) && (wantedFps < fps) ) {
+			fps = wantedFps;
+		}
+		deadline += std::chrono::microseconds(webrtc::kNumMicrosecsPerSec / fps);
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (deadline < now) {
+			deadline = now;
+		} else {
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cond.wait_until(lock, deadline, [this] { return !m_isrunning; });
+		}
 	}
 	RTC_LOG(LS_INFO) << "DesktopCapturer:Run exit";
 }
+
 bool DesktopCapturer::Start() {
 	m_isrunning = true;
 	m_capturethread = std::thread(&DesktopCapturer::CaptureThread, this); 
@@ -87,9 +184,22 @@ bool DesktopCapturer::Start() {
 }
 		
 void DesktopCapturer::Stop() {
-	m_isrunning = false;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_isrunning = false;
+	}
+	m_cond.notify_all();
 	m_capturethread.join(); 
 }
+
+void DesktopCapturer::AddOrUpdateSink(webrtc::VideoSinkInterface<webrtc::VideoFrame>* sink, const webrtc::VideoSinkWants& wants) {
+	VideoSource::AddOrUpdateSink(sink, wants);
+	m_forceFrame = true;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+	}
+	m_cond.notify_all();
+}
 		
 #endif
 
@@ -14,10 +14,13 @@
 
 #ifndef _WIN32
 #include <libgen.h>
+#include <unistd.h>
+#include <sys/wait.h>
 #endif
 
 #include <iostream>
 #include <fstream>
+#include <algorithm>
 
 #include "cxxopts.hpp"
 
@@ -30,6 +33,7 @@
 
 #include "PeerConnectionManager.h"
 #include "HttpServerRequestHandler.h"
+#include "WorkerDispatcher.h"
 
 PeerConnectionManager *webRtcServer = NULL;
 
@@ -101,6 +105,186 @@ std::string GetDefaultRessourceDir(const char *argv0)
 	return ressourceDir;
 }
 
+#ifndef _WIN32
+/* ---------------------------------------------------------------------------
+**  worker processes
+** -------------------------------------------------------------------------*/
+volatile sig_atomic_t supervisorRunning = 1;
+
+// the supervision loop runs every 500ms, the peers of the workers are checked every 30s
+const int kExpirePeersLoops = 60;
+
+void supervisorSighandler(int n)
+{
+	supervisorRunning = 0;
+}
+
+// the front server authenticates the requests and terminates TLS, the workers only listen on localhost
+bool isFrontOption(const std::string & arg, bool & separateValue)
+{
+	separateValue = false;
+	for (const std::string option : {"-A", "-D", "-c", "--passwd", "--domain", "--cert"})
+	{
+		if (arg == option)
+		{
+			separateValue = true;
+			return true;
+		}
+		if ( (arg.find(option) == 0) && ( (option.size() == 2) || (arg[option.size()] == '=') ) )
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// the worker is the same command line, listening on localhost with its own part of the UDP port range
+pid_t spawnWorker(int argc, char *argv[], int index, const std::string & httpAddress, const std::string & udpRange, const std::string & stunurl, const std::string & turnurl)
+{
+	std::vector<std::string> args;
+	for (int i = 0; i < argc; i++)
+	{
+		std::string arg(argv[i]);
+		bool separateValue = false;
+		if (isFrontOption(arg, separateValue))
+		{
+			if (separateValue)
+			{
+				i++;
+			}
+			continue;
+		}
+		// only the first worker starts the embedded STUN and TURN servers
+		if ( (index > 0) && ((arg.find("-S") == 0) || (arg.find("-T") == 0) || (arg.find("--stun-server") == 0) || (arg.find("--turn-server") == 0)) )
+		{
+			continue;
+		}
+		args.push_back(arg);
+	}
+	// the other workers use the embedded servers of the first one
+	if ( (index > 0) && !stunurl.empty() )
+	{
+		args.push_back("-s" + stunurl);
+	}
+	if ( (index > 0) && !turnurl.empty() )
+	{
+		args.push_back("-t" + turnurl);
+	}
+	args.push_back("-H" + httpAddress);
+	args.push_back("-R" + udpRange);
+	args.push_back("-F0");
+
+	std::vector<char *> execArgs;
+	for (std::string & arg : args)
+	{
+		execArgs.push_back(const_cast<char *>(arg.c_str()));
+	}
+	execArgs.push_back(NULL);
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		execvp(execArgs[0], execArgs.data());
+		_exit(1);
+	}
+	std::cout << "Worker:" << index << " pid:" << pid << " http:" << httpAddress << " udp:" << udpRange << std::endl;
+	return pid;
+}
+
+int superviseWorkers(int argc, char *argv[], int workers, const std::string & httpAddress, const std::string & webrtcUdpPortRange, const std::string & stunurl, const std::string & turnurl, const std::string & basePath, const std::vector<std::string> & options)
+{
+	// workers listen on the following ports
+	int httpPort = 8000;
+	size_t pos = httpAddress.find_last_of(':');
+	std::string port = httpAddress.substr(pos == std::string::npos ? 0 : pos + 1);
+	if (!port.empty() && isdigit(port[0]))
+	{
+		httpPort = std::stoi(port);
+	}
+
+	int minPort = 0;
+	int maxPort = 65535;
+	std::istringstream is(webrtcUdpPortRange);
+	std::getline(is, port, ':');
+	minPort = std::stoi(port);
+	if (std::getline(is, port, ':'))
+	{
+		maxPort = std::stoi(port);
+	}
+	// the default range lets each worker use any port
+	bool splitRange = (minPort != 0) || (maxPort != 65535);
+	int rangeSize = (maxPort - minPort + 1) / workers;
+	if (splitRange && (rangeSize <= 0))
+	{
+		std::cout << "UDP port range " << webrtcUdpPortRange << " is too small for " << workers << " workers" << std::endl;
+		return 1;
+	}
+
+	std::vector<std::string> addresses;
+	std::vector<std::string> ranges;
+	std::vector<pid_t> pids;
+	for (int index = 0; index < workers; index++)
+	{
+		addresses.push_back("127.0.0.1:" + std::to_string(httpPort + 1 + index));
+		if (splitRange)
+		{
+			int workerMinPort = minPort + index * rangeSize;
+			ranges.push_back(std::to_string(workerMinPort) + ":" + std::to_string(workerMinPort + rangeSize - 1));
+		}
+		else
+		{
+			ranges.push_back(webrtcUdpPortRange);
+		}
+		pids.push_back(spawnWorker(argc, argv, index, addresses[index], ranges[index], stunurl, turnurl));
+	}
+
+	try
+	{
+		std::cout << "HTTP Listen at " << httpAddress << std::endl;
+		WorkerDispatcher dispatcher(addresses, basePath, options);
+
+		signal(SIGINT, supervisorSighandler);
+		signal(SIGTERM, supervisorSighandler);
+		int loop = 0;
+		while (supervisorRunning)
+		{
+			// forget the peers that the workers closed by themselves
+			if (++loop % kExpirePeersLoops == 0)
+			{
+				dispatcher.expirePeers();
+			}
+
+			// restart the workers that exit
+			int status = 0;
+			pid_t pid = waitpid(-1, &status, WNOHANG);
+			std::vector<pid_t>::iterator it = std::find(pids.begin(), pids.end(), pid);
+			if ( (pid > 0) && (it != pids.end()) )
+			{
+				int index = it - pids.begin();
+				std::cout << "Worker:" << index << " pid:" << pid << " exit status:" << status << std::endl;
+				pids[index] = spawnWorker(argc, argv, index, addresses[index], ranges[index], stunurl, turnurl);
+			}
+			usleep(500000);
+		}
+	}
+	catch (const CivetException &ex)
+	{
+		std::cout << "Cannot Initialize start HTTP server exception:" << ex.what() << std::endl;
+	}
+
+	for (pid_t pid : pids)
+	{
+		kill(pid, SIGINT);
+	}
+	for (pid_t pid : pids)
+	{
+		waitpid(pid, NULL, 0);
+	}
+	std::cout << "Exit" << std::endl;
+	return 0;
+}
+#endif
+
 /* ---------------------------------------------------------------------------
 **  main
 ** -------------------------------------------------------------------------*/
@@ -129,6 +313,10 @@ int main(int argc, char *argv[])
 	bool useNullCodec = false;
 	bool usePlanB = false;
 	int maxpc = 0;
+	int pcPoolSize = 0;
+	int shards = 1;
+	int snapshotInterval = 1000;
+	int workers = 0;
 	webrtc::PeerConnectionInterface::IceTransportsType transportType = webrtc::PeerConnectionInterface::IceTransportsType::kAll;
 	std::string webrtcTrialsFields = "WebRTC-FrameDropper/Disabled/WebRTC-Video-H26xPacketBuffer/Enabled/";
 	TurnAuth turnAuth;
@@ -167,10 +355,14 @@ int main(int argc, char *argv[])
 			("A,passwd", "Password file for HTTP server access", cxxopts::value<std::string>())
 			("D,domain", "Authentication domain for HTTP server access (default: empty means disabled)", cxxopts::value<std::string>())
 			("X,disable-xframe", "Disable X-Frame-Options header")
-			("B,base-path", "Base path for HTTP server", cxxopts::value<std::string>());
+			("B,base-path", "Base path for HTTP server", cxxopts::value<std::string>())
+			("i,snapshot-interval", "Minimum interval in ms between two snapshots of a stream (default 1000)", cxxopts::value<int>());
 
 		options.add_options("WebRTC")
 			("m,maxpc", "Maximum number of peer connections", cxxopts::value<int>())
+			("P,pc-pool", "Number of peer connections created in advance", cxxopts::value<int>())
+			("j,shards", "Number of peer connection factories with their own network and worker threads", cxxopts::value<int>())
+			("F,workers", "Number of worker processes behind the HTTP server", cxxopts::value<int>())
 			("I,ice-transport", "Set ice transport type", cxxopts::value<int>())
 			("T,turn-server", "Start embedded TURN server", cxxopts::value<std::string>()->implicit_value(defaultlocalturnurl))
 			("t,turn", "Use an external TURN relay server", cxxopts::value<std::string>())
@@ -268,11 +460,31 @@ int main(int argc, char *argv[])
 			basePath = result["base-path"].as<std::string>();
 		}
 
+		if (result.count("snapshot-interval"))
+		{
+			snapshotInterval = result["snapshot-interval"].as<int>();
+		}
+
 		if (result.count("maxpc"))
 		{
 			maxpc = result["maxpc"].as<int>();
 		}
 
+		if (result.count("pc-pool"))
+		{
+			pcPoolSize = result["pc-pool"].as<int>();
+		}
+
+		if (result.count("shards"))
+		{
+			shards = result["shards"].as<int>();
+		}
+
+		if (result.count("workers"))
+		{
+			workers = result["workers"].as<int>();
+		}
+
 		if (result.count("ice-transport"))
 		{
 			transportType = (webrtc::PeerConnectionInterface::IceTransportsType)result["ice-transport"].as<int>();
@@ -370,6 +582,60 @@ int main(int argc, char *argv[])
 	std::cout << "Logger level:" << logConfig.debug_severity() << std::endl;
 	webrtc::InitializeLogging(std::move(logConfig));
 
+	// http server options
+	std::vector<std::string> options;
+	options.push_back("document_root");
+	options.push_back(webroot);
+	options.push_back("enable_directory_listing");
+	options.push_back("no");
+	if (!disableXframeOptions)
+	{
+		options.push_back("additional_header");
+		options.push_back("X-Frame-Options: SAMEORIGIN");
+	}
+	options.push_back("access_control_allow_origin");
+	options.push_back("*");
+	options.push_back("listening_ports");
+	options.push_back(httpAddress);
+	options.push_back("enable_keep_alive");
+	options.push_back("yes");
+	options.push_back("keep_alive_timeout_ms");
+	options.push_back("1000");
+	options.push_back("decode_url");
+	options.push_back("no");
+#if defined(__linux__)		
+	options.push_back("allow_sendfile_call");
+	options.push_back("no");
+#endif
+	if (!sslCertificate.empty())
+	{
+		options.push_back("ssl_certificate");
+		options.push_back(sslCertificate);
+	}
+	if (!nbthreads.empty())
+	{
+		options.push_back("num_threads");
+		options.push_back(nbthreads);
+	}
+	if (!passwdFile.empty())
+	{
+		options.push_back("global_auth_file");
+		options.push_back(passwdFile);
+	}
+	if (!authDomain.empty())
+	{
+		options.push_back("authentication_domain");
+		options.push_back(authDomain);
+	}
+
+#ifndef _WIN32
+	if (workers > 0)
+	{
+		// the urls of the embedded servers as the first worker publishes them
+		return superviseWorkers(argc, argv, workers, httpAddress, localWebrtcUdpPortRange, localstunurl.empty() ? "" : stunurl, localturnurl.empty() ? "" : turnurl, basePath, options);
+	}
+#endif
+
 	webrtc::ThreadManager::Instance()->WrapCurrentThread();
 	webrtc::Thread *thread = webrtc::Thread::Current();
 	webrtc::InitializeSSL();
@@ -385,63 +651,31 @@ int main(int argc, char *argv[])
 		iceServerList.push_back(std::string("turn:") + turnurl);
 	}
 
-	webRtcServer = new PeerConnectionManager(iceServerList, config["urls"], audioLayer, publishFilter, localWebrtcUdpPortRange, useNullCodec, usePlanB, maxpc, transportType, basePath, webrtcTrialsFields, extraHost);
+	webRtcServer = new PeerConnectionManager(iceServerList, config["urls"], audioLayer, publishFilter, localWebrtcUdpPortRange, useNullCodec, usePlanB, maxpc, transportType, basePath, webrtcTrialsFields, extraHost, pcPoolSize, shards, snapshotInterval);
 	if (!webRtcServer->InitializePeerConnection())
 	{
 		std::cout << "Cannot Initialize WebRTC server" << std::endl;
 	}
 	else
 	{
-		// http server
-		std::vector<std::string> options;
-		options.push_back("document_root");
-		options.push_back(webroot);
-		options.push_back("enable_directory_listing");
-		options.push_back("no");
-		if (!disableXframeOptions)
-		{
-			options.push_back("additional_header");
-			options.push_back("X-Frame-Options: SAMEORIGIN");
-		}
-		options.push_back("access_control_allow_origin");
-		options.push_back("*");
-		options.push_back("listening_ports");
-		options.push_back(httpAddress);
-		options.push_back("enable_keep_alive");
-		options.push_back("yes");
-		options.push_back("keep_alive_timeout_ms");
-		options.push_back("1000");
-		options.push_back("decode_url");
-		options.push_back("no");
-#if defined(__linux__)		
-		options.push_back("allow_sendfile_call");
-		options.push_back("no");
-#endif
-		if (!sslCertificate.empty())
-		{
-			options.push_back("ssl_certificate");
-			options.push_back(sslCertificate);
-		}
-		if (!nbthreads.empty())
-		{
-			options.push_back("num_threads");
-			options.push_back(nbthreads);
-		}
-		if (!passwdFile.empty())
-		{
-			options.push_back("global_auth_file");
-			options.push_back(passwdFile);
-		}
-		if (!authDomain.empty())
-		{
-			options.push_back("authentication_domain");
-			options.push_back(authDomain);
-		}
 		try
 		{
 			std::map<std::string, HttpServerRequestHandler::httpFunction> func = webRtcServer->getHttpApi();
 			std::cout << "HTTP Listen at " << httpAddress << std::endl;
 			HttpServerRequestHandler httpServer(func, options);
+			webRtcServer->setEventCallback([&httpServer](const std::string & peerid, const Json::Value & event) {
+				httpServer.publish(peerid, event);
+			}, [&httpServer](const std::string & peerid) {
+				return httpServer.hasSubscribers(peerid);
+			});
+			// the connections closed at exit are unsubscribed after the manager is deleted
+			httpServer.addStreamHandler("/ws/stream", [](const void* id, const struct mg_request_info *req_info, const HttpServerRequestHandler::wsWriter & writer, const HttpServerRequestHandler::wsCloser & closer) {
+				return webRtcServer && webRtcServer->subscribeStream(id, req_info->query_string, writer, closer);
+			}, [](const void* id) {
+				if (webRtcServer) {
+					webRtcServer->unsubscribeStream(id);
+				}
+			});
 
 			webrtc::Environment env(webrtc::CreateEnvironment());
 			// start STUN server if needed
@@ -12,26 +12,105 @@
 
 #ifdef HAVE_LIVE555
 
+#include <sstream>
+
 #include "rtc_base/logging.h"
+#include "rtc_base/time_utils.h"
 
 #include "rtspvideocapturer.h"
 
+static const int kDefaultFailoverSeconds = 10;
+
+// the data timeout of the connections detects the stalls of a stream with alternates
+static std::map<std::string,std::string> getConnectionOptions(const std::map<std::string,std::string> & opts)
+{
+	std::map<std::string,std::string> connectionOpts(opts);
+	if ( (opts.find("alternates") != opts.end()) && (opts.find("timeout") == opts.end()) ) {
+		connectionOpts["timeout"] = (opts.find("failover") != opts.end()) ? opts.at("failover") : std::to_string(kDefaultFailoverSeconds);
+	}
+	return connectionOpts;
+}
+
 RTSPVideoCapturer::RTSPVideoCapturer(const std::string & uri, const std::map<std::string,std::string> & opts, std::unique_ptr<webrtc::VideoDecoderFactory>& videoDecoderFactory) 
-	: LiveVideoSource(uri, opts, videoDecoderFactory, false)
+	: LiveVideoSource(uri, getConnectionOptions(opts), videoDecoderFactory, false), m_opts(getConnectionOptions(opts)), m_current(0)
+	, m_failoverMs(kDefaultFailoverSeconds * 1000), m_lastDataTime(webrtc::TimeMillis()), m_failoverTask(NULL)
 {
 	RTC_LOG(LS_INFO) << "RTSPVideoCapturer " << uri ;
 
+	m_urls.push_back(uri);
+	if (opts.find("alternates") != opts.end()) {
+		std::istringstream is(opts.at("alternates"));
+		std::string url;
+		while (is >> url) {
+			m_urls.push_back(url);
+		}
+	}
+	if (opts.find("failover") != opts.end()) {
+		m_failoverMs = std::stoi(opts.at("failover")) * 1000;
+	}
+	if (m_urls.size() > 1) {
+		RTC_LOG(LS_INFO) << "RTSPVideoCapturer alternates:" << (m_urls.size() - 1) << " failover:" << m_failoverMs << "ms";
+	}
 }
 
 RTSPVideoCapturer::~RTSPVideoCapturer()
 {
+	// the live555 loop is joined first, then the alternate connections are torn down from this thread
+	this->Stop();
+	m_env.taskScheduler().unscheduleDelayedTask(m_failoverTask);
+	for (auto & it : m_alternates) {
+		it.second->stop();
+	}
+	m_alternates.clear();
 }
 
+bool RTSPVideoCapturer::onData(const char* id, unsigned char* buffer, ssize_t size, struct timeval presentationTime) {
+	m_lastDataTime = webrtc::TimeMillis();
+	return LiveVideoSource::onData(id, buffer, size, presentationTime);
+}
 
 void RTSPVideoCapturer::onError(RTSPConnection& connection, const char* error) {
-	RTC_LOG(LS_ERROR) << "RTSPVideoCapturer:onError url:" << m_liveclient.getUrl() <<  " error:" << error;
-	connection.start(1);
+	RTC_LOG(LS_ERROR) << "RTSPVideoCapturer:onError url:" << connection.getUrl() <<  " error:" << error;
+	this->restart(connection, 1);
 }		
 
+// retry the current url, or open the next one when the stream has no frame since the failover delay
+void RTSPVideoCapturer::restart(RTSPConnection& connection, unsigned int delay) {
+	if (&connection != &this->getConnection(m_current)) {
+		RTC_LOG(LS_VERBOSE) << "RTSPVideoCapturer:restart ignore previous url:" << connection.getUrl();
+		return;
+	}
+	if ( (m_urls.size() > 1) && (webrtc::TimeMillis() - m_lastDataTime >= m_failoverMs) ) {
+		// the connection is stopped outside of its callback
+		if (!m_failoverTask) {
+			m_failoverTask = m_env.taskScheduler().scheduleDelayedTask(0, RTSPVideoCapturer::TaskFailover, this);
+		}
+	} else {
+		connection.start(delay);
+	}
+}
+
+RTSPConnection& RTSPVideoCapturer::getConnection(size_t index) {
+	if (index == 0) {
+		return m_liveclient;
+	}
+	std::unique_ptr<RTSPConnection> & connection = m_alternates[index];
+	if (!connection) {
+		connection.reset(new RTSPConnection(m_env, this, m_urls[index].c_str(), m_opts, webrtc::LogMessage::GetLogToDebug()<=2));
+	}
+	return *connection;
+}
+
+// the decoder is kept, the parameter sets and the key frame of the next url resync it
+void RTSPVideoCapturer::failover() {
+	m_failoverTask = NULL;
+	this->getConnection(m_current).stop();
+	m_current = (m_current + 1) % m_urls.size();
+	RTC_LOG(LS_WARNING) << "RTSPVideoCapturer:failover to url:" << m_urls[m_current];
+	m_lastDataTime = webrtc::TimeMillis();
+	this->resync();
+	this->getConnection(m_current).start();
+}
+
 
 #endif
@@ -0,0 +1,301 @@
+/* ---------------------------------------------------------------------------
+ * SPDX-License-Identifier: Unlicense
+ *
+ * This is free and unencumbered software released into the public domain.
+ *
+ * Anyone is free to copy, modify, publish, use, compile, sell, or distribute this
+ * software, either in source code form or as a compiled binary, for any purpose,
+ * commercial or non-commercial, and by any means.
+ *
+ * For more information, please refer to <http://unlicense.org/>
+ * -------------------------------------------------------------------------*/
+
+#include <future>
+#include <chrono>
+#include <vector>
+#include <memory>
+
+#include "rtc_base/logging.h"
+#include "api/jsep.h"
+
+#include "civetweb.h"
+
+#include "webrtcvideosource.h"
+
+static const int kWhepTimeoutMs = 10000;
+static const int kGatheringTimeoutMs = 2000;
+static const int kReconnectDelayMs = 1000;
+
+// the promises are shared with the observers, they could complete after the timeout of the connection thread
+class OfferObserver : public webrtc::SetSessionDescriptionObserver {
+	public:
+		explicit OfferObserver(const std::shared_ptr<std::promise<bool>> & promise) : m_promise(promise) {}
+		void OnSuccess() override { m_promise->set_value(true); }
+		void OnFailure(webrtc::RTCError error) override {
+			RTC_LOG(LS_ERROR) << "WebRtcVideoSource SetLocalDescription error:" << error.message();
+			m_promise->set_value(false);
+		}
+	private:
+		std::shared_ptr<std::promise<bool>> m_promise;
+};
+
+class CreateOfferObserver : public webrtc::CreateSessionDescriptionObserver {
+	public:
+		CreateOfferObserver(const webrtc::scoped_refptr<webrtc::PeerConnectionInterface> & pc, const std::shared_ptr<std::promise<bool>> & promise) : m_pc(pc), m_promise(promise) {}
+		void OnSuccess(webrtc::SessionDescriptionInterface* desc) override {
+			m_pc->SetLocalDescription(webrtc::make_ref_counted<OfferObserver>(m_promise).get(), desc);
+		}
+		void OnFailure(webrtc::RTCError error) override {
+			RTC_LOG(LS_ERROR) << "WebRtcVideoSource CreateOffer error:" << error.message();
+			m_promise->set_value(false);
+		}
+	private:
+		webrtc::scoped_refptr<webrtc::PeerConnectionInterface> m_pc;
+		std::shared_ptr<std::promise<bool>>                    m_promise;
+};
+
+class AnswerObserver : public webrtc::SetRemoteDescriptionObserverInterface {
+	public:
+		explicit AnswerObserver(const std::shared_ptr<std::promise<bool>> & promise) : m_promise(promise) {}
+		void OnSetRemoteDescriptionComplete(webrtc::RTCError error) override {
+			if (!error.ok()) {
+				RTC_LOG(LS_ERROR) << "WebRtcVideoSource SetRemoteDescription error:" << error.message();
+			}
+			m_promise->set_value(error.ok());
+		}
+	private:
+		std::shared_ptr<std::promise<bool>> m_promise;
+};
+
+WebRtcVideoSource* WebRtcVideoSource::Create(const std::string & url, const std::map<std::string,std::string> & opts, webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> peerConnectionFactory, bool useNullCodec) {
+	std::unique_ptr<WebRtcVideoSource> source(new WebRtcVideoSource(url, opts, peerConnectionFactory, useNullCodec));
+	if (source->m_host.empty()) {
+		RTC_LOG(LS_ERROR) << "WebRtcVideoSource cannot parse url:" << url;
+		return nullptr;
+	}
+	source->m_thread = std::thread(&WebRtcVideoSource::ConnectionThread, source.get());
+	return source.release();
+}
+
+WebRtcVideoSource::WebRtcVideoSource(const std::string & url, const std::map<std::string,std::string> & opts, webrtc::scoped_refptr<webrtc::PeerConnectionFactoryInterface> peerConnectionFactory, bool useNullCodec)
+	: m_peerConnectionFactory(peerConnectionFactory), m_port(0), m_ssl(false), m_stop(false), m_gatheringComplete(false), m_failed(false), m_width(0), m_height(0) {
+
+	// webrtc://host[:port]/stream, the stream part is the url requested to the upstream instance
+	std::string prefix;
+	if (url.find("webrtcs://") == 0) {
+		prefix = "webrtcs://";
+		m_ssl = true;
+		m_port = 443;
+	} else {
+		prefix = "webrtc://";
+		m_port = 8000;
+	}
+	std::string address = url.substr(prefix.size());
+	size_t pos = address.find('/');
+	if ( (pos == std::string::npos) || (pos + 1 >= address.size()) ) {
+		return;
+	}
+	std::string stream = address.substr(pos + 1);
+	address = address.substr(0, pos);
+	pos = address.rfind(':');
+	if (pos != std::string::npos) {
+		m_port = std::stoi(address.substr(pos + 1));
+		address = address.substr(0, pos);
+	}
+
+	std::string whep = "/api/whep";
+	if (opts.find("whep") != opts.end()) {
+		whep = opts.at("whep");
+	}
+	std::vector<char> encoded(stream.size() * 3 + 1);
+	mg_url_encode(stream.c_str(), encoded.data(), encoded.size());
+	m_whepUri = whep + "?url=" + encoded.data();
+	if (useNullCodec) {
+		// ask the upstream instance to forward the encoded frames too
+		m_whepUri += "&options=nullcodec%3D1";
+	}
+	m_host = address;
+}
+
+WebRtcVideoSource::~WebRtcVideoSource() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_cond.notify_all();
+	if (m_thread.joinable()) {
+		m_thread.join();
+	}
+}
+
+void WebRtcVideoSource::ConnectionThread() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (!m_stop) {
+		lock.unlock();
+		bool connected = this->connect();
+		lock.lock();
+		if (connected) {
+			RTC_LOG(LS_INFO) << "WebRtcVideoSource connected to " << m_host << ":" << m_port << m_whepUri;
+			m_cond.wait(lock, [this] { return m_stop || m_failed; });
+		}
+		lock.unlock();
+		this->disconnect();
+		lock.lock();
+		if (!m_stop) {
+			m_cond.wait_for(lock, std::chrono::milliseconds(kReconnectDelayMs), [this] { return m_stop; });
+		}
+	}
+}
+
+bool WebRtcVideoSource::connect() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_gatheringComplete = false;
+		m_failed = false;
+	}
+
+	webrtc::PeerConnectionInterface::RTCConfiguration config;
+	config.sdp_semantics = webrtc::SdpSemantics::kUnifiedPlan;
+	webrtc::PeerConnectionDependencies dependencies(this);
+	webrtc::RTCErrorOr<webrtc::scoped_refptr<webrtc::PeerConnectionInterface>> result = m_peerConnectionFactory->CreatePeerConnectionOrError(config, std::move(dependencies));
+	if (!result.ok()) {
+		RTC_LOG(LS_ERROR) << "WebRtcVideoSource CreatePeerConnection error:" << result.error().message();
+		return false;
+	}
+	m_pc = result.MoveValue();
+
+	webrtc::RtpTransceiverInit init;
+	init.direction = webrtc::RtpTransceiverDirection::kRecvOnly;
+	if (!m_pc->AddTransceiver(webrtc::MediaType::VIDEO, init).ok()) {
+		RTC_LOG(LS_ERROR) << "WebRtcVideoSource AddTransceiver failed";
+		return false;
+	}
+
+	std::shared_ptr<std::promise<bool>> offerPromise = std::make_shared<std::promise<bool>>();
+	std::future<bool> offerFuture = offerPromise->get_future();
+	m_pc->CreateOffer(webrtc::make_ref_counted<CreateOfferObserver>(m_pc, offerPromise).get(), webrtc::PeerConnectionInterface::RTCOfferAnswerOptions());
+	if ( (offerFuture.wait_for(std::chrono::milliseconds(kWhepTimeoutMs)) != std::future_status::ready) || !offerFuture.get() ) {
+		return false;
+	}
+
+	// WHEP does not require trickle ICE, send the offer with its candidates
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait_for(lock, std::chrono::milliseconds(kGatheringTimeoutMs), [this] { return m_stop || m_gatheringComplete; });
+		if (m_stop) {
+			return false;
+		}
+	}
+	std::string offer;
+	m_pc->local_description()->ToString(&offer);
+
+	std::string answer;
+	std::string location;
+	int code = this->request("POST", m_whepUri, offer, answer, location);
+	if (code != 201) {
+		RTC_LOG(LS_ERROR) << "WebRtcVideoSource WHEP request " << m_host << ":" << m_port << m_whepUri << " status:" << code;
+		return false;
+	}
+	// the resource could be given as an absolute url
+	size_t pos = location.find("://");
+	if (pos != std::string::npos) {
+		pos = location.find('/', pos + 3);
+		location = (pos != std::string::npos) ? location.substr(pos) : "";
+	}
+	m_location = location;
+
+	webrtc::SdpParseError error;
+	std::unique_ptr<webrtc::SessionDescriptionInterface> desc(webrtc::CreateSessionDescription(webrtc::SdpType::kAnswer, answer, &error));
+	if (!desc) {
+		RTC_LOG(LS_ERROR) << "WebRtcVideoSource cannot parse answer:" << error.description;
+		return false;
+	}
+	std::shared_ptr<std::promise<bool>> answerPromise = std::make_shared<std::promise<bool>>();
+	std::future<bool> answerFuture = answerPromise->get_future();
+	m_pc->SetRemoteDescription(std::move(desc), webrtc::make_ref_counted<AnswerObserver>(answerPromise));
+	return (answerFuture.wait_for(std::chrono::milliseconds(kWhepTimeoutMs)) == std::future_status::ready) && answerFuture.get();
+}
+
+void WebRtcVideoSource::disconnect() {
+	if (m_pc) {
+		m_pc->Close();
+		m_pc = nullptr;
+	}
+	if (!m_location.empty()) {
+		std::string answer;
+		std::string location;
+		this->request("DELETE", m_location, "", answer, location);
+		m_location.clear();
+	}
+}
+
+int WebRtcVideoSource::request(const std::string & method, const std::string & uri, const std::string & body, std::string & answer, std::string & location) {
+	char error[256] = {0};
+	struct mg_connection *client = mg_connect_client(m_host.c_str(), m_port, m_ssl, error, sizeof(error));
+	if (!client) {
+		RTC_LOG(LS_ERROR) << "WebRtcVideoSource cannot connect to " << m_host << ":" << m_port << " " << error;
+		return 0;
+	}
+	mg_printf(client, "%s %s HTTP/1.1\r\n", method.c_str(), uri.c_str());
+	mg_printf(client, "Host: %s:%d\r\n", m_host.c_str(), m_port);
+	if (!body.empty()) {
+		mg_printf(client, "Content-Type: application/sdp\r\n");
+	}
+	mg_printf(client, "Content-Length: %zd\r\n\r\n", body.size());
+	mg_write(client, body.c_str(), body.size());
+
+	int code = 0;
+	if (mg_get_response(client, error, sizeof(error), kWhepTimeoutMs) >= 0) {
+		const struct mg_response_info *resp_info = mg_get_response_info(client);
+		code = resp_info->status_code;
+		for (int i = 0; i < resp_info->num_headers; i++) {
+			if (std::string(resp_info->http_headers[i].name) == "Location") {
+				location = resp_info->http_headers[i].value;
+			}
+		}
+		char buffer[1024];
+		int size = 0;
+		while ((size = mg_read(client, buffer, sizeof(buffer))) > 0) {
+			answer.append(buffer, size);
+		}
+	} else {
+		RTC_LOG(LS_ERROR) << "WebRtcVideoSource no response from " << m_host << ":" << m_port << " " << error;
+	}
+	mg_close_connection(client);
+	return code;
+}
+
+void WebRtcVideoSource::OnIceGatheringChange(webrtc::PeerConnectionInterface::IceGatheringState state) {
+	if (state == webrtc::PeerConnectionInterface::kIceGatheringComplete) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_gatheringComplete = true;
+		}
+		m_cond.notify_all();
+	}
+}
+
+void WebRtcVideoSource::OnConnectionChange(webrtc::PeerConnectionInterface::PeerConnectionState state) {
+	RTC_LOG(LS_INFO) << "WebRtcVideoSource state:" << webrtc::PeerConnectionInterface::AsString(state);
+	if ( (state == webrtc::PeerConnectionInterface::PeerConnectionState::kFailed) || (state == webrtc::PeerConnectionInterface::PeerConnectionState::kClosed) ) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_failed = true;
+		}
+		m_cond.notify_all();
+	}
+}
+
+void WebRtcVideoSource::OnTrack(webrtc::scoped_refptr<webrtc::RtpTransceiverInterface> transceiver) {
+	webrtc::scoped_refptr<webrtc::MediaStreamTrackInterface> track = transceiver->receiver()->track();
+	if (track && (track->kind() == webrtc::MediaStreamTrackInterface::kVideoKind)) {
+		RTC_LOG(LS_INFO) << "WebRtcVideoSource video track:" << track->id();
+		static_cast<webrtc::VideoTrackInterface*>(track.get())->AddOrUpdateSink(this, webrtc::VideoSinkWants());
+	}
+}
+
+void WebRtcVideoSource::OnFrame(const webrtc::VideoFrame& frame) {
+	m_width = frame.width();
+	m_height = frame.height();
+	m_broadcaster.OnFrame(frame);
+}